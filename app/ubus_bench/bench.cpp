@@ -0,0 +1,135 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "bench.hpp"
+
+#include <endian.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "frame.hpp"
+#include "ubus_master.hpp"
+
+static double percentile_us(const std::vector<uint64_t> &sorted, double ratio) {
+    size_t index = static_cast<size_t>(ratio * (sorted.size() - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+
+LatencySummary summarize_latency(std::vector<uint64_t> *samples) {
+    LatencySummary summary;
+    if (samples->empty()) {
+        return summary;
+    }
+    std::sort(samples->begin(), samples->end());
+    double total = 0;
+    for (uint64_t sample : *samples) {
+        total += sample;
+    }
+    summary.count = samples->size();
+    summary.mean_us = total / samples->size() / 1000.0;
+    summary.p50_us = percentile_us(*samples, 0.5);
+    summary.p99_us = percentile_us(*samples, 0.99);
+    summary.p999_us = percentile_us(*samples, 0.999);
+    summary.max_us = samples->back() / 1000.0;
+    return summary;
+}
+
+nlohmann::json latency_to_json(const LatencySummary &summary) {
+    nlohmann::json json_struct;
+    json_struct["count"] = summary.count;
+    json_struct["mean"] = summary.mean_us;
+    json_struct["p50"] = summary.p50_us;
+    json_struct["p99"] = summary.p99_us;
+    json_struct["p999"] = summary.p999_us;
+    json_struct["max"] = summary.max_us;
+    return json_struct;
+}
+
+BenchPayload::BenchPayload(size_t size) : body_(std::max(size, header_size)) {
+    for (size_t i = header_size; i < body_.size(); ++i) {
+        body_[i] = static_cast<uint8_t>(i);
+    }
+}
+
+void BenchPayload::serialize(std::string *data) const { data->assign(body_.begin(), body_.end()); }
+
+void BenchPayload::deserialize(const std::string &data) {
+    deserialize(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+}
+
+bool BenchPayload::serialize(uint8_t *data, size_t size) const {
+    if (size < body_.size()) {
+        return false;
+    }
+    memcpy(data, body_.data(), body_.size());
+    return true;
+}
+
+void BenchPayload::deserialize(const uint8_t *data, size_t size) { body_.assign(data, data + size); }
+
+void BenchPayload::stamp(uint64_t index) {
+    uint64_t fields[2] = {htobe64(monotonic_now_ns()), htobe64(index)};
+    memcpy(body_.data(), fields, header_size);
+}
+
+bool BenchPayload::read_stamp(const uint8_t *data, size_t size, uint64_t *send_time_ns, uint64_t *index) {
+    if (size < header_size) {
+        return false;
+    }
+    uint64_t fields[2];
+    memcpy(fields, data, header_size);
+    *send_time_ns = be64toh(fields[0]);
+    *index = be64toh(fields[1]);
+    return true;
+}
+
+bool BenchEnvironment::init(const std::string &master_ip,
+                            uint32_t master_port,
+                            bool external_master,
+                            const std::string &transport) {
+    master_ip_ = master_ip;
+    master_port_ = master_port;
+    transport_ = transport;
+    if (external_master) {
+        return true;
+    }
+    // runs until the process exits, like the participants
+    UBusMaster *master = new UBusMaster();
+    if (!master->init(master_ip, master_port)) {
+        LERROR(UBusBench) << "Failed to start master on " << master_ip << ":" << master_port;
+        return false;
+    }
+    std::thread(&UBusMaster::run, master).detach();
+    return true;
+}
+
+UBusRuntime *BenchEnvironment::participant(const std::string &role, uint32_t index) {
+    std::vector<UBusRuntime *> &runtimes = participants_[role];
+    while (runtimes.size() <= index) {
+        UBusRuntime *runtime = new UBusRuntime();
+        if (transport_ != "shm") {
+            runtime->configure_shared_memory(0, 0);
+        }
+        runtime->configure_unix_socket(transport_ != "tcp");
+        auto executor_threads = executor_threads_.find(role);
+        runtime->configure_method_executor(executor_threads != executor_threads_.end() ? executor_threads->second : 0);
+        auto event_executor_threads = event_executor_threads_.find(role);
+        if (event_executor_threads != event_executor_threads_.end()) {
+            runtime->configure_event_executor(event_executor_threads->second);
+        }
+        std::string name = "bench_" + role + "_" + std::to_string(getpid()) + "_" + std::to_string(runtimes.size());
+        if (!runtime->init(name, master_ip_, master_port_)) {
+            // not deleted, some of its threads may already run
+            LERROR(UBusBench) << "Failed to register " << name;
+            return nullptr;
+        }
+        runtimes.push_back(runtime);
+    }
+    return runtimes[index];
+}
+
+std::string BenchEnvironment::unique_name(const std::string &prefix) {
+    return "/bench/" + prefix + "/" + std::to_string(getpid()) + "_" + std::to_string(name_counter_++);
+}
@@ -0,0 +1,183 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "nlohmann/json.hpp"
+
+#include "message.hpp"
+#include "ubus_runtime.hpp"
+
+/// Latency distribution of one benchmark case, in microseconds
+struct LatencySummary {
+    uint64_t count = 0;
+    double mean_us = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double p999_us = 0;
+    double max_us = 0;
+};
+
+/// samples are in nanoseconds, they are sorted in place
+LatencySummary summarize_latency(std::vector<uint64_t> *samples);
+nlohmann::json latency_to_json(const LatencySummary &summary);
+
+/// Payload of size bytes, the first 16 bytes carry the send time and the index of the message so that the
+/// receiver measures the latency without deserializing the rest.
+class BenchPayload : public MessageBase {
+ public:
+    UBUS_MESSAGE("ubus.bench.BenchPayload", 1);
+    static constexpr size_t header_size = 2 * sizeof(uint64_t);
+    // index of the messages sent before the measurement, until every receiver got one
+    static constexpr uint64_t warm_up_index = UINT64_MAX;
+
+    explicit BenchPayload(size_t size = header_size);
+
+    virtual void serialize(std::string *data) const;
+    virtual void deserialize(const std::string &data);
+    virtual size_t serialized_size() const { return body_.size(); }
+    virtual bool serialize(uint8_t *data, size_t size) const;
+    virtual void deserialize(const uint8_t *data, size_t size);
+
+    /// stamps the message with the current time
+    void stamp(uint64_t index);
+    /// reads send time and index of a serialized payload, false if it is too short
+    static bool read_stamp(const uint8_t *data, size_t size, uint64_t *send_time_ns, uint64_t *index);
+
+ private:
+    std::vector<uint8_t> body_;
+};
+
+/// Master and participants shared by the cases of a run. Runtimes have no teardown, they are kept until the
+/// process exits and reused by the following cases.
+class BenchEnvironment {
+ public:
+    /// Starts a master in this process unless external_master is set. transport is tcp, unix or shm, the latter
+    /// also connecting through unix sockets.
+    bool init(const std::string &master_ip,
+              uint32_t master_port,
+              bool external_master,
+              const std::string &transport);
+    /// executor threads of the runtimes of role created afterwards, 0 by default
+    void configure_method_executor(const std::string &role, uint32_t thread_count) {
+        executor_threads_[role] = thread_count;
+    }
+    /// event executor threads of the runtimes of role created afterwards, the runtime's default otherwise
+    void configure_event_executor(const std::string &role, uint32_t thread_count) {
+        event_executor_threads_[role] = thread_count;
+    }
+    /// index-th runtime of role, registered to the master on first use, nullptr if it fails
+    UBusRuntime *participant(const std::string &role, uint32_t index);
+    /// topic or method name not used by an earlier case
+    std::string unique_name(const std::string &prefix);
+
+ private:
+    std::string master_ip_;
+    uint32_t master_port_ = 0;
+    std::string transport_;
+    std::unordered_map<std::string, std::vector<UBusRuntime *>> participants_;
+    std::unordered_map<std::string, uint32_t> executor_threads_;
+    std::unordered_map<std::string, uint32_t> event_executor_threads_;
+    uint32_t name_counter_ = 0;
+};
+
+struct PubSubCase {
+    uint64_t payload_size = 0;
+    uint32_t subscribers = 0;
+    uint32_t topics = 0;
+};
+
+struct PubSubOptions {
+    std::vector<uint64_t> payload_sizes;
+    std::vector<uint32_t> fan_outs;
+    std::vector<uint32_t> topic_counts;
+    // baseline of the dimensions not being swept
+    uint64_t base_payload_size = 256;
+    uint32_t base_fan_out = 1;
+    uint32_t base_topics = 1;
+    // per topic, reduced for large cases so that a case delivers at most max_bytes
+    uint32_t messages = 2000;
+    uint64_t max_bytes = 1ull << 30;
+    // messages per second and topic, 0 publishes as fast as possible
+    uint32_t rate = 0;
+    bool async_publish = false;
+    // topics are published to a multicast group, subscribers on shared memory keep reading it
+    bool multicast = false;
+    uint32_t multicast_datagram_size = 1472;
+    // EventOptions::batch_max_bytes and batch_max_delay_us of the topics, 0 bytes disables batching
+    uint32_t batch_bytes = 0;
+    uint32_t batch_delay_us = 500;
+    // EventOptions::compression of the topics, the payload repeats every 256 bytes
+    bool compression = false;
+    // the payload is serialized into a buffer loaned from the publisher instead of published with publish_event
+    bool loan = false;
+};
+
+/// Sweeps payload size, fan-out and topic count one at a time, the others staying at their baseline.
+/// Every topic has its own publishing thread, all topics of a case share one publishing runtime.
+class PubSubBench {
+ public:
+    PubSubBench(BenchEnvironment *environment, const PubSubOptions &options)
+        : environment_(environment), options_(options) {}
+    /// results of every case, printed to stdout as they complete
+    nlohmann::json run();
+
+ private:
+    struct Probe;
+    bool run_case(const PubSubCase &bench_case, nlohmann::json *result);
+
+    BenchEnvironment *environment_;
+    PubSubOptions options_;
+    // subscriptions outlive their case, so do the probes their callbacks write to
+    std::vector<std::shared_ptr<Probe>> probes_;
+};
+
+struct RpcCase {
+    // resolve the provider through the master for every call instead of the cache
+    bool master_lookup = false;
+    uint64_t request_size = 0;
+    uint64_t response_size = 0;
+    uint32_t callers = 0;
+    uint32_t handler_us = 0;
+};
+
+struct RpcOptions {
+    std::vector<std::string> lookups;
+    std::vector<uint64_t> request_sizes;
+    std::vector<uint64_t> response_sizes;
+    std::vector<uint32_t> caller_counts;
+    std::vector<uint32_t> handler_costs_us;
+    // baseline of the dimensions not being swept
+    uint64_t base_request_size = 64;
+    uint64_t base_response_size = 64;
+    uint32_t base_callers = 1;
+    uint32_t base_handler_us = 0;
+    // per caller, reduced for large cases so that a case moves at most max_bytes
+    uint32_t calls = 2000;
+    uint64_t max_bytes = 1ull << 30;
+    // MethodOptions::compression of the methods
+    bool compression = false;
+};
+
+/// Sweeps request size, response size, concurrent callers and handler cost one at a time, for every lookup mode.
+/// Every caller is a runtime of its own calling from its own thread, all methods are provided by one runtime.
+class RpcBench {
+ public:
+    RpcBench(BenchEnvironment *environment, const RpcOptions &options)
+        : environment_(environment), options_(options) {}
+    /// results of every case, printed to stdout as they complete
+    nlohmann::json run();
+
+ private:
+    bool run_case(const RpcCase &bench_case, nlohmann::json *result);
+
+    BenchEnvironment *environment_;
+    RpcOptions options_;
+};
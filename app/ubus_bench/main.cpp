@@ -0,0 +1,131 @@
+#include <fstream>
+#include <iostream>
+
+#include "CLI11.hpp"
+
+#include "bench.hpp"
+
+int main(int argc, char **argv) {
+    CLI::App app{"ubus-bench: throughput and latency benchmarks of ubus"};
+    std::string master_ip = "127.0.0.1";
+    app.add_option("--master_ip", master_ip, "ip of ubus master, default: 127.0.0.1");
+    uint32_t master_port = 5201;
+    app.add_option("--master_port", master_port, "port of ubus master, default: 5201");
+    bool external_master = false;
+    app.add_flag("--external_master", external_master, "use a running master instead of starting one in process");
+    std::string transport = "tcp";
+    app.add_option("--transport", transport,
+                   "tcp, unix for unix sockets, or shm for shared memory and unix sockets, default: tcp")
+        ->check(CLI::IsMember({"tcp", "unix", "shm"}));
+    std::string output;
+    app.add_option("--output", output, "file the results are written to as json");
+    int32_t log_level = 4;
+    app.add_option("--log_level", log_level, "log level of the runtimes, default: 4");
+    app.require_subcommand(1);
+
+    CLI::App *subcom_pubsub = app.add_subcommand("pubsub", "publish/subscribe throughput and latency");
+    PubSubOptions pubsub_options;
+    pubsub_options.payload_sizes = {16, 256, 4096, 65536, 1 << 20, 16 << 20};
+    pubsub_options.fan_outs = {1, 4, 16, 64, 256};
+    pubsub_options.topic_counts = {1, 4, 16, 64};
+    subcom_pubsub->add_option("--payload_sizes", pubsub_options.payload_sizes, "payload sizes in bytes to sweep")
+        ->delimiter(',');
+    subcom_pubsub->add_option("--fan_outs", pubsub_options.fan_outs, "subscriber counts per topic to sweep")
+        ->delimiter(',');
+    subcom_pubsub->add_option("--topic_counts", pubsub_options.topic_counts, "topic counts to sweep")->delimiter(',');
+    subcom_pubsub->add_option("--base_payload_size", pubsub_options.base_payload_size,
+                              "payload size of the fan-out and topic sweeps, default: 256");
+    subcom_pubsub->add_option("--messages", pubsub_options.messages, "messages per topic and case, default: 2000");
+    subcom_pubsub->add_option("--max_bytes", pubsub_options.max_bytes,
+                              "bytes delivered per case at most, fewer messages are sent for large cases");
+    subcom_pubsub->add_option("--rate", pubsub_options.rate, "messages per second and topic, default: unlimited");
+    subcom_pubsub->add_flag("--async", pubsub_options.async_publish, "publish through the asynchronous send queues");
+    subcom_pubsub->add_flag("--multicast", pubsub_options.multicast, "publish every topic to a multicast group");
+    subcom_pubsub->add_option("--multicast_datagram_size", pubsub_options.multicast_datagram_size,
+                              "UDP payload of the multicast datagrams, default: 1472");
+    subcom_pubsub->add_option("--batch_bytes", pubsub_options.batch_bytes,
+                              "pack events into frames of up to this many bytes, default: 0, no batching");
+    subcom_pubsub->add_option("--batch_delay_us", pubsub_options.batch_delay_us,
+                              "longest an event waits in a batch, default: 500");
+    subcom_pubsub->add_flag("--compression", pubsub_options.compression, "compress events of at least 1 KB with lz4");
+    subcom_pubsub->add_flag("--loan", pubsub_options.loan, "serialize events into buffers loaned from the publisher");
+    uint32_t subscriber_threads = 1;
+    subcom_pubsub->add_option("--subscriber_threads", subscriber_threads,
+                              "threads running the callbacks of a subscriber, 0 runs them in its event worker, "
+                              "default: 1");
+
+    CLI::App *subcom_rpc = app.add_subcommand("rpc", "method call throughput and latency");
+    RpcOptions rpc_options;
+    rpc_options.lookups = {"cached", "master"};
+    rpc_options.request_sizes = {16, 1024, 65536, 1 << 20};
+    rpc_options.response_sizes = {16, 1024, 65536, 1 << 20};
+    rpc_options.caller_counts = {1, 4, 16, 64};
+    rpc_options.handler_costs_us = {0, 10, 100, 1000};
+    subcom_rpc->add_option("--lookups", rpc_options.lookups,
+                           "cached resolves the provider once, master queries the master for every call")
+        ->delimiter(',')
+        ->check(CLI::IsMember({"cached", "master"}));
+    subcom_rpc->add_option("--request_sizes", rpc_options.request_sizes, "request sizes in bytes to sweep")
+        ->delimiter(',');
+    subcom_rpc->add_option("--response_sizes", rpc_options.response_sizes, "response sizes in bytes to sweep")
+        ->delimiter(',');
+    subcom_rpc->add_option("--caller_counts", rpc_options.caller_counts, "concurrent callers to sweep")->delimiter(',');
+    subcom_rpc->add_option("--handler_costs", rpc_options.handler_costs_us, "busy time of the handler in us to sweep")
+        ->delimiter(',');
+    subcom_rpc->add_option("--calls", rpc_options.calls, "calls per caller and case, default: 2000");
+    subcom_rpc->add_option("--max_bytes", rpc_options.max_bytes,
+                           "bytes moved per case at most, fewer calls are made for large cases");
+    uint32_t provider_threads = 4;
+    subcom_rpc->add_option("--provider_threads", provider_threads, "executor threads of the provider, default: 4");
+    subcom_rpc->add_flag("--compression", rpc_options.compression,
+                         "compress requests and responses of at least 1 KB with lz4");
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        return app.exit(e);
+    }
+    g_log_manager.SetLogLevel(log_level);
+
+    BenchEnvironment environment;
+    if (!environment.init(master_ip, master_port, external_master, transport)) {
+        return 1;
+    }
+    nlohmann::json report;
+    report["transport"] = transport;
+    if (subcom_pubsub->parsed()) {
+        environment.configure_event_executor("subscriber", subscriber_threads);
+        PubSubBench bench(&environment, pubsub_options);
+        report["benchmark"] = "pubsub";
+        report["async_publish"] = pubsub_options.async_publish;
+        report["rate"] = pubsub_options.rate;
+        report["multicast"] = pubsub_options.multicast;
+        report["batch_bytes"] = pubsub_options.batch_bytes;
+        report["batch_delay_us"] = pubsub_options.batch_delay_us;
+        report["compression"] = pubsub_options.compression;
+        report["loan"] = pubsub_options.loan;
+        report["subscriber_threads"] = subscriber_threads;
+        report["cases"] = bench.run();
+    } else if (subcom_rpc->parsed()) {
+        environment.configure_method_executor("provider", provider_threads);
+        RpcBench bench(&environment, rpc_options);
+        report["benchmark"] = "rpc";
+        report["provider_threads"] = provider_threads;
+        report["compression"] = rpc_options.compression;
+        report["cases"] = bench.run();
+    }
+
+    if (!output.empty()) {
+        std::ofstream file(output);
+        file << report.dump(4) << std::endl;
+        if (!file) {
+            std::cerr << "Failed to write " << output << std::endl;
+            return 1;
+        }
+    } else {
+        std::cout << report.dump(4) << std::endl;
+    }
+    // participants have no teardown, their threads still run
+    std::cout.flush();
+    _exit(0);
+}
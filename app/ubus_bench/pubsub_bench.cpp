@@ -0,0 +1,247 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "bench.hpp"
+
+#include <unistd.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "frame.hpp"
+
+/// Latencies of one subscription, written by its callback only
+struct PubSubBench::Probe {
+    std::vector<uint64_t> latencies;
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> last_receive_ns{0};
+    std::atomic<bool> warmed_up{false};
+};
+
+namespace {
+
+// a case ends once every message arrived or nothing arrived for this long
+const uint64_t idle_timeout_ns = 5000000000ull;
+const uint64_t warm_up_timeout_ns = 5000000000ull;
+
+void sleep_until_ns(uint64_t deadline_ns) {
+    uint64_t now = monotonic_now_ns();
+    if (deadline_ns > now) {
+        usleep((deadline_ns - now) / 1000);
+    }
+}
+
+}  // namespace
+
+nlohmann::json PubSubBench::run() {
+    std::vector<PubSubCase> cases;
+    auto add_case = [&cases](uint64_t payload_size, uint32_t subscribers, uint32_t topics) {
+        for (auto &bench_case : cases) {
+            if (bench_case.payload_size == payload_size && bench_case.subscribers == subscribers &&
+                bench_case.topics == topics) {
+                return;
+            }
+        }
+        cases.push_back({payload_size, subscribers, topics});
+    };
+    for (uint64_t payload_size : options_.payload_sizes) {
+        add_case(payload_size, options_.base_fan_out, options_.base_topics);
+    }
+    for (uint32_t fan_out : options_.fan_outs) {
+        add_case(options_.base_payload_size, fan_out, options_.base_topics);
+    }
+    for (uint32_t topics : options_.topic_counts) {
+        add_case(options_.base_payload_size, options_.base_fan_out, topics);
+    }
+
+    nlohmann::json results = nlohmann::json::array();
+    for (auto &bench_case : cases) {
+        nlohmann::json result;
+        result["payload_size"] = bench_case.payload_size;
+        result["subscribers"] = bench_case.subscribers;
+        result["topics"] = bench_case.topics;
+        if (!run_case(bench_case, &result)) {
+            LERROR(UBusBench) << "Case failed, payload " << bench_case.payload_size << " subscribers "
+                              << bench_case.subscribers << " topics " << bench_case.topics;
+            result["error"] = "failed";
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+bool PubSubBench::run_case(const PubSubCase &bench_case, nlohmann::json *result) {
+    if (bench_case.subscribers == 0 || bench_case.topics == 0) {
+        return false;
+    }
+    UBusRuntime *publisher = environment_->participant("publisher", 0);
+    if (publisher == nullptr) {
+        return false;
+    }
+    uint64_t case_bytes = std::max<uint64_t>(bench_case.payload_size, 1) * bench_case.subscribers * bench_case.topics;
+    uint64_t messages = std::min<uint64_t>(options_.messages, std::max<uint64_t>(10, options_.max_bytes / case_bytes));
+
+    EventOptions event_options;
+    event_options.async_publish = options_.async_publish;
+    // measures the throughput of the bus, not how many frames a policy drops
+    event_options.overflow_policy = OVERFLOW_BLOCK;
+    event_options.multicast = options_.multicast;
+    event_options.multicast_datagram_size = options_.multicast_datagram_size;
+    event_options.batch_max_bytes = options_.batch_bytes;
+    event_options.batch_max_delay_us = options_.batch_delay_us;
+    event_options.compression = options_.compression ? COMPRESSION_LZ4 : COMPRESSION_NONE;
+    std::vector<std::string> topics;
+    std::vector<std::shared_ptr<Probe>> probes;
+    std::vector<std::pair<UBusRuntime *, std::string>> subscriptions;
+    for (uint32_t t = 0; t < bench_case.topics; ++t) {
+        std::string topic = environment_->unique_name("pubsub");
+        if (!publisher->advertise_event<BenchPayload>(topic, event_options)) {
+            return false;
+        }
+        for (uint32_t s = 0; s < bench_case.subscribers; ++s) {
+            UBusRuntime *subscriber = environment_->participant("subscriber", s);
+            if (subscriber == nullptr) {
+                return false;
+            }
+            std::shared_ptr<Probe> probe = std::make_shared<Probe>();
+            probe->latencies.resize(messages);
+            Probe *target = probe.get();
+            bool subscribed = subscriber->subscribe_raw(topic, BenchPayload::id, [target](std::string_view data) {
+                uint64_t now = monotonic_now_ns();
+                uint64_t send_time_ns;
+                uint64_t index;
+                if (!BenchPayload::read_stamp(reinterpret_cast<const uint8_t *>(data.data()), data.size(),
+                                              &send_time_ns, &index)) {
+                    return;
+                }
+                if (index == BenchPayload::warm_up_index) {
+                    target->warmed_up.store(true);
+                    return;
+                }
+                uint64_t slot = target->received.load(std::memory_order_relaxed);
+                if (slot < target->latencies.size()) {
+                    target->latencies[slot] = now - send_time_ns;
+                }
+                target->last_receive_ns.store(now, std::memory_order_relaxed);
+                target->received.store(slot + 1, std::memory_order_release);
+            });
+            probes_.push_back(probe);
+            if (!subscribed) {
+                return false;
+            }
+            probes.push_back(probe);
+            subscriptions.emplace_back(subscriber, topic);
+        }
+        topics.push_back(topic);
+    }
+
+    // subscriptions are complete once every subscriber received a message
+    {
+        BenchPayload payload(bench_case.payload_size);
+        uint64_t deadline_ns = monotonic_now_ns() + warm_up_timeout_ns;
+        while (std::any_of(probes.begin(), probes.end(), [](auto &probe) { return !probe->warmed_up.load(); })) {
+            if (monotonic_now_ns() > deadline_ns) {
+                LERROR(UBusBench) << "Subscribers did not receive the warm up messages";
+                return false;
+            }
+            for (auto &topic : topics) {
+                payload.stamp(BenchPayload::warm_up_index);
+                publisher->publish_event(topic, payload);
+            }
+            usleep(10000);
+        }
+    }
+
+    uint64_t start_ns = monotonic_now_ns();
+    std::atomic<uint64_t> publish_failures{0};
+    std::vector<std::thread> publishing_threads;
+    for (auto &topic : topics) {
+        publishing_threads.emplace_back([&, topic] {
+            BenchPayload payload(bench_case.payload_size);
+            for (uint64_t i = 0; i < messages; ++i) {
+                if (options_.rate > 0) {
+                    sleep_until_ns(start_ns + i * 1000000000ull / options_.rate);
+                }
+                payload.stamp(i);
+                bool published;
+                if (options_.loan) {
+                    LoanedEvent loaned = publisher->loan<BenchPayload>(topic, payload.serialized_size());
+                    published = loaned.valid() && payload.serialize(loaned.data(), loaned.size()) &&
+                                publisher->publish(std::move(loaned));
+                } else {
+                    published = publisher->publish_event(topic, payload);
+                }
+                if (!published) {
+                    publish_failures.fetch_add(1);
+                }
+            }
+            // the last batch does not wait for its deadline
+            publisher->flush(topic);
+        });
+    }
+    for (auto &thread : publishing_threads) {
+        thread.join();
+    }
+    uint64_t publish_end_ns = monotonic_now_ns();
+
+    uint64_t expected = messages * probes.size();
+    uint64_t delivered = 0;
+    uint64_t last_progress_ns = monotonic_now_ns();
+    while (1) {
+        uint64_t total = 0;
+        for (auto &probe : probes) {
+            total += std::min<uint64_t>(probe->received.load(std::memory_order_acquire), messages);
+        }
+        uint64_t now = monotonic_now_ns();
+        if (total != delivered) {
+            delivered = total;
+            last_progress_ns = now;
+        }
+        if (delivered == expected || now - last_progress_ns > idle_timeout_ns) {
+            break;
+        }
+        usleep(1000);
+    }
+
+    uint64_t end_ns = publish_end_ns;
+    std::vector<uint64_t> latencies;
+    latencies.reserve(delivered);
+    for (auto &probe : probes) {
+        uint64_t received = std::min<uint64_t>(probe->received.load(std::memory_order_acquire), messages);
+        latencies.insert(latencies.end(), probe->latencies.begin(), probe->latencies.begin() + received);
+        end_ns = std::max<uint64_t>(end_ns, probe->last_receive_ns.load());
+    }
+    double elapsed = (end_ns - start_ns) / 1e9;
+    uint64_t published = messages * topics.size() - publish_failures.load();
+    LatencySummary latency = summarize_latency(&latencies);
+    // events the subscribers' callbacks fell too far behind for
+    uint64_t queue_dropped = 0;
+    for (auto &subscription : subscriptions) {
+        EventStats stats;
+        if (subscription.first->get_event_stats(subscription.second, &stats)) {
+            queue_dropped += stats.queue_dropped;
+        }
+    }
+
+    (*result)["messages_per_topic"] = messages;
+    (*result)["published"] = published;
+    (*result)["delivered"] = delivered;
+    (*result)["expected"] = expected;
+    (*result)["queue_dropped"] = queue_dropped;
+    (*result)["elapsed_sec"] = elapsed;
+    (*result)["msgs_per_sec"] = published / elapsed;
+    (*result)["deliveries_per_sec"] = delivered / elapsed;
+    (*result)["mb_per_sec"] = delivered * bench_case.payload_size / elapsed / 1e6;
+    (*result)["latency_us"] = latency_to_json(latency);
+
+    printf("payload %10lu B  subscribers %4u  topics %4u | %10.0f msg/s %10.0f deliveries/s %9.1f MB/s | "
+           "p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us | %lu/%lu delivered\n",
+           bench_case.payload_size, bench_case.subscribers, bench_case.topics, published / elapsed,
+           delivered / elapsed, delivered * bench_case.payload_size / elapsed / 1e6, latency.p50_us, latency.p99_us,
+           latency.p999_us, delivered, expected);
+    fflush(stdout);
+    return true;
+}
@@ -0,0 +1,159 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "bench.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "frame.hpp"
+
+nlohmann::json RpcBench::run() {
+    std::vector<RpcCase> cases;
+    for (auto &lookup : options_.lookups) {
+        bool master_lookup = lookup == "master";
+        auto add_case = [&cases, master_lookup](uint64_t request_size,
+                                                uint64_t response_size,
+                                                uint32_t callers,
+                                                uint32_t handler_us) {
+            for (auto &bench_case : cases) {
+                if (bench_case.master_lookup == master_lookup && bench_case.request_size == request_size &&
+                    bench_case.response_size == response_size && bench_case.callers == callers &&
+                    bench_case.handler_us == handler_us) {
+                    return;
+                }
+            }
+            cases.push_back({master_lookup, request_size, response_size, callers, handler_us});
+        };
+        for (uint64_t request_size : options_.request_sizes) {
+            add_case(request_size, options_.base_response_size, options_.base_callers, options_.base_handler_us);
+        }
+        for (uint64_t response_size : options_.response_sizes) {
+            add_case(options_.base_request_size, response_size, options_.base_callers, options_.base_handler_us);
+        }
+        for (uint32_t callers : options_.caller_counts) {
+            add_case(options_.base_request_size, options_.base_response_size, callers, options_.base_handler_us);
+        }
+        for (uint32_t handler_us : options_.handler_costs_us) {
+            add_case(options_.base_request_size, options_.base_response_size, options_.base_callers, handler_us);
+        }
+    }
+
+    nlohmann::json results = nlohmann::json::array();
+    for (auto &bench_case : cases) {
+        nlohmann::json result;
+        result["lookup"] = bench_case.master_lookup ? "master" : "cached";
+        result["request_size"] = bench_case.request_size;
+        result["response_size"] = bench_case.response_size;
+        result["callers"] = bench_case.callers;
+        result["handler_us"] = bench_case.handler_us;
+        if (!run_case(bench_case, &result)) {
+            LERROR(UBusBench) << "Case failed, request " << bench_case.request_size << " response "
+                              << bench_case.response_size << " callers " << bench_case.callers << " handler "
+                              << bench_case.handler_us << " us";
+            result["error"] = "failed";
+        }
+        results.push_back(result);
+    }
+    return results;
+}
+
+bool RpcBench::run_case(const RpcCase &bench_case, nlohmann::json *result) {
+    if (bench_case.callers == 0) {
+        return false;
+    }
+    UBusRuntime *provider = environment_->participant("provider", 0);
+    if (provider == nullptr) {
+        return false;
+    }
+    uint64_t call_bytes = std::max<uint64_t>(bench_case.request_size + bench_case.response_size, 1);
+    uint64_t affordable_calls = options_.max_bytes / call_bytes / bench_case.callers;
+    uint64_t calls = std::min<uint64_t>(options_.calls, std::max<uint64_t>(10, affordable_calls));
+
+    std::string method = environment_->unique_name("rpc");
+    std::shared_ptr<BenchPayload> response_body = std::make_shared<BenchPayload>(bench_case.response_size);
+    uint64_t handler_ns = bench_case.handler_us * 1000ull;
+    MethodOptions method_options;
+    method_options.compression = options_.compression ? COMPRESSION_LZ4 : COMPRESSION_NONE;
+    bool provided = provider->provide_method<BenchPayload, BenchPayload>(
+        method, std::function<void(const BenchPayload &, BenchPayload *)>(
+                    [response_body, handler_ns](const BenchPayload &, BenchPayload *response) {
+                        // busy, like a handler doing actual work would keep its thread
+                        uint64_t deadline_ns = monotonic_now_ns() + handler_ns;
+                        while (handler_ns > 0 && monotonic_now_ns() < deadline_ns) {
+                        }
+                        *response = *response_body;
+                    }),
+        method_options);
+    if (!provided) {
+        return false;
+    }
+
+    std::vector<UBusRuntime *> callers;
+    BenchPayload request(bench_case.request_size);
+    for (uint32_t i = 0; i < bench_case.callers; ++i) {
+        UBusRuntime *caller = environment_->participant(bench_case.master_lookup ? "lookup_caller" : "caller", i);
+        if (caller == nullptr) {
+            return false;
+        }
+        caller->configure_method_cache(!bench_case.master_lookup);
+        // opens the connection to the provider, and resolves it for the cached mode
+        BenchPayload response;
+        if (!caller->call_method(method, request, &response)) {
+            LERROR(UBusBench) << "Warm up call of " << method << " failed";
+            return false;
+        }
+        callers.push_back(caller);
+    }
+
+    std::vector<std::vector<uint64_t>> latencies(callers.size());
+    std::atomic<uint64_t> failures{0};
+    std::vector<std::thread> calling_threads;
+    uint64_t start_ns = monotonic_now_ns();
+    for (size_t i = 0; i < callers.size(); ++i) {
+        calling_threads.emplace_back([&, i] {
+            BenchPayload thread_request(bench_case.request_size);
+            BenchPayload response;
+            latencies[i].reserve(calls);
+            for (uint64_t call = 0; call < calls; ++call) {
+                uint64_t call_start_ns = monotonic_now_ns();
+                if (callers[i]->call_method(method, thread_request, &response)) {
+                    latencies[i].push_back(monotonic_now_ns() - call_start_ns);
+                } else {
+                    failures.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto &thread : calling_threads) {
+        thread.join();
+    }
+    double elapsed = (monotonic_now_ns() - start_ns) / 1e9;
+
+    std::vector<uint64_t> merged;
+    for (auto &caller_latencies : latencies) {
+        merged.insert(merged.end(), caller_latencies.begin(), caller_latencies.end());
+    }
+    uint64_t completed = merged.size();
+    LatencySummary latency = summarize_latency(&merged);
+
+    (*result)["calls_per_caller"] = calls;
+    (*result)["completed"] = completed;
+    (*result)["failed"] = failures.load();
+    (*result)["elapsed_sec"] = elapsed;
+    (*result)["calls_per_sec"] = completed / elapsed;
+    (*result)["mb_per_sec"] = completed * call_bytes / elapsed / 1e6;
+    (*result)["latency_us"] = latency_to_json(latency);
+
+    printf("%-6s request %9lu B  response %9lu B  callers %3u  handler %5u us | %9.0f calls/s %9.1f MB/s | "
+           "p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us | %lu failed\n",
+           bench_case.master_lookup ? "master" : "cached", bench_case.request_size, bench_case.response_size,
+           bench_case.callers, bench_case.handler_us, completed / elapsed, completed * call_bytes / elapsed / 1e6,
+           latency.p50_us, latency.p99_us, latency.p999_us, failures.load());
+    fflush(stdout);
+    return true;
+}
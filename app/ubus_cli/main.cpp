@@ -76,7 +76,7 @@ int main(int argc, char **argv) {
         debugger.init("debugger" + std::to_string(getpid()), master_ip, master_port);
         std::string response_body;
         debugger.request_method(request_method, request_type, request_body, response_type, &response_body);
-        std::cout << response_body << std::endl;
+        std::cout << UBusDebugger::printable(response_body) << std::endl;
     }
     return 0;
 }
\ No newline at end of file
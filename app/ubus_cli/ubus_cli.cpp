@@ -11,45 +11,19 @@ bool UBusDebugger::query_debug_info(const std::string &input, std::string *outpu
         return false;
     }
 
-    int32_t sock = this->control_sock_;
     Frame frame;
     frame.header.message_type = FRAME_DEBUG;
-    const char *char_struct = input.c_str();
     frame.header.data_length = htonl(static_cast<uint32_t>(input.size()));
     LDEBUG(UBusDebugger) << "Data length : " << ntohl(frame.header.data_length);
-    frame.data = new uint8_t[ntohl(frame.header.data_length)];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, input.size());
-    int32_t ret;
-    if ((ret = writen(sock, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LDEBUG(UBusDebugger) << "Write returned " << ret;
-    }
-    LDEBUG(UBusDebugger) << "Sent header";
-    if ((ret = writen(sock, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
-        LDEBUG(UBusDebugger) << "Write returned " << ret;
-    }
+    memcpy(frame.allocate(input.size()), input.data(), input.size());
 
-    {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(sock, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusDebugger) << "Failed to read header";
-            return false;
-        }
-        FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-        header->data_length = ntohl(header->data_length);
-        if (header->message_type != FRAME_DEBUG) {
-            LERROR(UBusDebugger) << "Invalid frame type " << static_cast<int32_t>(header->message_type);
-            return false;
-        }
-        char content_buff[header->data_length];
-        read_size = readn(sock, &content_buff, header->data_length);
-        if (read_size < header->data_length) {
-            LERROR(UBusDebugger) << "Failed to read content";
-        }
-        std::string content(content_buff, header->data_length);
-        *output = std::move(content);
-        return true;
+    std::string content;
+    if (!control_request(frame, &content)) {
+        LERROR(UBusDebugger) << "Failed to read response from master";
+        return false;
     }
+    *output = std::move(content);
+    return true;
 }
 
 bool UBusDebugger::query_event_list(std::string *out) {
@@ -209,139 +183,105 @@ bool UBusDebugger::echo_event(const std::string &topic) {
     json_struct["name"] = name_;
     std::string serialized_string = json_struct.dump();
 
-    const char *char_struct = serialized_string.c_str();
     frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-    frame.data = new uint8_t[serialized_string.size()];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-    int32_t ret;
-    if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
-    }
-    if ((ret = writen(control_sock_, static_cast<void *>(frame.data), serialized_string.size())) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
-    }
+    memcpy(frame.allocate(serialized_string.size()), serialized_string.data(), serialized_string.size());
 
-    {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(control_sock_, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusRuntime) << "Failed to read header";
-        } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-            char content_buff[header->data_length];
-            read_size = readn(control_sock_, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LERROR(UBusRuntime) << "Failed to read content";
-            }
-            std::string content(content_buff, header->data_length);
-            try {
-                nlohmann::json response_json = nlohmann::json::parse(content);
-                if (response_json.contains("response")) {
-                    if (response_json["response"] == "OK") {
-                        LINFO(UBusRuntime) << "Topic subscription registered to master";
-                        if (!response_json.contains("publisher_ip") || !response_json.contains("publisher_port") ||
-                            !response_json.contains("publisher_name")) {
-                            LERROR(UBusRuntime) << "Invalid reponse from master for subscription";
-                            return false;
-                        }
-                        int32_t sub_socket = 0;
-                        if ((sub_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-                            LERROR(UBusRuntime) << "Failed to create socket";
-                            control_sock_ = 0;
-                            return false;
-                        }
-                        sockaddr_in sub_sockaddr;
-                        bzero(&sub_sockaddr, sizeof(sub_sockaddr));
-                        sub_sockaddr.sin_family = AF_INET;
-                        sub_sockaddr.sin_port = htons(response_json.at("publisher_port").get<int32_t>());
-                        if (inet_pton(AF_INET, response_json.at("publisher_ip").get<std::string>().c_str(),
-                                      &sub_sockaddr.sin_addr) <= 0) {
-                            LERROR(UBusRuntime)
-                                << "Failed to convert ip address " << std::string(response_json.at("publisher_ip"));
-                            return false;
-                        }
+    std::string content;
+    if (!control_request(frame, &content)) {
+        LERROR(UBusRuntime) << "Failed to read response from master";
+        return false;
+    }
+    try {
+        nlohmann::json response_json = nlohmann::json::parse(content);
+        if (response_json.contains("response")) {
+            if (response_json["response"] == "OK") {
+                LINFO(UBusRuntime) << "Topic subscription registered to master";
+                if (!response_json.contains("publisher_ip") || !response_json.contains("publisher_port") ||
+                    !response_json.contains("publisher_name")) {
+                    LERROR(UBusRuntime) << "Invalid reponse from master for subscription";
+                    return false;
+                }
+                int32_t sub_socket = 0;
+                if ((sub_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+                    LERROR(UBusRuntime) << "Failed to create socket";
+                    return false;
+                }
+                sockaddr_in sub_sockaddr;
+                bzero(&sub_sockaddr, sizeof(sub_sockaddr));
+                sub_sockaddr.sin_family = AF_INET;
+                sub_sockaddr.sin_port = htons(response_json.at("publisher_port").get<int32_t>());
+                if (inet_pton(AF_INET, response_json.at("publisher_ip").get<std::string>().c_str(),
+                              &sub_sockaddr.sin_addr) <= 0) {
+                    LERROR(UBusRuntime)
+                        << "Failed to convert ip address " << std::string(response_json.at("publisher_ip"));
+                    return false;
+                }
 
-                        int32_t ret;
-                        if ((ret = connect(sub_socket, reinterpret_cast<sockaddr *>(&sub_sockaddr),
-                                           sizeof(sub_sockaddr))) != 0) {
-                            LERROR(UBusRuntime) << "Failed to connect to publisher, ret " << ret;
-                            return false;
-                        }
+                int32_t ret;
+                if ((ret = connect(sub_socket, reinterpret_cast<sockaddr *>(&sub_sockaddr),
+                                   sizeof(sub_sockaddr))) != 0) {
+                    LERROR(UBusRuntime) << "Failed to connect to publisher, ret " << ret;
+                    return false;
+                }
+                set_tcp_nodelay(sub_socket);
 
-                        SubEventInfo event_info;
-                        event_info.topic = topic;
-                        event_info.type = type_id;
-                        event_info.socket = sub_socket;
-                        event_info.publisher = response_json.at("publisher_name").get<std::string>();
-                        event_info.callback =
-                            std::make_shared<EventCallbackHolder<StringMsg> >([](const StringMsg &msg) {
-                                std::cout << msg.data << std::endl;
-                                std::cout << "---------" << std::endl;
-                            });
+                SubEventInfo event_info;
+                event_info.topic = topic;
+                event_info.type = type_id;
+                event_info.socket = sub_socket;
+                event_info.publisher = response_json.at("publisher_name").get<std::string>();
+                event_info.callback =
+                    std::make_shared<EventCallbackHolder<StringMsg> >([](const StringMsg &msg) {
+                        std::cout << printable(msg.data) << std::endl;
+                        std::cout << "---------" << std::endl;
+                    });
 
-                        // send subscribe message to publisher
-                        if ((ret = writen(sub_socket, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-                            LINFO(UBusRuntime) << "Write returned " << ret;
-                        }
-                        if ((ret = writen(sub_socket, static_cast<void *>(frame.data),
-                                          ntohl(frame.header.data_length))) < 0) {
-                            LINFO(UBusRuntime) << "Write returned " << ret;
-                        }
+                // send subscribe message to publisher
+                if ((ret = send_frame(sub_socket, frame)) < 0) {
+                    LINFO(UBusRuntime) << "Write returned " << ret;
+                }
 
-                        {
-                            char header_buff[sizeof(FrameHeader)];
-                            size_t read_size = readn(sub_socket, &header_buff, sizeof(FrameHeader));
-                            if (read_size < sizeof(FrameHeader)) {
-                                LERROR(UBusRuntime) << "Failed to read header";
-                            } else {
-                                FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-                                header->data_length = ntohl(header->data_length);
-                                LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-                                char content_buff[header->data_length];
-                                read_size = readn(sub_socket, &content_buff, header->data_length);
-                                if (read_size < header->data_length) {
-                                    LDEBUG(UBusRuntime) << "Failed to read content";
-                                }
-                                std::string content(content_buff, header->data_length);
-                                try {
-                                    nlohmann::json response_json = nlohmann::json::parse(content);
-                                    if (response_json.contains("response")) {
-                                        if (response_json["response"] == "OK") {
-                                            LINFO(UBusRuntime) << "Registered with publisher";
-                                            sub_list_[topic] = event_info;
-                                            unprocessed_new_sub_events_.push(topic);
-                                            return true;
-                                        } else {
-                                            LERROR(UBusRuntime) << "Failed to connect to "
-                                                                   "publisher";
-                                            return false;
-                                        }
-                                    } else {
-                                        LERROR(UBusRuntime) << "Failed to connect to publisher";
-                                        return false;
-                                    }
-                                } catch (nlohmann::json::exception &e) {
-                                    LERROR(UBusRuntime) << "Exception in json : " << e.what();
+                {
+                    FrameHeader header;
+                    std::string content;
+                    if (!read_frame(sub_socket, &header, &content)) {
+                        LERROR(UBusRuntime) << "Failed to read response from publisher";
+                    } else {
+                        LDEBUG(UBusRuntime) << "Size of data read : " << header.data_length;
+                        try {
+                            nlohmann::json response_json = nlohmann::json::parse(content);
+                            if (response_json.contains("response")) {
+                                if (response_json["response"] == "OK") {
+                                    LINFO(UBusRuntime) << "Registered with publisher";
+                                    add_sub_event(event_info);
+                                    return true;
+                                } else {
+                                    LERROR(UBusRuntime) << "Failed to connect to "
+                                                           "publisher";
                                     return false;
                                 }
+                            } else {
+                                LERROR(UBusRuntime) << "Failed to connect to publisher";
+                                return false;
                             }
+                        } catch (nlohmann::json::exception &e) {
+                            LERROR(UBusRuntime) << "Exception in json : " << e.what();
+                            return false;
                         }
-
-                    } else {
-                        LERROR(UBusRuntime) << "Error from master : " << std::string(response_json["response"]);
-                        return false;
                     }
-                } else {
-                    LERROR(UBusRuntime) << "Invalid response from master";
-                    return false;
                 }
-            } catch (nlohmann::json::exception &e) {
-                LERROR(UBusRuntime) << "Exception in json : " << e.what();
+
+            } else {
+                LERROR(UBusRuntime) << "Error from master : " << std::string(response_json["response"]);
                 return false;
             }
+        } else {
+            LERROR(UBusRuntime) << "Invalid response from master";
+            return false;
         }
+    } catch (nlohmann::json::exception &e) {
+        LERROR(UBusRuntime) << "Exception in json : " << e.what();
+        return false;
     }
     return true;
 }
@@ -361,4 +301,27 @@ bool UBusDebugger::request_method(const std::string &method_name,
     } else {
         return false;
     }
-}
\ No newline at end of file
+}
+
+std::string UBusDebugger::printable(const std::string &data) {
+    bool text = true;
+    for (unsigned char c : data) {
+        if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r') || c == 0x7f) {
+            text = false;
+            break;
+        }
+    }
+    if (text) {
+        return data;
+    }
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char c : data) {
+        if (!hex.empty()) {
+            hex += ' ';
+        }
+        hex += digits[c >> 4];
+        hex += digits[c & 0xf];
+    }
+    return hex;
+}
@@ -18,6 +18,17 @@ class DebugMsg : public MessageBase {
  public:
     virtual void serialize(std::string *data) const { *data = this->data; }
     virtual void deserialize(const std::string &data) { this->data = data; }
+    virtual size_t serialized_size() const { return this->data.size(); }
+    virtual bool serialize(uint8_t *data, size_t size) const {
+        if (this->data.size() > size) {
+            return false;
+        }
+        memcpy(data, this->data.data(), this->data.size());
+        return true;
+    }
+    virtual void deserialize(const uint8_t *data, size_t size) {
+        this->data.assign(reinterpret_cast<const char *>(data), size);
+    }
 
  public:
     std::string data;
@@ -40,4 +51,7 @@ class UBusDebugger : public UBusRuntime {
                         std::string *response);
 
     bool echo_event(const std::string &topic);
+
+    /// data as is when it is text, e.g. json, its bytes in hex otherwise, e.g. for plain struct messages
+    static std::string printable(const std::string &data);
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/// Payload of the frames flagged FRAME_FLAG_LZ4: uint32 size of the original payload (network order) followed by
+/// one LZ4 block (lz4_Block_format.md of the LZ4 project), which any LZ4 implementation decompresses.
+/// The compressor is a greedy single pass with a 4K entry hash table, close to LZ4_compress_fast at level 1.
+
+/// Compresses data into out, false if the result would not be smaller than data.
+bool compress_payload(const uint8_t *data, size_t length, std::vector<uint8_t> *out);
+
+/// size of the original payload, false if data is not a compressed payload or the size exceeds
+/// MAX_FRAME_DATA_LENGTH
+bool decompressed_size(const uint8_t *data, size_t length, uint32_t *size);
+
+/// out holds the decompressed_size of data, false if data is malformed
+bool decompress_payload(const uint8_t *data, size_t length, uint8_t *out, size_t out_length);
+bool decompress_payload(const uint8_t *data, size_t length, std::vector<uint8_t> *out);
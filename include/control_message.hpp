@@ -0,0 +1,87 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+/// Fields of the control frames exchanged with the master
+enum ControlTag : uint8_t {
+    CONTROL_TAG_UNKNOWN = 0,
+    CONTROL_TAG_RESPONSE,
+    CONTROL_TAG_NAME,
+    CONTROL_TAG_TOPIC,
+    CONTROL_TAG_TYPE_ID,
+    CONTROL_TAG_METHOD,
+    CONTROL_TAG_REQUEST_TYPE_ID,
+    CONTROL_TAG_RESPONSE_TYPE_ID,
+    CONTROL_TAG_PUBLISHER_IP,
+    CONTROL_TAG_PUBLISHER_PORT,
+    CONTROL_TAG_PUBLISHER_NAME,
+    CONTROL_TAG_PUBLISHER_LOCAL,
+    CONTROL_TAG_PROVIDER_IP,
+    CONTROL_TAG_PROVIDER_PORT,
+    CONTROL_TAG_PROVIDER_NAME,
+    CONTROL_TAG_PROVIDER_FRAME_VERSION,
+    // abstract AF_UNIX names, only sent to participants on the same host
+    CONTROL_TAG_PUBLISHER_UNIX_PATH,
+    CONTROL_TAG_PROVIDER_UNIX_PATH,
+    // asked for by the publisher of a topic, the master answers with the group and port of the topic
+    CONTROL_TAG_MULTICAST,
+    CONTROL_TAG_MULTICAST_GROUP,
+    CONTROL_TAG_MULTICAST_PORT,
+    // CompressionCodec of a method and the request size from which callers compress
+    CONTROL_TAG_COMPRESSION,
+    CONTROL_TAG_COMPRESSION_MIN_SIZE,
+    // message_fingerprint of the types, compared by the master along with the type ids when both sides sent one
+    CONTROL_TAG_TYPE_FINGERPRINT,
+    CONTROL_TAG_REQUEST_FINGERPRINT,
+    CONTROL_TAG_RESPONSE_FINGERPRINT,
+    CONTROL_TAG_MAX
+};
+
+/// Control frame content in the binary TLV encoding:
+///   uint8 version, then for every field: uint8 tag, uint16 length (network order), value
+/// Strings are stored as is, integers big endian on as few bytes as needed and booleans on one byte.
+/// Participants which did not negotiate the binary encoding in FRAME_INITIATION keep exchanging json, see
+/// from_json and to_json.
+class ControlMessage {
+ public:
+    static constexpr uint8_t version = 1;
+
+    ControlMessage() { clear(); }
+
+    void clear() { buffer_.assign(1, static_cast<char>(version)); }
+
+    void set_string(ControlTag tag, const std::string &value);
+    void set_uint(ControlTag tag, uint64_t value);
+    void set_bool(ControlTag tag, bool value) { set_uint(tag, value ? 1 : 0); }
+
+    bool contains(ControlTag tag) const { return find(tag, nullptr, nullptr); }
+    bool get_string(ControlTag tag, std::string *value) const;
+    bool get_uint(ControlTag tag, uint64_t *value) const;
+    bool get_uint(ControlTag tag, uint32_t *value) const;
+    bool get_bool(ControlTag tag, bool *value) const;
+    /// empty if the field is missing
+    std::string get_string(ControlTag tag) const;
+
+    /// true if data is in the binary encoding, json content starts with '{'
+    static bool is_binary(const uint8_t *data, size_t size) { return size > 0 && data[0] == version; }
+
+    /// takes over an encoded message, returns false if it is malformed
+    bool parse(const uint8_t *data, size_t size);
+    const std::string &encoded() const { return buffer_; }
+
+    bool from_json(const std::string &content);
+    std::string to_json() const;
+
+ private:
+    bool find(ControlTag tag, const char **value, uint16_t *length) const;
+    void append(ControlTag tag, const char *value, uint16_t length);
+
+    std::string buffer_;
+};
@@ -5,6 +5,17 @@
 #pragma once
 
 #include "stdint.h"
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <string.h>
+#include <time.h>
+
+#include <cstddef>
+#include <string>
+
+#include "helpers.hpp"
+#include "frame_pool.hpp"
 
 enum FrameType : uint8_t {
     FRAME_UNKNOWN = 0,
@@ -17,15 +28,139 @@ enum FrameType : uint8_t {
     FRAME_METHOD_QUERY,
     FRAME_METHOD_CALL,
     FRAME_METHOD_RESPONSE,
-    FRAME_DEBUG
+    FRAME_DEBUG,
+    // pushed by the master when the provider of a method changes
+    FRAME_METHOD_INVALIDATE,
+    // events packed by a batching publisher, each one as uint32 length (network order) followed by its payload.
+    // The version 2 header carries the sequence of the first one, the others follow it without gaps.
+    FRAME_EVENT_BATCH
 };
 
+/// Version 1 header, sent as the native struct. Still used on the master channel and in handshakes, and for
+/// peers which did not announce version 2.
 struct FrameHeader {
     FrameType message_type = FRAME_UNKNOWN;
     uint32_t data_length = 0;
 };
 
+// first byte of a version 2 header, never a valid FrameType so that readers tell both versions apart
+const uint8_t FRAME_MAGIC = 0xfb;
+const uint8_t FRAME_VERSION_1 = 1;
+const uint8_t FRAME_VERSION_2 = 2;
+
+/// Version 2 header, multi-byte fields are in network byte order on the wire
+struct FrameHeaderV2 {
+    uint8_t magic = FRAME_MAGIC;
+    uint8_t version = FRAME_VERSION_2;
+    FrameType message_type = FRAME_UNKNOWN;
+    // FRAME_FLAG_*
+    uint8_t flags = 0;
+    uint32_t data_length = 0;
+    // per stream (topic of a publisher, or connection), starts at 1, a gap means frames were dropped
+    uint64_t sequence = 0;
+    // CLOCK_MONOTONIC of the sender in nanoseconds, comparable between processes of the same host
+    uint64_t timestamp = 0;
+};
+static_assert(sizeof(FrameHeaderV2) == 24 && offsetof(FrameHeaderV2, data_length) == 4 &&
+                  offsetof(FrameHeaderV2, sequence) == 8 && offsetof(FrameHeaderV2, timestamp) == 16,
+              "FrameHeaderV2 must match the wire layout");
+
+// room for the header of any version
+const size_t MAX_FRAME_HEADER_SIZE = sizeof(FrameHeaderV2);
+// largest data_length accepted from a peer, larger frames are rejected before anything is allocated for them
+const uint32_t MAX_FRAME_DATA_LENGTH = 64u << 20;
+
+// the payload is compressed, see compression.hpp, for method frames the part after the MethodFrameHeader
+const uint8_t FRAME_FLAG_LZ4 = 0x01;
+// set on FRAME_METHOD_CALL by callers which read compressed responses
+const uint8_t FRAME_FLAG_ACCEPT_LZ4 = 0x02;
+
+inline uint64_t monotonic_now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+}
+
+/// Writes the wire header of a frame of the given version into out, returns its size.
+/// sequence and flags are ignored by version 1, the timestamp is taken now.
+inline size_t encode_frame_header(uint8_t version,
+                                  FrameType type,
+                                  uint32_t length,
+                                  uint64_t sequence,
+                                  uint8_t *out,
+                                  uint8_t flags = 0) {
+    if (version < FRAME_VERSION_2) {
+        FrameHeader header;
+        header.message_type = type;
+        header.data_length = htonl(length);
+        memcpy(out, &header, sizeof(FrameHeader));
+        return sizeof(FrameHeader);
+    }
+    FrameHeaderV2 header;
+    header.message_type = type;
+    header.flags = flags;
+    header.data_length = htonl(length);
+    header.sequence = htobe64(sequence);
+    header.timestamp = htobe64(monotonic_now_ns());
+    memcpy(out, &header, sizeof(FrameHeaderV2));
+    return sizeof(FrameHeaderV2);
+}
+
 struct Frame {
     FrameHeader header;
-    uint8_t *data;
-};
\ No newline at end of file
+    uint8_t *data = nullptr;
+    // owns data when it was taken with allocate
+    FrameBuffer buffer;
+
+    /// points data to a pooled buffer of size bytes, released with the frame
+    uint8_t *allocate(size_t size) {
+        buffer = FrameBuffer(size);
+        data = buffer.data();
+        return data;
+    }
+};
+
+/// Sends header and data of a frame with a single gathered write, header.data_length is in network byte order.
+inline ssize_t send_frame(int fd, const Frame &frame) {
+    iovec iov[2];
+    iov[0].iov_base = const_cast<FrameHeader *>(&frame.header);
+    iov[0].iov_len = sizeof(FrameHeader);
+    iov[1].iov_base = frame.data;
+    iov[1].iov_len = ntohl(frame.header.data_length);
+    return writevn(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+}
+
+/// Same as send_frame with a header of the given version.
+inline ssize_t send_frame(int fd,
+                          uint8_t version,
+                          FrameType type,
+                          const uint8_t *data,
+                          size_t length,
+                          uint64_t sequence,
+                          uint8_t flags = 0) {
+    uint8_t header[MAX_FRAME_HEADER_SIZE];
+    iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = encode_frame_header(version, type, length, sequence, header, flags);
+    iov[1].iov_base = const_cast<uint8_t *>(data);
+    iov[1].iov_len = length;
+    return writevn(fd, iov, length > 0 ? 2 : 1);
+}
+
+/// Blocking read of a version 1 frame. The content is read into the heap, up to max_data_length bytes.
+/// header->data_length is converted to host byte order, false if the peer closed before the frame is complete
+/// or announced a larger one, the stream cannot be read any further then.
+inline bool read_frame(int fd,
+                       FrameHeader *header,
+                       std::string *content,
+                       uint32_t max_data_length = MAX_FRAME_DATA_LENGTH) {
+    if (readn(fd, header, sizeof(FrameHeader)) < static_cast<ssize_t>(sizeof(FrameHeader))) {
+        return false;
+    }
+    header->data_length = ntohl(header->data_length);
+    if (header->data_length > max_data_length) {
+        return false;
+    }
+    content->resize(header->data_length);
+    return readn(fd, &(*content)[0], header->data_length) == static_cast<ssize_t>(header->data_length);
+}
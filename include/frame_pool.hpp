@@ -0,0 +1,69 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+
+/// Reference counted buffer taken from FramePool. Copies share the same memory, which goes back to the pool of
+/// the thread releasing the last reference.
+class FrameBuffer {
+ public:
+    FrameBuffer() = default;
+    /// size bytes, not initialized
+    explicit FrameBuffer(size_t size);
+    ~FrameBuffer() { reset(); }
+
+    FrameBuffer(const FrameBuffer &other);
+    FrameBuffer(FrameBuffer &&other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+    FrameBuffer &operator=(const FrameBuffer &other);
+    FrameBuffer &operator=(FrameBuffer &&other) noexcept;
+
+    uint8_t *data() const;
+    size_t size() const;
+    /// shrinks the buffer, or grows it within its size class
+    bool resize(size_t size);
+    void reset();
+    bool empty() const { return block_ == nullptr; }
+
+ private:
+    friend class FramePool;
+    struct Block;
+    Block *block_ = nullptr;
+};
+
+/// Power of two size classes from 256 bytes to 4 MiB, larger buffers go to the global allocator.
+/// Every thread keeps a small cache per class, blocks beyond it are moved to a shared list so that buffers
+/// released by another thread than the one which took them are reused as well. Both caches are bounded in bytes
+/// per class, so that a few large frames are not kept as long as thousands of small ones.
+class FramePool {
+ public:
+    static constexpr size_t min_block_size = 256;
+    static constexpr uint32_t class_count = 15;
+    // bytes of blocks kept by a thread per class before they are handed to the shared list, at least 2 blocks
+    // and at most thread_cache_size
+    static constexpr size_t thread_cache_bytes = 2 << 20;
+    static constexpr uint32_t thread_cache_size = 32;
+    // bytes of blocks kept by the shared list per class, at least 2 blocks, the others are freed
+    static constexpr size_t shared_cache_bytes = 8 << 20;
+
+    /// bytes currently held by blocks in use or cached
+    static size_t reserved_bytes() { return reserved_bytes_.load(std::memory_order_relaxed); }
+
+ private:
+    friend class FrameBuffer;
+    struct ThreadCache;
+    static void *acquire(size_t size, uint8_t *size_class);
+    static void release(void *block, uint8_t size_class);
+    /// keeps the block in the shared list if it has room, frees it otherwise
+    static void release_shared(void *block, uint8_t size_class);
+    /// nullptr once the cache of the calling thread is destroyed
+    static ThreadCache *thread_cache();
+    static size_t block_size(uint8_t size_class);
+
+    static std::atomic<size_t> reserved_bytes_;
+};
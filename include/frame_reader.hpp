@@ -0,0 +1,117 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "frame.hpp"
+
+/// Accumulates the bytes of a stream socket and splits them into frames, so that a reactor can drain every
+/// complete frame after a single wake up without blocking on a partial one.
+class FrameReader {
+ public:
+    /// frames announcing more than max_data_length bytes of data fail the reader
+    explicit FrameReader(uint32_t max_data_length = MAX_FRAME_DATA_LENGTH) : max_data_length_(max_data_length) {}
+
+    /// Reads everything available on fd without blocking.
+    /// Returns false once the peer closed the connection, on error or after the reader failed,
+    /// frames read before stay available.
+    bool fill(int32_t fd) {
+        while (!failed_) {
+            if (end_ == buffer_.size()) {
+                if (begin_ > 0) {
+                    reserve(buffer_.size());
+                } else {
+                    reserve(buffer_.size() < initial_size_ ? initial_size_ : buffer_.size() * 2);
+                }
+            }
+            ssize_t read_size = recv(fd, buffer_.data() + end_, buffer_.size() - end_, MSG_DONTWAIT);
+            if (read_size > 0) {
+                end_ += read_size;
+            } else if (read_size == 0) {
+                return false;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+        return false;
+    }
+
+    /// Pops the next complete frame, of either header version.
+    /// data points into the reader and stays valid until the next call of fill or next.
+    /// extended receives the version 2 fields in host byte order, version is FRAME_VERSION_1 for older frames.
+    bool next(FrameHeader *header, const uint8_t **data, FrameHeaderV2 *extended = nullptr) {
+        if (failed_ || end_ == begin_) {
+            return false;
+        }
+        size_t header_size = buffer_[begin_] == FRAME_MAGIC ? sizeof(FrameHeaderV2) : sizeof(FrameHeader);
+        if (end_ - begin_ < header_size) {
+            return false;
+        }
+        FrameHeaderV2 v2_header;
+        if (header_size == sizeof(FrameHeaderV2)) {
+            memcpy(&v2_header, buffer_.data() + begin_, sizeof(FrameHeaderV2));
+            v2_header.data_length = ntohl(v2_header.data_length);
+            v2_header.sequence = be64toh(v2_header.sequence);
+            v2_header.timestamp = be64toh(v2_header.timestamp);
+            header->message_type = v2_header.message_type;
+            header->data_length = v2_header.data_length;
+        } else {
+            memcpy(header, buffer_.data() + begin_, sizeof(FrameHeader));
+            header->data_length = ntohl(header->data_length);
+            v2_header.version = FRAME_VERSION_1;
+            v2_header.message_type = header->message_type;
+            v2_header.data_length = header->data_length;
+        }
+        if (header->data_length > max_data_length_) {
+            // nothing after it can be framed anymore, the connection has to be closed
+            failed_ = true;
+            return false;
+        }
+        size_t frame_size = header_size + header->data_length;
+        if (end_ - begin_ < frame_size) {
+            // make room for the whole frame at once instead of growing step by step
+            reserve(frame_size);
+            return false;
+        }
+        if (extended != nullptr) {
+            *extended = v2_header;
+        }
+        *data = buffer_.data() + begin_ + header_size;
+        begin_ += frame_size;
+        return true;
+    }
+
+    /// true once a frame exceeded the limit, the stream cannot be resynchronized
+    bool failed() const { return failed_; }
+
+ private:
+    /// moves the pending bytes to the front, then grows the buffer to hold at least size pending bytes
+    void reserve(size_t size) {
+        if (begin_ > 0) {
+            memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (buffer_.size() < size) {
+            buffer_.resize(size);
+        }
+    }
+
+    static const size_t initial_size_ = 4096;
+    uint32_t max_data_length_;
+    bool failed_ = false;
+    std::vector<uint8_t> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
@@ -5,11 +5,20 @@
 #pragma once
 
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 
+#include <string>
+
 /// Copied from Unix Network Programming
 
 inline ssize_t /* Read "n" bytes from a descriptor. */
@@ -55,4 +64,90 @@ writen(int fd, const void *vptr, size_t n) {
         ptr += nwritten;
     }
     return (n);
-}
\ No newline at end of file
+}
+/* end writen */
+
+inline ssize_t /* Write all "iovcnt" buffers to a descriptor with gathered writes. */
+writevn(int fd, struct iovec *iov, int iovcnt) {
+    size_t nwritten_total = 0;
+    ssize_t nwritten;
+    while (iovcnt > 0) {
+        if ((nwritten = writev(fd, iov, iovcnt)) <= 0) {
+            if (nwritten < 0 && errno == EINTR)
+                continue; /* and call writev() again */
+            else
+                return (-1); /* error */
+        }
+        nwritten_total += nwritten;
+        /* skip the buffers which are completely written, then resume in the middle of the partial one */
+        while (iovcnt > 0 && static_cast<size_t>(nwritten) >= iov->iov_len) {
+            nwritten -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+    return (nwritten_total);
+}
+/* end writevn */
+
+/// Small frames are flushed immediately instead of waiting for the ack of the previous one.
+inline int set_tcp_nodelay(int fd) {
+    int flag = 1;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+/// Connects a TCP socket to ip:port with TCP_NODELAY set, -1 if it fails.
+inline int connect_tcp(const std::string &ip, uint32_t port) {
+    sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) <= 0) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    set_tcp_nodelay(fd);
+    return fd;
+}
+
+/// Fills addr with the abstract AF_UNIX address of name, which lives outside the filesystem so that nothing is
+/// left behind by a process that did not clean up. Returns the length of the address, 0 if name is too long.
+inline socklen_t make_unix_address(const std::string &name, sockaddr_un *addr) {
+    bzero(addr, sizeof(sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (name.empty() || name.size() + 1 > sizeof(addr->sun_path)) {
+        return 0;
+    }
+    // a leading nul selects the abstract namespace
+    memcpy(addr->sun_path + 1, name.data(), name.size());
+    return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + name.size());
+}
+
+/// Connects a stream socket to the abstract AF_UNIX address of name, -1 if it fails.
+inline int connect_unix(const std::string &name) {
+    sockaddr_un addr;
+    socklen_t addr_length = make_unix_address(name, &addr);
+    if (addr_length == 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), addr_length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,96 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+
+#include "frame_pool.hpp"
+#include "shared_memory.hpp"
+
+class UBusRuntime;
+
+/// Buffer handed out by UBusRuntime::loan. The application writes the serialized event straight into it and
+/// UBusRuntime::publish sends it from there. Destroying it without publishing gives the buffer back.
+class LoanedEvent {
+ public:
+    LoanedEvent() = default;
+    ~LoanedEvent() { release(); }
+    LoanedEvent(LoanedEvent &&other) noexcept { *this = std::move(other); }
+    LoanedEvent &operator=(LoanedEvent &&other) noexcept;
+    LoanedEvent(const LoanedEvent &) = delete;
+    LoanedEvent &operator=(const LoanedEvent &) = delete;
+
+    /// false if the topic is not advertised with the loaned type
+    bool valid() const { return data_ != nullptr; }
+    uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+    /// shrinks the payload, for producers which only know an upper bound when loaning
+    bool resize(size_t size);
+    /// The buffer is the next slot of the shared memory ring of the topic, subscribers on this host get the event
+    /// without the publisher copying it. Only one loan of a topic holds the slot at a time.
+    bool in_shared_memory() const { return shm_ring_ != nullptr; }
+
+ private:
+    friend class UBusRuntime;
+    void release();
+
+    UBusRuntime *runtime_ = nullptr;
+    std::string topic_;
+    uint32_t type_ = 0;
+    uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+    // set when data_ points into the reserved slot of the ring, buffer_ holds it otherwise
+    std::shared_ptr<SharedMemoryRing> shm_ring_;
+    FrameBuffer buffer_;
+};
+
+/// Plain struct message constructed in place in a LoanedEvent, handed out by UBusRuntime::loan<EventT>(topic).
+/// The application fills it through get() or operator-> and UBusRuntime::publish sends its bytes from there.
+template <typename EventT>
+class LoanedMessage {
+    static_assert(std::is_trivially_copyable<EventT>::value, "only plain struct messages are constructed in place");
+    // ring slots and pooled buffers are 16 byte aligned
+    static_assert(alignof(EventT) <= 16, "EventT is aligned beyond the loaned buffers");
+
+ public:
+    LoanedMessage() = default;
+    explicit LoanedMessage(LoanedEvent &&event) : event_(std::move(event)) {
+        if (event_.valid()) {
+            message_ = new (event_.data()) EventT();
+        }
+    }
+    // the buffer moves along with event_, message_ stays valid
+    LoanedMessage(LoanedMessage &&other) noexcept : event_(std::move(other.event_)), message_(other.message_) {
+        other.message_ = nullptr;
+    }
+    LoanedMessage &operator=(LoanedMessage &&other) noexcept {
+        if (this != &other) {
+            event_ = std::move(other.event_);
+            message_ = other.message_;
+            other.message_ = nullptr;
+        }
+        return *this;
+    }
+
+    /// false if the topic is not advertised with EventT
+    bool valid() const { return message_ != nullptr; }
+    EventT *get() const { return message_; }
+    EventT *operator->() const { return message_; }
+    EventT &operator*() const { return *message_; }
+    bool in_shared_memory() const { return event_.in_shared_memory(); }
+
+ private:
+    friend class UBusRuntime;
+
+    LoanedEvent event_;
+    EventT *message_ = nullptr;
+};
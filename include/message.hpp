@@ -5,7 +5,14 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
 
 #include "definitions.hpp"
 
@@ -14,24 +21,201 @@ class MessageBase {
     virtual ~MessageBase() {}
     virtual void serialize(std::string *data) const = 0;
     virtual void deserialize(const std::string &data) = 0;
+
+    /// Buffer based interface, binary safe and written straight into the caller's buffer.
+    /// Messages which only implement the std::string interface keep working through the defaults.
+    static const size_t unknown_size = static_cast<size_t>(-1);
+
+    /// bytes written by serialize(uint8_t *, size_t), unknown_size if the message does not override it
+    virtual size_t serialized_size() const { return unknown_size; }
+    /// returns false if size is smaller than serialized_size()
+    virtual bool serialize(uint8_t *data, size_t size) const {
+        std::string buffer;
+        serialize(&buffer);
+        if (buffer.size() > size) {
+            return false;
+        }
+        memcpy(data, buffer.data(), buffer.size());
+        return true;
+    }
+    virtual void deserialize(const uint8_t *data, size_t size) {
+        deserialize(std::string(reinterpret_cast<const char *>(data), size));
+    }
+};
+
+/// Serializes message into buffer, which is meant to be reused so that the steady state does not allocate.
+inline bool serialize_message(const MessageBase &message, std::vector<uint8_t> *buffer) {
+    size_t size = message.serialized_size();
+    if (size == MessageBase::unknown_size) {
+        std::string data;
+        message.serialize(&data);
+        buffer->assign(data.begin(), data.end());
+        return true;
+    }
+    buffer->resize(size);
+    return message.serialize(buffer->data(), size);
+}
+
+/// Calls the buffer based deserialize, which may be hidden by the std::string overload of a derived message.
+/// Returns false if data cannot be the message, which only plain structs check.
+inline bool deserialize_message(MessageBase *message, const uint8_t *data, size_t size) {
+    message->deserialize(data, size);
+    return true;
+}
+
+/// Type id of a message from its declared name, FNV-1a of the characters. Numbers are taken as they are, ids below
+/// 256 are left to the built-in messages which keep the numbers older participants know them by.
+constexpr uint32_t message_type_id(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash = (hash ^ static_cast<uint8_t>(*name++)) * 16777619u;
+    }
+    return hash < 256 ? hash + 256 : hash;
+}
+
+constexpr uint32_t message_type_id(uint32_t id) { return id; }
+
+/// Declares the id and the schema version of a message derived from MessageBase:
+///     class Pose : public MessageBase {
+///      public:
+///         UBUS_MESSAGE("navigation.Pose", 2);
+///         ...
+///     };
+/// Bump the version whenever the serialized form changes, peers built against another version are refused when they
+/// subscribe or resolve the method instead of failing to parse every message.
+#define UBUS_MESSAGE(type_name, schema_version)                 \
+    static constexpr uint32_t id = message_type_id(type_name); \
+    static constexpr uint32_t schema = schema_version
+
+/// Declares the id of a plain struct sent as its bytes, without deriving from MessageBase:
+///     struct Telemetry {
+///         uint64_t stamp;
+///         float position[3];
+///         UBUS_POD_MESSAGE("robot.Telemetry");
+///     };
+/// Publisher and subscribers must agree on the layout, its size and alignment are part of the fingerprint. A
+/// `static constexpr uint32_t schema` may be declared as well for changes which keep both.
+#define UBUS_POD_MESSAGE(type_name) static constexpr uint32_t id = message_type_id(type_name)
+
+/// Messages which do not derive from MessageBase are plain structs, copied as they are.
+template <typename T>
+struct is_pod_message : std::integral_constant<bool, !std::is_base_of<MessageBase, T>::value> {
+    static_assert(std::is_base_of<MessageBase, T>::value || std::is_trivially_copyable<T>::value,
+                  "messages not derived from MessageBase must be trivially copyable");
 };
 
+/// schema version declared by the message, 0 if it declares none
+template <typename T, typename = void>
+struct message_schema : std::integral_constant<uint32_t, 0> {};
+
+template <typename T>
+struct message_schema<T, decltype(void(T::schema))> : std::integral_constant<uint32_t, T::schema> {};
+
+constexpr uint32_t fingerprint_mix(uint32_t hash, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 16777619u;
+    }
+    return hash;
+}
+
+/// Fingerprint of the wire format of a message, compared along with the type id when publishers and subscribers (or
+/// providers and callers) are matched. Plain structs mix in their size and alignment. 0 for messages which declare
+/// no schema, those are matched by id only.
+template <typename T>
+constexpr uint32_t message_fingerprint() {
+    if (!is_pod_message<T>::value && message_schema<T>::value == 0) {
+        return 0;
+    }
+    uint32_t hash = fingerprint_mix(2166136261u, message_schema<T>::value);
+    if (is_pod_message<T>::value) {
+        hash = fingerprint_mix(hash, static_cast<uint32_t>(sizeof(T)));
+        hash = fingerprint_mix(hash, static_cast<uint32_t>(alignof(T)));
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+template <typename T, typename std::enable_if<is_pod_message<T>::value, int>::type = 0>
+inline bool serialize_message(const T &message, std::vector<uint8_t> *buffer) {
+    buffer->resize(sizeof(T));
+    memcpy(buffer->data(), &message, sizeof(T));
+    return true;
+}
+
+template <typename T, typename std::enable_if<is_pod_message<T>::value, int>::type = 0>
+inline bool deserialize_message(T *message, const uint8_t *data, size_t size) {
+    if (size != sizeof(T)) {
+        return false;
+    }
+    memcpy(message, data, sizeof(T));
+    return true;
+}
+
+/// Points data to the bytes to send for message: plain structs are sent in place, the others are serialized into
+/// buffer first.
+template <typename T>
+inline bool message_payload(const T &message, std::vector<uint8_t> *buffer, const uint8_t **data, size_t *size) {
+    if (is_pod_message<T>::value) {
+        *data = reinterpret_cast<const uint8_t *>(&message);
+        *size = sizeof(T);
+        return true;
+    }
+    if (!serialize_message(message, buffer)) {
+        return false;
+    }
+    *data = buffer->data();
+    *size = buffer->size();
+    return true;
+}
+
+/// The numeric messages are sent as the text std::to_string gives, which older peers parse. It is formatted on the
+/// stack instead, the longest "%f" of a double is 317 characters.
+static const size_t number_text_capacity = 320;
+
+inline int format_number(char *text, size_t size, int32_t value) { return snprintf(text, size, "%" PRId32, value); }
+inline int format_number(char *text, size_t size, int64_t value) { return snprintf(text, size, "%" PRId64, value); }
+inline int format_number(char *text, size_t size, float32_t value) {
+    return snprintf(text, size, "%f", static_cast<float64_t>(value));
+}
+inline int format_number(char *text, size_t size, float64_t value) { return snprintf(text, size, "%f", value); }
+
+template <typename T>
+inline size_t number_text_size(T value) {
+    int length = format_number(nullptr, 0, value);
+    return length < 0 ? 0 : static_cast<size_t>(length);
+}
+
+template <typename T>
+inline bool serialize_number(T value, uint8_t *data, size_t size) {
+    char text[number_text_capacity];
+    int length = format_number(text, sizeof(text), value);
+    if (length < 0 || static_cast<size_t>(length) > size) {
+        return false;
+    }
+    memcpy(data, text, length);
+    return true;
+}
+
 class NullMsg : public MessageBase {
  public:
-    static const uint32_t id;
+    UBUS_MESSAGE(1, 1);
 
  public:
-    virtual void serialize(std::string *data) const {}
-    virtual void deserialize(const std::string &data) {}
+    virtual void serialize(std::string *) const {}
+    virtual void deserialize(const std::string &) {}
+    virtual size_t serialized_size() const { return 0; }
+    virtual bool serialize(uint8_t *, size_t) const { return true; }
+    virtual void deserialize(const uint8_t *, size_t) {}
 };
 
 class Int32Msg : public MessageBase {
  public:
-    static const uint32_t id;
+    UBUS_MESSAGE(2, 1);
 
  public:
     virtual void serialize(std::string *data) const { *data = std::to_string(this->data); }
     virtual void deserialize(const std::string &data) { this->data = atoi(data.c_str()); }
+    virtual size_t serialized_size() const { return number_text_size(this->data); }
+    virtual bool serialize(uint8_t *data, size_t size) const { return serialize_number(this->data, data, size); }
 
  public:
     int32_t data;
@@ -39,11 +223,13 @@ class Int32Msg : public MessageBase {
 
 class Int64Msg : public MessageBase {
  public:
-    static const uint32_t id;
+    UBUS_MESSAGE(3, 1);
 
  public:
     virtual void serialize(std::string *data) const { *data = std::to_string(this->data); }
     virtual void deserialize(const std::string &data) { this->data = atol(data.c_str()); }
+    virtual size_t serialized_size() const { return number_text_size(this->data); }
+    virtual bool serialize(uint8_t *data, size_t size) const { return serialize_number(this->data, data, size); }
 
  public:
     int64_t data;
@@ -51,11 +237,13 @@ class Int64Msg : public MessageBase {
 
 class Float32Msg : public MessageBase {
  public:
-    static const uint32_t id;
+    UBUS_MESSAGE(4, 1);
 
  public:
     virtual void serialize(std::string *data) const { *data = std::to_string(this->data); }
     virtual void deserialize(const std::string &data) { this->data = atof(data.c_str()); }
+    virtual size_t serialized_size() const { return number_text_size(this->data); }
+    virtual bool serialize(uint8_t *data, size_t size) const { return serialize_number(this->data, data, size); }
 
  public:
     float32_t data;
@@ -63,11 +251,13 @@ class Float32Msg : public MessageBase {
 
 class Float64Msg : public MessageBase {
  public:
-    static const uint32_t id;
+    UBUS_MESSAGE(5, 1);
 
  public:
     virtual void serialize(std::string *data) const { *data = std::to_string(this->data); }
     virtual void deserialize(const std::string &data) { this->data = atof(data.c_str()); }
+    virtual size_t serialized_size() const { return number_text_size(this->data); }
+    virtual bool serialize(uint8_t *data, size_t size) const { return serialize_number(this->data, data, size); }
 
  public:
     float64_t data;
@@ -75,11 +265,22 @@ class Float64Msg : public MessageBase {
 
 class StringMsg : public MessageBase {
  public:
-    static const uint32_t id;
+    UBUS_MESSAGE(6, 1);
 
  public:
     virtual void serialize(std::string *data) const { *data = this->data; }
     virtual void deserialize(const std::string &data) { this->data = data; }
+    virtual size_t serialized_size() const { return this->data.size(); }
+    virtual bool serialize(uint8_t *data, size_t size) const {
+        if (this->data.size() > size) {
+            return false;
+        }
+        memcpy(data, this->data.data(), this->data.size());
+        return true;
+    }
+    virtual void deserialize(const uint8_t *data, size_t size) {
+        this->data.assign(reinterpret_cast<const char *>(data), size);
+    }
 
  public:
     std::string data;
@@ -0,0 +1,95 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <endian.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <string_view>
+
+#include "frame.hpp"
+#include "helpers.hpp"
+
+const uint8_t METHOD_FRAME_VERSION = 1;
+
+enum MethodStatus : uint8_t {
+    METHOD_STATUS_OK = 0,
+    // unknown method or type ids not matching the provided ones
+    METHOD_STATUS_INVALID,
+    // the provider failed to serialize the response
+    METHOD_STATUS_ERROR
+};
+
+/// Leads the content of FRAME_METHOD_CALL and FRAME_METHOD_RESPONSE, followed by the serialized request or
+/// response. All fields are in network byte order on the wire.
+struct MethodFrameHeader {
+    uint8_t version = METHOD_FRAME_VERSION;
+    MethodStatus status = METHOD_STATUS_OK;
+    uint16_t reserved = 0;
+    // method_name_hash of the method
+    uint32_t method_id = 0;
+    uint32_t request_type_id = 0;
+    uint32_t response_type_id = 0;
+    // echoed in the response, callers match responses of concurrent calls by it
+    uint64_t request_id = 0;
+};
+static_assert(sizeof(MethodFrameHeader) == 24, "MethodFrameHeader must not be padded");
+
+/// 32-bit FNV-1a of the method name, providers reject a second method with the same id
+constexpr uint32_t method_name_hash(std::string_view method) {
+    uint32_t hash = 2166136261u;
+    for (char c : method) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+/// converts between host and network byte order, both ways
+inline MethodFrameHeader swap_method_header(const MethodFrameHeader &header) {
+    MethodFrameHeader swapped = header;
+    swapped.method_id = htonl(header.method_id);
+    swapped.request_type_id = htonl(header.request_type_id);
+    swapped.response_type_id = htonl(header.response_type_id);
+    swapped.request_id = htobe64(header.request_id);
+    return swapped;
+}
+
+/// Reads the method header at the beginning of a frame content, false if the content is too short or of an
+/// unsupported version
+inline bool parse_method_header(const uint8_t *data, size_t length, MethodFrameHeader *header) {
+    if (length < sizeof(MethodFrameHeader) || data[0] != METHOD_FRAME_VERSION) {
+        return false;
+    }
+    MethodFrameHeader network_header;
+    memcpy(&network_header, data, sizeof(MethodFrameHeader));
+    *header = swap_method_header(network_header);
+    return true;
+}
+
+/// Sends frame header of the given version, method header and payload with a single gathered write, the payload is
+/// not copied.
+inline ssize_t send_method_frame(int fd,
+                                 uint8_t version,
+                                 FrameType type,
+                                 const MethodFrameHeader &header,
+                                 const uint8_t *payload,
+                                 size_t length,
+                                 uint64_t sequence,
+                                 uint8_t flags = 0) {
+    uint8_t frame_header[MAX_FRAME_HEADER_SIZE];
+    MethodFrameHeader network_header = swap_method_header(header);
+    iovec iov[3];
+    iov[0].iov_base = frame_header;
+    iov[0].iov_len = encode_frame_header(version, type, static_cast<uint32_t>(sizeof(MethodFrameHeader) + length),
+                                         sequence, frame_header, flags);
+    iov[1].iov_base = &network_header;
+    iov[1].iov_len = sizeof(MethodFrameHeader);
+    iov[2].iov_base = const_cast<uint8_t *>(payload);
+    iov[2].iov_len = length;
+    return writevn(fd, iov, length > 0 ? 3 : 2);
+}
@@ -0,0 +1,88 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Header in front of every datagram of the multicast transport, all fields in network order.
+/// A message larger than one datagram is split into fragment_count datagrams sharing its sequence.
+struct MulticastFragmentHeader {
+    uint32_t magic = 0;
+    // method_name_hash of the topic, datagrams of another topic sent to the same group are ignored
+    uint32_t topic_hash = 0;
+    uint64_t sequence = 0;
+    uint64_t timestamp = 0;
+    uint32_t total_length = 0;
+    uint32_t offset = 0;
+    uint16_t fragment_index = 0;
+    uint16_t fragment_count = 0;
+    uint32_t reserved = 0;
+};
+static_assert(sizeof(MulticastFragmentHeader) == 40, "MulticastFragmentHeader must not be padded");
+
+/// Publisher side of a topic using multicast: one datagram per fragment, whatever the number of subscribers.
+class MulticastSender {
+ public:
+    MulticastSender() = default;
+    ~MulticastSender();
+    MulticastSender(const MulticastSender &) = delete;
+    MulticastSender &operator=(const MulticastSender &) = delete;
+
+    /// interface is the address of the interface to send from, empty for the default route.
+    /// datagram_size includes the fragment header.
+    bool open(const std::string &topic,
+              const std::string &group,
+              uint32_t port,
+              const std::string &interface,
+              uint32_t datagram_size);
+
+    /// returns false if a fragment could not be sent
+    bool send(uint64_t sequence, uint64_t timestamp, const uint8_t *data, size_t length);
+
+ private:
+    int32_t socket_ = -1;
+    sockaddr_in group_address_ = {};
+    uint32_t topic_hash_ = 0;
+    uint32_t fragment_size_ = 0;
+};
+
+/// Subscriber side, joins the group and reassembles the fragments. Only one message is reassembled at a time,
+/// a message is lost as soon as a fragment of a newer one arrives before it is complete.
+class MulticastReceiver {
+ public:
+    MulticastReceiver() = default;
+    ~MulticastReceiver();
+    MulticastReceiver(const MulticastReceiver &) = delete;
+    MulticastReceiver &operator=(const MulticastReceiver &) = delete;
+
+    bool open(const std::string &topic, const std::string &group, uint32_t port, const std::string &interface);
+
+    /// non blocking, to be polled for EPOLLIN
+    int32_t socket() const { return socket_; }
+
+    /// Reads pending datagrams until a message is complete. Returns 1 with the message, which stays valid until
+    /// the next call, 0 when no datagram is pending and -1 on error.
+    int32_t receive(uint64_t *sequence, uint64_t *timestamp, std::string_view *message);
+
+    /// messages of which only some fragments arrived
+    uint64_t incomplete_count() const { return incomplete_count_; }
+
+ private:
+    int32_t socket_ = -1;
+    uint32_t topic_hash_ = 0;
+    std::vector<uint8_t> datagram_;
+    // message being reassembled
+    uint64_t sequence_ = 0;
+    std::vector<uint8_t> message_;
+    std::vector<bool> fragments_;
+    uint32_t missing_fragments_ = 0;
+    uint64_t incomplete_count_ = 0;
+};
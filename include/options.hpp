@@ -0,0 +1,54 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/// What an asynchronous publisher does when the queue of a subscriber is full
+enum OverflowPolicy : uint8_t {
+    OVERFLOW_DROP_OLDEST = 0,
+    OVERFLOW_DROP_NEWEST,
+    OVERFLOW_BLOCK
+};
+
+/// Codec of the payloads written to sockets, see compression.hpp
+enum CompressionCodec : uint8_t {
+    COMPRESSION_NONE = 0,
+    COMPRESSION_LZ4
+};
+
+/// Per topic settings, given to advertise_event
+struct EventOptions {
+    // publish_event only queues the frame, the runtime's publish worker sends it to the subscribers
+    bool async_publish = false;
+    // frames queued per subscriber in async mode
+    uint32_t queue_depth = 64;
+    OverflowPolicy overflow_policy = OVERFLOW_DROP_OLDEST;
+    // Sends every event once to the multicast group the master assigns to the topic instead of once per subscriber.
+    // Datagrams may be lost, subscribers see the gaps in their EventStats. Subscribers reading from shared memory
+    // keep doing so.
+    bool multicast = false;
+    // UDP payload of a datagram, larger events are fragmented. Up to 65507 on loopback.
+    uint32_t multicast_datagram_size = 1472;
+    // Packs events into one frame per subscriber until batch_max_bytes of them are pending or the first one waited
+    // batch_max_delay_us, see UBusRuntime::flush. 0 sends every event on its own. The latency in EventStats is
+    // measured from the moment the batch is sent.
+    uint32_t batch_max_bytes = 0;
+    uint32_t batch_max_delay_us = 500;
+    // Events (or batches) of at least compression_min_size bytes are compressed for the subscribers reading them
+    // through a socket, when it makes them smaller. Older subscribers get them as is.
+    CompressionCodec compression = COMPRESSION_NONE;
+    uint32_t compression_min_size = 1024;
+};
+
+/// Per method settings, given to provide_method
+struct MethodOptions {
+    // calls of this method running at the same time on the executor, 0 means only bounded by the executor
+    uint32_t max_concurrency = 0;
+    // Requests and responses of at least compression_min_size bytes are compressed, callers learn it from the
+    // master. Older callers send and get them as is.
+    CompressionCodec compression = COMPRESSION_NONE;
+    uint32_t compression_min_size = 1024;
+};
@@ -0,0 +1,86 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+
+/// Broadcast ring of fixed size slots in a POSIX shared memory segment, used for same-host event delivery.
+/// There is one producer (the publisher of the topic) and any number of consumers. Every consumer owns its read
+/// cursor, so a slow subscriber gets overrun instead of blocking the publisher. Consumers sleep on a futex which
+/// lives inside the segment and is only woken when somebody is actually waiting.
+class SharedMemoryRing {
+ public:
+    SharedMemoryRing() = default;
+    ~SharedMemoryRing();
+    SharedMemoryRing(const SharedMemoryRing &) = delete;
+    SharedMemoryRing &operator=(const SharedMemoryRing &) = delete;
+
+    /// producer side, replaces any stale segment with the same name
+    bool create(const std::string &name, uint32_t slot_count, uint32_t slot_size);
+    /// consumer side, reading starts with the next message written after this call
+    bool open(const std::string &name);
+
+    /// returns false if the ring is not created or the message does not fit in a slot. event_sequence and
+    /// event_timestamp are handed to the consumers along with the message.
+    bool write(const void *data, size_t length, uint64_t event_sequence = 0, uint64_t event_timestamp = 0);
+
+    /// Producer side write in place: hands out the next slot for up to length bytes, consumers see it once it is
+    /// committed. Nothing else may be written to the ring until commit or abort. nullptr if the message does not fit
+    /// or a slot is already reserved.
+    uint8_t *reserve(size_t length);
+    /// publishes the first length bytes of the reserved slot, false if none is reserved
+    bool commit(size_t length, uint64_t event_sequence = 0, uint64_t event_timestamp = 0);
+    /// gives the reserved slot back, its previous message is lost
+    void abort() { reserved_ = false; }
+
+    /// returns 1 when a message is read, 0 on timeout and -1 on error
+    int32_t read(std::string *data,
+                 uint32_t timeout_ms,
+                 uint64_t *event_sequence = nullptr,
+                 uint64_t *event_timestamp = nullptr);
+
+    uint32_t slot_size() const;
+    uint64_t overrun_count() const { return overrun_count_; }
+    const std::string &name() const { return name_; }
+
+    static std::string make_name(const std::string &publisher, const std::string &topic);
+
+ private:
+    struct RingHeader {
+        uint32_t magic;
+        uint32_t slot_count;
+        uint32_t slot_size;
+        uint32_t slot_stride;
+        std::atomic<uint64_t> write_sequence;
+        std::atomic<uint32_t> futex_word;
+        std::atomic<uint32_t> waiters;
+    };
+    struct SlotHeader {
+        // 2 * seq + 1 while message seq is written, 2 * seq + 2 once it is committed
+        std::atomic<uint64_t> sequence;
+        uint32_t length;
+        uint32_t reserved;
+        // given by the producer, e.g. the sequence number and the timestamp of the frame header
+        uint64_t event_sequence;
+        uint64_t event_timestamp;
+    };
+
+    bool map(int32_t fd, size_t size);
+    SlotHeader *slot(uint64_t sequence) const;
+
+    std::string name_;
+    RingHeader *header_ = nullptr;
+    size_t mapped_size_ = 0;
+    bool owner_ = false;
+    // set between reserve and commit or abort
+    bool reserved_ = false;
+    size_t reserved_length_ = 0;
+    uint64_t read_sequence_ = 0;
+    uint64_t overrun_count_ = 0;
+};
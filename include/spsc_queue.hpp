@@ -0,0 +1,73 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+/// Bounded lock-free ring with one producer and one consumer thread at a time. A consumer may hand over to another
+/// thread as long as the handover is synchronized, e.g. through a task queue.
+template <typename T>
+class SpscQueue {
+ public:
+    /// capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) : mask_(round_up(capacity) - 1), slots_(mask_ + 1) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /// false if the queue is full, value is left as is then
+    bool push(T &&value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// false if the queue is empty, the slot is moved from so that it does not hold on to the value
+    bool pop(T *value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        *value = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// exact from the producer or the consumer, a snapshot from any other thread
+    size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask_ + 1; }
+
+ private:
+    static size_t round_up(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    const size_t mask_;
+    std::vector<T> slots_;
+    // written by the consumer, along with its last view of tail_
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;
+    // written by the producer, along with its last view of head_
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;
+};
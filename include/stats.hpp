@@ -0,0 +1,60 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/// Counters of one subscription, taken from the version 2 headers of the received frames and from the shared memory
+/// slots. Both arrive on their own thread, so an event may arrive after a later one of the other transport.
+struct EventStats {
+    uint64_t received = 0;
+    // frames missing between two received sequence numbers, less those which arrived late
+    uint64_t dropped = 0;
+    uint64_t last_sequence = 0;
+    // one-way latency, only meaningful when the publisher runs on the same host
+    uint64_t last_latency_ns = 0;
+    uint64_t max_latency_ns = 0;
+    uint64_t total_latency_ns = 0;
+    // events received and not through the callback yet, when callbacks run on the event executor
+    uint64_t queue_depth = 0;
+    // events dropped on receipt because the callback fell queue_depth events behind
+    uint64_t queue_dropped = 0;
+    // bit i is set once last_sequence - 1 - i is received, a late event is taken back from dropped only once,
+    // events later than the window stay dropped
+    uint64_t received_window = 0;
+    static const uint64_t sequence_window = 64;
+
+    /// sequence 0 comes from a version 1 header, which only counts as received
+    void update(uint64_t sequence, uint64_t timestamp, uint64_t now) {
+        ++received;
+        if (sequence == 0) {
+            return;
+        }
+        if (last_sequence == 0) {
+            last_sequence = sequence;
+        } else if (sequence > last_sequence) {
+            uint64_t shift = sequence - last_sequence;
+            dropped += shift - 1;
+            if (shift > sequence_window) {
+                received_window = 0;
+            } else {
+                // the previous last_sequence goes to bit shift - 1
+                received_window = (shift < sequence_window ? received_window << shift : 0) | (1ull << (shift - 1));
+            }
+            last_sequence = sequence;
+        } else if (sequence < last_sequence) {
+            uint64_t bit = last_sequence - 1 - sequence;
+            if (bit < sequence_window && !(received_window & (1ull << bit))) {
+                received_window |= 1ull << bit;
+                dropped -= dropped > 0 ? 1 : 0;
+            }
+        }
+        last_latency_ns = now > timestamp ? now - timestamp : 0;
+        if (last_latency_ns > max_latency_ns) {
+            max_latency_ns = last_latency_ns;
+        }
+        total_latency_ns += last_latency_ns;
+    }
+};
@@ -20,9 +20,13 @@
 #include <mutex>
 #include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "version.hpp"
 #include "definitions.hpp"
+#include "frame.hpp"
+#include "frame_reader.hpp"
+#include "control_message.hpp"
 
 #include "nlohmann/json.hpp"
 
@@ -44,6 +48,13 @@ class UBusMaster {
         uint32_t socket = 0;
         std::string listening_ip;
         uint32_t listening_port = 0;
+        std::string host_id;
+        // abstract AF_UNIX name the participant listens on as well, empty if it does not
+        std::string unix_path;
+        // negotiated in FRAME_INITIATION, json otherwise
+        bool binary_control = false;
+        // highest frame header version the participant reads
+        uint8_t frame_version = FRAME_VERSION_1;
         std::unordered_map<std::string, uint32_t> published_topic_list;
         std::unordered_map<std::string, uint32_t> subscribed_topic_list;
         std::unordered_map<std::string, std::pair<uint32_t, uint32_t> > method_list;
@@ -52,41 +63,78 @@ class UBusMaster {
     struct EventInfo {
         std::string name;
         uint32_t type;
+        // 0 if the publisher sent none
+        uint32_t fingerprint = 0;
         std::shared_ptr<UBusParticipantInfo> publisher;
         std::vector<std::shared_ptr<UBusParticipantInfo> > subscribers;
+        // empty unless the publisher asked for multicast
+        std::string multicast_group;
+        uint32_t multicast_port = 0;
     };
     struct MethodInfo {
         std::string name;
         uint32_t request_type;
         uint32_t response_type;
+        uint32_t request_fingerprint = 0;
+        uint32_t response_fingerprint = 0;
         std::shared_ptr<UBusParticipantInfo> provider;
+        // announced by the provider, passed on to the callers
+        uint32_t compression = 0;
+        uint32_t compression_min_size = 0;
     };
     std::unordered_map<std::string, std::shared_ptr<UBusParticipantInfo> > participant_list_;
     std::unordered_map<uint32_t, std::shared_ptr<UBusParticipantInfo> > socket_participant_mapping_;
     std::shared_mutex participant_info_mtx_;
 
-    std::queue<std::string> unprocessed_new_participants_;
-    std::mutex unprocessed_new_participants_mtx_;
+    // accepted sockets with their peer address, the control worker reads their FRAME_INITIATION
+    std::queue<std::pair<int32_t, sockaddr_in> > unprocessed_new_connections_;
+    std::mutex unprocessed_new_connections_mtx_;
     std::queue<std::string> unprocessed_dead_participants_;
     std::mutex unprocessed_dead_participants_mtx_;
 
     std::unordered_map<std::string, EventInfo> event_list_;
+    // groups are handed out in order from 239.255.0.1, guarded by event_list_mtx_
+    uint32_t multicast_group_count_ = 0;
     std::mutex event_list_mtx_;
 
     std::unordered_map<std::string, MethodInfo> method_list_;
+    // participants which resolved a method and may have cached its provider, guarded by method_list_mtx_
+    std::unordered_map<std::string, std::unordered_set<std::string> > method_resolvers_;
     std::mutex method_list_mtx_;
 
     int32_t control_sock_ = 0;
-
-    int32_t max_connections_ = 1024;
+    // sockets shut down by send_control_frame, the control worker stops reading them
+    std::unordered_set<int32_t> dropped_sockets_;
+    int32_t epoll_fd_ = -1;
+    // wakes up the control worker when participants join or die
+    int32_t wakeup_fd_ = -1;
 
  private:
     const uint32_t keep_alive_interval_ = 1000;
+    // every group uses the same port, receivers only get the groups they joined
+    const uint32_t multicast_port_ = 30000;
+    // control frames are small, a participant announcing more is dropped
+    const uint32_t max_control_data_length_ = 1 << 20;
+    // the control worker answers every participant, one which does not read its socket for that long is dropped
+    const uint32_t control_send_timeout_ms_ = 1000;
     const std::string api_version_ = STRING(UBUS_API_VERSION_MAJOR) "." STRING(UBUS_APT_VERSION_MINOR);
 
  private:
     void check_participant_pulse();
     void process_control_message();
+    void process_participant_changes(std::unordered_map<int32_t, FrameReader> *readers,
+                                     std::unordered_map<int32_t, sockaddr_in> *initiating);
+    /// answers the first frame of a connection, false if the socket did not join as a participant
+    bool process_initiation(int32_t fd,
+                            const sockaddr_in &address,
+                            const FrameHeader &header,
+                            const std::string &content);
+    void process_control_frame(int32_t fd, const FrameHeader &header, const std::string &content);
+    void send_control_message(int32_t fd, FrameType type, const ControlMessage &message, bool binary);
+    /// writes frame to a control socket, the socket is shut down if the write fails or times out
+    void send_control_frame(int32_t fd, const Frame &frame);
+    void wake_up_control_worker();
+    void notify_method_resolvers(const std::string &method);
     void listening_control_message();
     void accept_new_connection();
     void keep_alive_worker();
@@ -6,6 +6,7 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
@@ -16,11 +17,17 @@
 #include <list>
 #include <atomic>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <thread>
 #include <queue>
+#include <deque>
+#include <mutex>
+#include <future>
+#include <condition_variable>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "nlohmann/json.hpp"
 
@@ -28,6 +35,17 @@
 #include "log.hpp"
 #include "frame.hpp"
 #include "helpers.hpp"
+#include "frame_reader.hpp"
+#include "control_message.hpp"
+#include "method_frame.hpp"
+#include "shared_memory.hpp"
+#include "loaned_event.hpp"
+#include "multicast.hpp"
+#include "compression.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+#include "thread_pool.hpp"
+#include "spsc_queue.hpp"
 
 class UBusRuntime {
  public:
@@ -36,47 +54,234 @@ class UBusRuntime {
     template <typename EventT>
     bool subscribe_event(const std::string &topic, std::function<void(const EventT &)> callback);
 
+    /// Subscribes without deserializing, type is the id of the published message type.
+    /// data points into the receive buffer of the connection and is only valid during the callback.
+    bool subscribe_raw(const std::string &topic, uint32_t type, std::function<void(std::string_view)> callback) {
+        return subscribe_payload(topic, type, std::make_shared<RawEventCallbackHolder>(callback));
+    }
+
     template <typename EventT>
-    bool advertise_event(const std::string &topic);
+    bool advertise_event(const std::string &topic, const EventOptions &options = EventOptions());
 
     template <typename EventT>
     bool publish_event(const std::string &topic, const EventT &event);
 
+    /// Hands out size bytes for the serialized event, from the shared memory ring of topic when the event fits in
+    /// a slot and from the frame pool otherwise. Invalid if topic is not advertised with EventT.
+    template <typename EventT>
+    LoanedEvent loan(const std::string &topic, size_t size) {
+        return loan_payload(topic, EventT::id, size);
+    }
+    /// Same for a plain struct message, which is value initialized in the loaned buffer, e.g.
+    ///     auto msg = runtime.loan<Telemetry>(topic);
+    ///     msg->stamp = now;
+    ///     runtime.publish(std::move(msg));
+    template <typename EventT, typename std::enable_if<is_pod_message<EventT>::value, int>::type = 0>
+    LoanedMessage<EventT> loan(const std::string &topic) {
+        return LoanedMessage<EventT>(loan_payload(topic, EventT::id, sizeof(EventT)));
+    }
+    /// Publishes the payload written into event without copying it, event is released either way.
+    bool publish(LoanedEvent &&event);
+    template <typename EventT>
+    bool publish(LoanedMessage<EventT> &&message) {
+        LoanedMessage<EventT> loaned(std::move(message));
+        loaned.message_ = nullptr;
+        return publish(std::move(loaned.event_));
+    }
+
+    /// Sends the events batched for topic right away, false if topic is not advertised.
+    bool flush(const std::string &topic);
+    /// same for every advertised topic
+    void flush();
+
     template <typename RequestT, typename ResponseT>
-    bool provide_method(const std::string &method, std::function<void(const RequestT &, ResponseT *)> callback);
+    bool provide_method(const std::string &method,
+                        std::function<void(const RequestT &, ResponseT *)> callback,
+                        const MethodOptions &options = MethodOptions());
 
     template <typename RequestT, typename ResponseT>
     bool call_method(const std::string &method, const RequestT &request, ResponseT *response);
 
+    /// Sends the request without waiting for the response, many calls may be in flight over the same connection.
+    /// response must stay valid until the future is ready.
+    template <typename RequestT, typename ResponseT>
+    std::future<bool> call_method_async(const std::string &method, const RequestT &request, ResponseT *response);
+
+    /// callback runs in the method response thread of the runtime, it must not wait for another call
+    template <typename RequestT, typename ResponseT>
+    void call_method_async(const std::string &method,
+                           const RequestT &request,
+                           std::function<void(bool, const ResponseT &)> callback);
+
     bool is_initiated() { return this->initiated_.load(); }
 
+    /// Received and dropped events, their latency and the events waiting for the callback since the subscription
+    /// of topic, false if not subscribed. Events read from shared memory are not counted.
+    bool get_event_stats(const std::string &topic, EventStats *stats);
+
+    /// Geometry of the shared memory rings used for subscribers on the same host, to be called before
+    /// advertise_event. slot_count 0 disables the shared memory transport, messages larger than slot_size
+    /// fall back to the socket.
+    void configure_shared_memory(uint32_t slot_count, uint32_t slot_size) {
+        shm_slot_count_ = slot_count;
+        shm_slot_size_ = slot_size;
+    }
+
+    /// Number of threads running the callbacks of provided methods, to be called before init.
+    /// 0 runs every callback inline in the listener thread.
+    void configure_method_executor(uint32_t thread_count) { method_executor_threads_ = thread_count; }
+
+    /// Threads running the callbacks of subscriptions, to be called before init. The threads reading the events
+    /// copy every event into a queue of queue_depth events per subscription and go on reading, events arriving while
+    /// the queue is full are dropped and counted in EventStats::queue_dropped. Callbacks of one subscription run one
+    /// at a time and in order of arrival per transport. 1 thread by default. 0 threads runs every callback inline in
+    /// the thread reading its events, with the payload in place and without a copy, but a slow callback then holds
+    /// back the reading of every topic and eventually the publishers.
+    void configure_event_executor(uint32_t thread_count, uint32_t queue_depth = 1024) {
+        event_executor_threads_ = thread_count;
+        event_queue_depth_ = queue_depth > 0 ? queue_depth : 1;
+    }
+
+    /// Providers resolved by the master are cached by default. Without the cache every call queries the master,
+    /// which is what a first call costs. Connections to providers stay open either way.
+    void configure_method_cache(bool enabled) {
+        std::lock_guard<std::mutex> lock(method_cache_mtx_);
+        method_cache_enabled_ = enabled;
+        method_cache_.clear();
+    }
+
+    /// Peers on the same host connect through an AF_UNIX socket instead of TCP over loopback, to be called before
+    /// init. Enabled by default.
+    void configure_unix_socket(bool enabled) { unix_socket_enabled_ = enabled; }
+
+    /// Address of the interface multicast topics are published from and subscribed on, e.g. 127.0.0.1 to keep
+    /// them on loopback. Empty, the default, uses the interface of the default route.
+    void configure_multicast_interface(const std::string &address) { multicast_interface_ = address; }
+
  protected:
     std::atomic<bool> initiated_{false};
     int32_t control_sock_ = 0;
     int32_t listening_sock_ = 0;
+    // listens on the abstract name unix_path_ for peers on the same host, -1 if disabled
+    int32_t unix_listening_sock_ = -1;
+    std::string unix_path_;
+    bool unix_socket_enabled_ = true;
     std::shared_ptr<std::thread> listening_worker_;
     std::shared_ptr<std::thread> event_worker_;
     std::shared_ptr<std::thread> keep_alive_worker_;
+    std::shared_ptr<std::thread> publish_worker_;
+    std::shared_ptr<std::thread> control_worker_;
+
+    // control_sock_ carries one request at a time, control_worker_ hands its response over to the caller
+    std::mutex control_request_mtx_;
+    std::mutex control_write_mtx_;
+    std::mutex control_response_mtx_;
+    std::condition_variable control_response_cv_;
+    std::string control_response_;
+    bool control_response_ready_ = false;
+    bool control_closed_ = false;
+    // the master accepted binary control frames in FRAME_INITIATION
+    bool binary_control_ = false;
+
+    /// Frames waiting to be written to one subscriber of an async topic, drained by publish_worker_
+    struct SendQueue {
+        int32_t socket = 0;
+        uint32_t depth = 0;
+        OverflowPolicy overflow_policy = OVERFLOW_DROP_OLDEST;
+        // header and payload of every frame, shared by the queues of all subscribers of the topic
+        std::deque<FrameBuffer> frames;
+        // bytes of frames.front() already written
+        size_t offset = 0;
+        uint64_t dropped = 0;
+        bool dead = false;
+        // registered for EPOLLOUT in publish_epoll_fd_
+        bool waiting_writable = false;
+        std::mutex mtx;
+        std::condition_variable space_cv;
+    };
+
     struct PubEventInfo {
         std::string topic;
         uint32_t type = 0;
+        // message_fingerprint of the event type, subscribers with another one are refused
+        uint32_t fingerprint = 0;
+        EventOptions options;
         std::unordered_map<std::string, int32_t> client_socket_map;
+        // subscribers reading from shm_ring, skipped by the socket fan-out
+        std::unordered_set<std::string> shm_subscribers;
+        std::shared_ptr<SharedMemoryRing> shm_ring;
+        // the next slot of shm_ring is held by a LoanedEvent, events published meanwhile skip the ring
+        bool shm_loaned = false;
+        // subscribers joined to the group of multicast, skipped by the socket fan-out as well
+        std::unordered_set<std::string> multicast_subscribers;
+        std::shared_ptr<MulticastSender> multicast;
+        // only for async_publish topics, a subscriber gets its queue once the handshake is answered
+        std::unordered_map<std::string, std::shared_ptr<SendQueue>> send_queues;
+        // subscribers which announced version 2 frame headers in the handshake
+        std::unordered_set<std::string> v2_subscribers;
+        // subscribers which unpack FRAME_EVENT_BATCH, the others get the events of a batch one by one
+        std::unordered_set<std::string> batch_subscribers;
+        // subscribers which read FRAME_FLAG_LZ4
+        std::unordered_set<std::string> lz4_subscribers;
+        // sequence of the last published event
+        uint64_t sequence = 0;
+        // events waiting for the next flush when options.batch_max_bytes is set, in FRAME_EVENT_BATCH encoding
+        std::vector<uint8_t> batch;
+        uint64_t batch_sequence = 0;
+        uint64_t batch_deadline_ns = 0;
+        // every event of the batch also went through shm_ring, or multicast
+        bool batch_shm_sent = true;
+        bool batch_multicast_sent = true;
+        // keeps batches of the topic in order when the publisher and batch_worker_ flush at the same time
+        std::shared_ptr<std::mutex> flush_mtx = std::make_shared<std::mutex>();
+        // held while shm_ring or multicast is written, both have a single producer, taken before pub_list_mtx_
+        std::shared_ptr<std::mutex> transport_mtx = std::make_shared<std::mutex>();
     };
     std::unordered_map<std::string, PubEventInfo> pub_list_;
+    std::mutex pub_list_mtx_;
+    int32_t publish_epoll_fd_ = -1;
+    // wakes up publish_worker_ when pending_send_queues_ is filled
+    int32_t publish_wakeup_fd_ = -1;
+    std::vector<std::shared_ptr<SendQueue>> pending_send_queues_;
+    std::mutex pending_send_queues_mtx_;
+    // fires at the deadline of the oldest batch, batch_worker_ flushes the batches due by then. It is not
+    // publish_worker_, flushing may wait for room in the send queues that publish_worker_ drains.
+    std::shared_ptr<std::thread> batch_worker_;
+    int32_t batch_timer_fd_ = -1;
+    // topics with a pending batch and the deadline the timer is armed for, guarded by pub_list_mtx_
+    std::unordered_set<std::string> pending_batches_;
+    uint64_t batch_timer_deadline_ns_ = UINT64_MAX;
+
+    /// Subscriber an event is written to through its socket
+    struct EventTarget {
+        std::string name;
+        int32_t socket = 0;
+        uint8_t frame_version = FRAME_VERSION_1;
+        bool batch = false;
+        bool lz4 = false;
+        // reads from shm_ring or the multicast group as well
+        bool shm = false;
+        bool multicast = false;
+        std::shared_ptr<SendQueue> queue;
+    };
 
     class EventCallbackHolderBase {
      public:
         virtual ~EventCallbackHolderBase() {}
-        virtual void operator()(const std::string &) = 0;
+        /// data is only valid during the call
+        virtual void operator()(std::string_view data) = 0;
     };
 
     template <typename EventT>
     class EventCallbackHolder : public EventCallbackHolderBase {
      public:
         EventCallbackHolder(std::function<void(const EventT &)> callback) : callback_(callback) {}
-        virtual void operator()(const std::string &data) {
+        virtual void operator()(std::string_view data) {
             EventT event;
-            event.deserialize(data);
+            if (!deserialize_message(&event, reinterpret_cast<const uint8_t *>(data.data()), data.size())) {
+                LERROR(UBusRuntime) << "Event of unexpected size " << data.size();
+                return;
+            }
             callback_(event);
         }
 
@@ -84,539 +289,509 @@ class UBusRuntime {
         std::function<void(const EventT &)> callback_;
     };
 
+    class RawEventCallbackHolder : public EventCallbackHolderBase {
+     public:
+        RawEventCallbackHolder(std::function<void(std::string_view)> callback) : callback_(callback) {}
+        virtual void operator()(std::string_view data) { callback_(data); }
+
+     private:
+        std::function<void(std::string_view)> callback_;
+    };
+
+    /// Events of one subscription waiting for event_executor_, pushed by a single reading thread
+    struct EventQueue {
+        explicit EventQueue(size_t depth) : events(depth) {}
+        SpscQueue<FrameBuffer> events;
+        // events pushed and not through the callback yet, the push taking it from 0 schedules a drain
+        std::atomic<uint64_t> pending{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    /// Thread reading the shm_ring of one subscription, stopped and joined once the subscription is removed
+    struct SharedMemoryReader {
+        std::thread thread;
+        std::atomic<bool> stop{false};
+    };
+
     struct SubEventInfo {
         std::string topic;
         uint32_t type = 0;
         std::shared_ptr<EventCallbackHolderBase> callback;
         int32_t socket = 0;
         std::string publisher;
+        std::shared_ptr<SharedMemoryRing> shm_ring;
+        // started by add_sub_event when shm_ring is set
+        std::shared_ptr<SharedMemoryReader> shm_reader;
+        // read by event_worker_ next to socket
+        std::shared_ptr<MulticastReceiver> multicast;
+        // events may arrive from both the socket and the shared memory ring
+        std::shared_ptr<std::mutex> callback_mtx = std::make_shared<std::mutex>();
+        // events read from the socket or the multicast group, nullptr if event_worker_ runs the callback
+        std::shared_ptr<EventQueue> event_queue;
+        // events read from shm_ring, its thread is the only producer of this queue
+        std::shared_ptr<EventQueue> shm_event_queue;
+        // guarded by sub_list_mtx_
+        EventStats stats;
     };
     std::unordered_map<std::string, SubEventInfo> sub_list_;
     std::queue<std::string> unprocessed_new_sub_events_;
     std::queue<std::string> unprocessed_dead_sub_events_;
+    // subscriptions replaced by a new one of their topic, event_worker_ closes their socket and multicast receiver
+    std::queue<SubEventInfo> unprocessed_replaced_sub_events_;
+    std::mutex sub_list_mtx_;
+    int32_t event_epoll_fd_ = -1;
+    // wakes up event_worker_ when a subscription is added or removed
+    int32_t event_wakeup_fd_ = -1;
 
     class MethodCallbackHolderBase {
      public:
         virtual ~MethodCallbackHolderBase() {}
-        virtual void operator()(const std::string &, std::string *) = 0;
+        /// serializes the response into response, false if it fails
+        virtual bool operator()(const uint8_t *request, size_t length, std::vector<uint8_t> *response) = 0;
     };
 
     template <typename RequestT, typename ResponseT>
     class MethodCallbackHolder : public MethodCallbackHolderBase {
      public:
         MethodCallbackHolder(std::function<void(const RequestT &, ResponseT *)> callback) : callback_(callback) {}
-        virtual void operator()(const std::string &request, std::string *response) {
+        virtual bool operator()(const uint8_t *request, size_t length, std::vector<uint8_t> *response) {
             if (response == nullptr) {
                 LERROR(UBusRuntime) << "Error nullptr";
-                return;
+                return false;
             }
             RequestT req;
-            req.deserialize(request);
+            if (!deserialize_message(&req, request, length)) {
+                LERROR(UBusRuntime) << "Request of unexpected size " << length;
+                return false;
+            }
             ResponseT resp;
             callback_(req, &resp);
-            resp.serialize(response);
+            if (!serialize_message(resp, response)) {
+                LERROR(UBusRuntime) << "Failed to serialize response";
+                return false;
+            }
+            return true;
         }
 
      private:
         std::function<void(const RequestT &, ResponseT *)> callback_;
     };
 
+    /// calls of one method waiting for a free slot under MethodOptions::max_concurrency
+    struct MethodCallQueue {
+        std::mutex mtx;
+        uint32_t running = 0;
+        std::queue<std::function<void()>> pending;
+    };
+
     struct MethodInfo {
         std::string method;
         uint32_t request_type = 0;
         uint32_t response_type = 0;
         std::shared_ptr<MethodCallbackHolderBase> callback;
+        MethodOptions options;
+        std::shared_ptr<MethodCallQueue> call_queue = std::make_shared<MethodCallQueue>();
+    };
+    // by method_name_hash of the method
+    std::unordered_map<uint32_t, MethodInfo> method_list_;
+    std::mutex method_list_mtx_;
+    std::shared_ptr<ThreadPool> method_executor_;
+    uint32_t method_executor_threads_ = 4;
+    std::shared_ptr<ThreadPool> event_executor_;
+    uint32_t event_executor_threads_ = 1;
+    uint32_t event_queue_depth_ = 1024;
+
+    /// Connection accepted by the listener, the socket is closed once the listener and every method call still
+    /// running for it are done with it.
+    struct PeerConnection {
+        explicit PeerConnection(int32_t fd) : socket(fd) {}
+        ~PeerConnection() {
+            if (!handed_over) {
+                close(socket);
+            }
+        }
+        int32_t socket;
+        // responses of concurrent calls are written from the executor threads
+        std::mutex write_mtx;
+        // the socket belongs to a publisher now
+        bool handed_over = false;
+        // set for a subscriber reading from shm_ring or multicast, the socket fan-out skips it and would not notice
+        // it is gone, so the listener keeps watching its socket for a hang up
+        std::string watched_topic;
+        std::string watched_subscriber;
+        // responses use the header version of the calls, both guarded by write_mtx
+        uint8_t frame_version = FRAME_VERSION_1;
+        uint64_t sequence = 0;
+    };
+
+    /// receives the serialized response of a call, or false if the call failed
+    typedef std::function<void(bool, const uint8_t *, size_t)> MethodResponseCallback;
+
+    /// Connection to a method provider shared by all calls to it, responses are matched by request id
+    struct ProviderChannel {
+        // a lost channel is only shut down, the socket is closed once the last caller writing to it let go
+        ~ProviderChannel() {
+            if (socket >= 0) {
+                close(socket);
+            }
+        }
+        int32_t socket = -1;
+        // key in provider_channels_
+        std::string address;
+        std::mutex write_mtx;
+        // announced by the provider to the master, sequence is guarded by write_mtx
+        uint8_t frame_version = FRAME_VERSION_1;
+        uint64_t sequence = 0;
+        std::mutex mtx;
+        std::unordered_map<uint64_t, MethodResponseCallback> pending_calls;
+        // set by method_worker_ once the connection is lost, the next call opens a new channel
+        bool closed = false;
+        // only touched by method_worker_
+        FrameReader reader;
+    };
+    // channels by "ip:port"
+    std::unordered_map<std::string, std::shared_ptr<ProviderChannel>> provider_channels_;
+    // every channel not released by method_worker_ yet, including replaced ones
+    std::unordered_map<ProviderChannel *, std::shared_ptr<ProviderChannel>> live_provider_channels_;
+    std::mutex provider_channels_mtx_;
+    std::atomic<uint64_t> next_request_id_{1};
+    std::shared_ptr<std::thread> method_worker_;
+    int32_t method_epoll_fd_ = -1;
+
+    struct MethodProviderInfo {
+        std::string name;
+        std::string ip;
+        uint32_t port = 0;
+        // set by the master when the provider runs on this host
+        std::string unix_path;
+        uint8_t frame_version = FRAME_VERSION_1;
+        uint32_t request_type = 0;
+        uint32_t response_type = 0;
+        uint32_t request_fingerprint = 0;
+        uint32_t response_fingerprint = 0;
+        // the provider reads compressed requests of at least compression_min_size bytes
+        CompressionCodec compression = COMPRESSION_NONE;
+        uint32_t compression_min_size = 0;
     };
-    std::unordered_map<std::string, MethodInfo> method_list_;
+    // providers resolved by the master, entries are dropped when the master sends FRAME_METHOD_INVALIDATE
+    std::unordered_map<std::string, MethodProviderInfo> method_cache_;
+    // bumped on every invalidation, a resolution that raced with one is not cached
+    uint64_t method_cache_generation_ = 0;
+    bool method_cache_enabled_ = true;
+    std::mutex method_cache_mtx_;
 
-    const uint32_t max_connections_ = 1024;
+    uint32_t shm_slot_count_ = 64;
+    uint32_t shm_slot_size_ = 1024 * 1024;
+
+    std::string multicast_interface_;
 
     std::string name_;
 
+    /// adds the subscription and starts reading its shm_ring, a previous subscription of the topic is replaced
+    void add_sub_event(const SubEventInfo &event_info);
+    /// stops the shm_reader of a subscription removed from sub_list_ and unmaps its ring, to be called without
+    /// sub_list_mtx_ as the reader may be waiting for it
+    void stop_shared_memory_reader(SubEventInfo *event_info);
+
+    /// Registers to the master and the publisher of topic, events are handed to callback without being copied.
+    /// fingerprint is the message_fingerprint of the event type, checked by the master and the publisher.
+    bool subscribe_payload(const std::string &topic,
+                           uint32_t type,
+                           std::shared_ptr<EventCallbackHolderBase> callback,
+                           uint32_t fingerprint = 0);
+
+    /// Sends a serialized event to every subscriber of topic, directly or through the send queues.
+    /// loaned_ring is set when data is the reserved slot of the ring of topic, which the caller commits afterwards
+    /// with the sequence number given to the event in published_sequence.
+    bool publish_payload(const std::string &topic,
+                         uint32_t type,
+                         const uint8_t *data,
+                         size_t length,
+                         SharedMemoryRing *loaned_ring = nullptr,
+                         uint64_t *published_sequence = nullptr);
+    LoanedEvent loan_payload(const std::string &topic, uint32_t type, size_t size);
+    /// commits the ring slot held by event as sequence, or gives it back
+    void finish_loan(const LoanedEvent &event, bool commit, uint64_t sequence = 0);
+    friend class LoanedEvent;
+    /// subscribers of event_info not reached through shared memory or multicast, to be called with pub_list_mtx_
+    void collect_event_targets(const PubEventInfo &event_info,
+                               bool shm_sent,
+                               bool multicast_sent,
+                               std::vector<EventTarget> *targets);
+    /// removes subscribers from every list of topic, to be called with pub_list_mtx_
+    void remove_subscribers(const std::string &topic, const std::vector<std::string> &subscribers);
+    /// writes one frame to every target, subscribers found dead are removed from topic
+    void send_event_frame(const std::string &topic,
+                          const EventOptions &options,
+                          const std::vector<EventTarget> &targets,
+                          FrameType type,
+                          const uint8_t *data,
+                          size_t length,
+                          uint64_t sequence);
+    /// arms batch_timer_fd_ if deadline_ns comes before the current one, to be called with pub_list_mtx_
+    void arm_batch_timer(uint64_t deadline_ns);
+    /// flushes the batches whose deadline passed and arms the timer for the others
+    void flush_due_batches();
+    /// creates publish_epoll_fd_ and starts publish_worker_, which writes the frames given to enqueue_frame
+    bool start_publish_worker();
+    /// returns false if the subscriber is gone
+    bool enqueue_frame(const std::shared_ptr<SendQueue> &queue, const FrameBuffer &frame);
+
+    /// sends request to the master and waits for its response
+    bool control_request(const Frame &request, std::string *response);
+    /// same, encoded as negotiated with the master
+    bool control_request(FrameType type, const ControlMessage &request, ControlMessage *response);
+
+    /// resolves the provider of method, from the cache when possible, and sends it the request.
+    /// done is called exactly once, from method_worker_ or from the calling thread on early failure.
+    /// The master refuses to resolve the method for other types or fingerprints than the provider's.
+    void call_method_raw(const std::string &method,
+                         uint32_t request_type,
+                         uint32_t response_type,
+                         uint32_t request_fingerprint,
+                         uint32_t response_fingerprint,
+                         const uint8_t *data,
+                         size_t length,
+                         MethodResponseCallback done);
+    bool resolve_method(const std::string &method,
+                        uint32_t request_type,
+                        uint32_t response_type,
+                        uint32_t request_fingerprint,
+                        uint32_t response_fingerprint,
+                        MethodProviderInfo *provider,
+                        bool *cached);
+    void invalidate_method(const std::string &method);
+
+    std::shared_ptr<ProviderChannel> acquire_provider_channel(const MethodProviderInfo &provider);
+    /// returns false if the request could not be sent, done is not called in that case
+    bool send_method_call(const std::shared_ptr<ProviderChannel> &channel,
+                          const MethodFrameHeader &header,
+                          const uint8_t *data,
+                          size_t length,
+                          uint8_t flags,
+                          MethodResponseCallback done);
+
+    /// per thread scratch buffer for outgoing payloads, reused so that sending does not allocate
+    static std::vector<uint8_t> &payload_buffer() {
+        thread_local std::vector<uint8_t> buffer;
+        return buffer;
+    }
+    /// same for compressed payloads
+    static std::vector<uint8_t> &compression_buffer() {
+        thread_local std::vector<uint8_t> buffer;
+        return buffer;
+    }
+
  private:
     void keep_alive_sender();
+    void process_control_message();
     void start_listening_socket();
+    void process_incoming_frame(const std::shared_ptr<PeerConnection> &connection,
+                                const FrameHeaderV2 &header,
+                                const uint8_t *data);
+    void send_method_response(const std::shared_ptr<PeerConnection> &connection,
+                              const MethodFrameHeader &header,
+                              const uint8_t *data,
+                              size_t length,
+                              uint8_t flags = 0);
+    void dispatch_method_call(const MethodInfo &method_info, std::function<void()> task);
+    void run_method_call(const std::shared_ptr<MethodCallQueue> &call_queue, std::function<void()> task);
     void process_event_message();
+    /// Counts the event in the stats of topic and runs its callback, or queues a copy of data when callbacks run on
+    /// event_executor_. shared_memory tells which queue the calling thread produces into.
+    void dispatch_event(const std::string &topic,
+                        uint64_t sequence,
+                        uint64_t timestamp,
+                        std::string_view data,
+                        bool shared_memory);
+    /// hands the queued events to callback until the queue is empty or its time slice is over
+    void drain_event_queue(std::shared_ptr<EventQueue> queue,
+                           std::shared_ptr<EventCallbackHolderBase> callback,
+                           std::shared_ptr<std::mutex> callback_mtx);
+    void process_publish_queue();
+    void process_batch_timer();
+    void process_method_response();
+    void close_provider_channel(ProviderChannel *channel);
+    void flush_send_queue(const std::shared_ptr<SendQueue> &queue,
+                          std::unordered_map<int32_t, std::shared_ptr<SendQueue>> *writable_waiters);
+    void process_shared_memory_event(std::string topic,
+                                     std::shared_ptr<SharedMemoryRing> shm_ring,
+                                     std::shared_ptr<SharedMemoryReader> reader);
 };
 
 template <typename EventT>
-bool UBusRuntime::advertise_event(const std::string &topic) {
-    Frame frame;
-    frame.header.message_type = FRAME_EVENT_REGISTER;
-    nlohmann::json json_struct;
-    json_struct["topic"] = topic;
-    json_struct["type_id"] = EventT::id;
-    std::string serialized_string = json_struct.dump();
-    const char *char_struct = serialized_string.c_str();
-    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-    LDEBUG(UBusRuntime) << "Data length : " << ntohl(frame.header.data_length);
-    frame.data = new uint8_t[ntohl(frame.header.data_length)];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, ntohl(frame.header.data_length));
-    int32_t ret;
-    if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
+bool UBusRuntime::advertise_event(const std::string &topic, const EventOptions &options) {
+    ControlMessage request;
+    request.set_string(CONTROL_TAG_TOPIC, topic);
+    request.set_uint(CONTROL_TAG_TYPE_ID, EventT::id);
+    if (message_fingerprint<EventT>() != 0) {
+        request.set_uint(CONTROL_TAG_TYPE_FINGERPRINT, message_fingerprint<EventT>());
     }
-    if ((ret = writen(control_sock_, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
+    if (options.multicast) {
+        request.set_bool(CONTROL_TAG_MULTICAST, true);
     }
-    LDEBUG(UBusRuntime) << "Debug content "
-                        << std::string(reinterpret_cast<char *>(frame.data), ntohl(frame.header.data_length));
 
-    {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(control_sock_, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusRuntime) << "Failed to read header";
-        } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-            char content_buff[header->data_length];
-            read_size = readn(control_sock_, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LERROR(UBusRuntime) << "Failed to read content";
-            }
-            std::string content(content_buff, header->data_length);
-            try {
-                nlohmann::json response_json = nlohmann::json::parse(content);
-                if (response_json.contains("response")) {
-                    if (response_json["response"] == "OK") {
-                        LINFO(UBusRuntime) << "Topic registered to master";
-                        PubEventInfo event_info;
-                        event_info.topic = topic;
-                        event_info.type = EventT::id;
-                        pub_list_[topic] = event_info;
-                    } else {
-                        LERROR(UBusRuntime) << "Error from master : " << std::string(response_json["response"]);
-                        return false;
-                    }
-                } else {
-                    LERROR(UBusRuntime) << "Invalid response from master";
-                    return false;
-                }
-            } catch (nlohmann::json::exception &e) {
-                LERROR(UBusRuntime) << "Exception in json : " << e.what();
-                return false;
-            }
-        }
-    }
-    return true;
-}
-
-template <typename EventT>
-bool UBusRuntime::publish_event(const std::string &topic, const EventT &event) {
-    if (pub_list_.find(topic) == pub_list_.end()) {
-        LERROR(UBusRuntime) << "Error topic unregistered";
+    ControlMessage response;
+    if (!control_request(FRAME_EVENT_REGISTER, request, &response)) {
+        LERROR(UBusRuntime) << "Failed to read response from master";
         return false;
     }
-    if (EventT::id != pub_list_.at(topic).type) {
-        LERROR(UBusRuntime) << "Error wrong event type";
+    std::string result = response.get_string(CONTROL_TAG_RESPONSE);
+    if (result != "OK") {
+        LERROR(UBusRuntime) << "Error from master : " << (result.empty() ? "invalid response" : result);
         return false;
     }
-    if (pub_list_.at(topic).client_socket_map.size() == 0) {
-        LINFO(UBusRuntime) << "No subscribers";
-        return true;
+    LINFO(UBusRuntime) << "Topic registered to master";
+    PubEventInfo event_info;
+    event_info.topic = topic;
+    event_info.type = EventT::id;
+    event_info.fingerprint = message_fingerprint<EventT>();
+    event_info.options = options;
+    if (event_info.options.queue_depth == 0) {
+        event_info.options.queue_depth = 1;
     }
-    Frame frame;
-    frame.header.message_type = FRAME_EVENT;
-    std::string serialized_string;
-    event.serialize(&serialized_string);
-    const char *char_struct = serialized_string.c_str();
-    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-    frame.data = new uint8_t[serialized_string.size()];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-    std::vector<std::string> dead_subscribers;
-    for (auto &p : pub_list_.at(topic).client_socket_map) {
-        LINFO(UBusRuntime) << "Sending event to subscriber " << p.first;
-        int32_t ret;
-        if ((ret = writen(p.second, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-            LDEBUG(UBusRuntime) << "Write returned " << ret;
-        } else if ((ret = writen(p.second, static_cast<void *>(frame.data), serialized_string.size())) < 0) {
-            LDEBUG(UBusRuntime) << "Write returned " << ret;
-        }
-        if (ret < 0 && errno == EPIPE) {
-            LINFO(UBusRuntime) << "EPIPE returned, socket is closed by peer, will remove from subscriber list: "
-                               << p.first;
-            dead_subscribers.push_back(p.first);
+    if (shm_slot_count_ > 0) {
+        event_info.shm_ring = std::make_shared<SharedMemoryRing>();
+        if (!event_info.shm_ring->create(SharedMemoryRing::make_name(name_, topic), shm_slot_count_, shm_slot_size_)) {
+            LWARN(UBusRuntime) << "Shared memory unavailable for " << topic;
+            event_info.shm_ring.reset();
         }
     }
-    for (auto &p : dead_subscribers) {
-        pub_list_.at(topic).client_socket_map.erase(p);
+    std::string multicast_group;
+    uint32_t multicast_port = 0;
+    if (response.get_string(CONTROL_TAG_MULTICAST_GROUP, &multicast_group) &&
+        response.get_uint(CONTROL_TAG_MULTICAST_PORT, &multicast_port)) {
+        // subscribers are only told to read the group once the sender works, otherwise they stay on the socket
+        event_info.multicast = std::make_shared<MulticastSender>();
+        if (event_info.multicast->open(topic, multicast_group, multicast_port, multicast_interface_,
+                                       options.multicast_datagram_size)) {
+            LINFO(UBusRuntime) << "Publishing " << topic << " to multicast group " << multicast_group;
+        } else {
+            LWARN(UBusRuntime) << "Multicast unavailable for " << topic;
+            event_info.multicast.reset();
+        }
     }
+    std::lock_guard<std::mutex> lock(pub_list_mtx_);
+    pub_list_[topic] = event_info;
     return true;
 }
 
 template <typename EventT>
-bool UBusRuntime::subscribe_event(const std::string &topic, std::function<void(const EventT &)> callback) {
-    Frame frame;
-    frame.header.message_type = FRAME_EVENT_SUBSCRIBE;
-
-    nlohmann::json json_struct;
-    json_struct["topic"] = topic;
-    json_struct["type_id"] = EventT::id;
-    json_struct["name"] = name_;
-    std::string serialized_string = json_struct.dump();
-
-    const char *char_struct = serialized_string.c_str();
-    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-    frame.data = new uint8_t[serialized_string.size()];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-    int32_t ret;
-    if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
-    }
-    if ((ret = writen(control_sock_, static_cast<void *>(frame.data), serialized_string.size())) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
+bool UBusRuntime::publish_event(const std::string &topic, const EventT &event) {
+    const uint8_t *payload;
+    size_t length;
+    if (!message_payload(event, &payload_buffer(), &payload, &length)) {
+        LERROR(UBusRuntime) << "Failed to serialize event";
+        return false;
     }
+    return publish_payload(topic, EventT::id, payload, length);
+}
 
-    {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(control_sock_, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusRuntime) << "Failed to read header";
-        } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-            char content_buff[header->data_length];
-            read_size = readn(control_sock_, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LERROR(UBusRuntime) << "Failed to read content";
-            }
-            std::string content(content_buff, header->data_length);
-            try {
-                nlohmann::json response_json = nlohmann::json::parse(content);
-                if (response_json.contains("response")) {
-                    if (response_json["response"] == "OK") {
-                        LINFO(UBusRuntime) << "Topic subscription registered to master";
-                        if (!response_json.contains("publisher_ip") || !response_json.contains("publisher_port") ||
-                            !response_json.contains("publisher_name")) {
-                            LERROR(UBusRuntime) << "Invalid reponse from master for subscription";
-                            return false;
-                        }
-                        int32_t sub_socket = 0;
-                        if ((sub_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-                            LERROR(UBusRuntime) << "Failed to create socket";
-                            control_sock_ = 0;
-                            return false;
-                        }
-                        sockaddr_in sub_sockaddr;
-                        bzero(&sub_sockaddr, sizeof(sub_sockaddr));
-                        sub_sockaddr.sin_family = AF_INET;
-                        sub_sockaddr.sin_port = htons(response_json.at("publisher_port").get<int32_t>());
-                        if (inet_pton(AF_INET, response_json.at("publisher_ip").get<std::string>().c_str(),
-                                      &sub_sockaddr.sin_addr) <= 0) {
-                            LERROR(UBusRuntime)
-                                << "Failed to convert ip address " << std::string(response_json.at("publisher_ip"));
-                            return false;
-                        }
-
-                        int32_t ret;
-                        if ((ret = connect(sub_socket, reinterpret_cast<sockaddr *>(&sub_sockaddr),
-                                           sizeof(sub_sockaddr))) != 0) {
-                            LERROR(UBusRuntime) << "Failed to connect to publisher, ret " << ret;
-                            return false;
-                        }
-
-                        SubEventInfo event_info;
-                        event_info.topic = topic;
-                        event_info.type = EventT::id;
-                        event_info.socket = sub_socket;
-                        event_info.publisher = response_json.at("publisher_name").get<std::string>();
-                        event_info.callback = std::make_shared<EventCallbackHolder<EventT> >(callback);
-
-                        // send subscribe message to publisher
-                        if ((ret = writen(sub_socket, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-                            LINFO(UBusRuntime) << "Write returned " << ret;
-                        }
-                        if ((ret = writen(sub_socket, static_cast<void *>(frame.data),
-                                          ntohl(frame.header.data_length))) < 0) {
-                            LINFO(UBusRuntime) << "Write returned " << ret;
-                        }
-
-                        {
-                            char header_buff[sizeof(FrameHeader)];
-                            size_t read_size = readn(sub_socket, &header_buff, sizeof(FrameHeader));
-                            if (read_size < sizeof(FrameHeader)) {
-                                LERROR(UBusRuntime) << "Failed to read header";
-                            } else {
-                                FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-                                header->data_length = ntohl(header->data_length);
-                                LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-                                char content_buff[header->data_length];
-                                read_size = readn(sub_socket, &content_buff, header->data_length);
-                                if (read_size < header->data_length) {
-                                    LDEBUG(UBusRuntime) << "Failed to read content";
-                                }
-                                std::string content(content_buff, header->data_length);
-                                try {
-                                    nlohmann::json response_json = nlohmann::json::parse(content);
-                                    if (response_json.contains("response")) {
-                                        if (response_json["response"] == "OK") {
-                                            LINFO(UBusRuntime) << "Registered with publisher";
-                                            sub_list_[topic] = event_info;
-                                            unprocessed_new_sub_events_.push(topic);
-                                            return true;
-                                        } else {
-                                            LERROR(UBusRuntime) << "Failed to connect to "
-                                                                   "publisher";
-                                            return false;
-                                        }
-                                    } else {
-                                        LERROR(UBusRuntime) << "Failed to connect to publisher";
-                                        return false;
-                                    }
-                                } catch (nlohmann::json::exception &e) {
-                                    LERROR(UBusRuntime) << "Exception in json : " << e.what();
-                                    return false;
-                                }
-                            }
-                        }
-
-                    } else {
-                        LERROR(UBusRuntime) << "Error from master : " << std::string(response_json["response"]);
-                        return false;
-                    }
-                } else {
-                    LERROR(UBusRuntime) << "Invalid response from master";
-                    return false;
-                }
-            } catch (nlohmann::json::exception &e) {
-                LERROR(UBusRuntime) << "Exception in json : " << e.what();
-                return false;
-            }
-        }
-    }
-    return true;
+template <typename EventT>
+bool UBusRuntime::subscribe_event(const std::string &topic, std::function<void(const EventT &)> callback) {
+    return subscribe_payload(topic, EventT::id, std::make_shared<EventCallbackHolder<EventT> >(callback),
+                             message_fingerprint<EventT>());
 }
 
 template <typename RequestT, typename ResponseT>
 bool UBusRuntime::provide_method(const std::string &method,
-                                 std::function<void(const RequestT &, ResponseT *)> callback) {
-    Frame frame;
-    frame.header.message_type = FRAME_METHOD_PROVIDE;
-    nlohmann::json json_struct;
-    json_struct["method"] = method;
-    json_struct["request_type_id"] = RequestT::id;
-    json_struct["response_type_id"] = ResponseT::id;
-    std::string serialized_string = json_struct.dump();
-    const char *char_struct = serialized_string.c_str();
-    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-    LDEBUG(UBusRuntime) << "Data length : " << ntohl(frame.header.data_length);
-    frame.data = new uint8_t[ntohl(frame.header.data_length)];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-    int32_t ret;
-    if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
+                                 std::function<void(const RequestT &, ResponseT *)> callback,
+                                 const MethodOptions &options) {
+    {
+        // calls only carry the hash of the method name
+        std::lock_guard<std::mutex> lock(method_list_mtx_);
+        auto ite = method_list_.find(method_name_hash(method));
+        if (ite != method_list_.end()) {
+            LERROR(UBusRuntime) << "Method " << method << " has the same id as " << ite->second.method;
+            return false;
+        }
+    }
+    ControlMessage request;
+    request.set_string(CONTROL_TAG_METHOD, method);
+    request.set_uint(CONTROL_TAG_REQUEST_TYPE_ID, RequestT::id);
+    request.set_uint(CONTROL_TAG_RESPONSE_TYPE_ID, ResponseT::id);
+    if (message_fingerprint<RequestT>() != 0) {
+        request.set_uint(CONTROL_TAG_REQUEST_FINGERPRINT, message_fingerprint<RequestT>());
+    }
+    if (message_fingerprint<ResponseT>() != 0) {
+        request.set_uint(CONTROL_TAG_RESPONSE_FINGERPRINT, message_fingerprint<ResponseT>());
     }
-    if ((ret = writen(control_sock_, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
+    if (options.compression != COMPRESSION_NONE) {
+        request.set_uint(CONTROL_TAG_COMPRESSION, options.compression);
+        request.set_uint(CONTROL_TAG_COMPRESSION_MIN_SIZE, options.compression_min_size);
     }
-    LDEBUG(UBusRuntime) << "Debug content "
-                        << std::string(reinterpret_cast<char *>(frame.data), ntohl(frame.header.data_length));
 
-    {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(control_sock_, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusRuntime) << "Failed to read header";
-        } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-            char content_buff[header->data_length];
-            read_size = readn(control_sock_, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LERROR(UBusRuntime) << "Failed to read content";
-            }
-            std::string content(content_buff, header->data_length);
-            try {
-                nlohmann::json response_json = nlohmann::json::parse(content);
-                if (response_json.contains("response")) {
-                    if (response_json["response"] == "OK") {
-                        LINFO(UBusRuntime) << "Method registered to master";
-                        MethodInfo method_info;
-                        method_info.method = method;
-                        method_info.request_type = RequestT::id;
-                        method_info.response_type = ResponseT::id;
-                        method_info.callback = std::make_shared<MethodCallbackHolder<RequestT, ResponseT> >(callback);
-                        method_list_[method] = method_info;
-                    } else {
-                        LERROR(UBusRuntime) << "Error from master : " << std::string(response_json["response"]);
-                        return false;
-                    }
-                } else {
-                    LERROR(UBusRuntime) << "Invalid response from master";
-                    return false;
-                }
-            } catch (nlohmann::json::exception &e) {
-                LERROR(UBusRuntime) << "Exception in json : " << e.what();
-                return false;
-            }
-        }
+    ControlMessage response;
+    if (!control_request(FRAME_METHOD_PROVIDE, request, &response)) {
+        LERROR(UBusRuntime) << "Failed to read response from master";
+        return false;
+    }
+    std::string result = response.get_string(CONTROL_TAG_RESPONSE);
+    if (result != "OK") {
+        LERROR(UBusRuntime) << "Error from master : " << (result.empty() ? "invalid response" : result);
+        return false;
     }
+    LINFO(UBusRuntime) << "Method registered to master";
+    MethodInfo method_info;
+    method_info.method = method;
+    method_info.request_type = RequestT::id;
+    method_info.response_type = ResponseT::id;
+    method_info.callback = std::make_shared<MethodCallbackHolder<RequestT, ResponseT> >(callback);
+    method_info.options = options;
+    std::lock_guard<std::mutex> lock(method_list_mtx_);
+    method_list_[method_name_hash(method)] = method_info;
     return true;
 }
 
 template <typename RequestT, typename ResponseT>
 bool UBusRuntime::call_method(const std::string &method, const RequestT &request, ResponseT *response) {
-    // get method info
-    Frame frame;
-    frame.header.message_type = FRAME_METHOD_QUERY;
-
-    nlohmann::json json_struct;
-    json_struct["method"] = method;
-    // json_struct["request_type_id"] = RequestT::id;
-    // json_struct["response_type_id"] = ResponseT::id;
-    json_struct["request_type_id"] = request.id;
-    json_struct["response_type_id"] = response->id;
-    json_struct["name"] = name_;
-    std::string serialized_string = json_struct.dump();
-
-    const char *char_struct = serialized_string.c_str();
-    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-    frame.data = new uint8_t[ntohl(frame.header.data_length)];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-    int32_t ret;
-    if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
-    }
-    if ((ret = writen(control_sock_, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
-        LINFO(UBusRuntime) << "Write returned " << ret;
-    }
-
-    {
-        // get provider info
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(control_sock_, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusRuntime) << "Failed to read header";
-            return false;
-        }
-        FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-        header->data_length = ntohl(header->data_length);
-        LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-        char content_buff[header->data_length];
-        read_size = readn(control_sock_, &content_buff, header->data_length);
-        if (read_size < header->data_length) {
-            LERROR(UBusRuntime) << "Failed to read content";
-        }
-        std::string content(content_buff, header->data_length);
-
-        try {
-            nlohmann::json response_json = nlohmann::json::parse(content);
-            if (!response_json.contains("response")) {
-                LERROR(UBusRuntime) << "Invalid response from master";
-                return false;
-            }
-            if (response_json["response"] != "OK") {
-                LERROR(UBusRuntime) << "Master returned " << std::string(response_json["response"]);
-                return false;
-            }
-            LINFO(UBusRuntime) << "Method request is validated by master.";
-            if (!response_json.contains("provider_ip") || !response_json.contains("provider_port") ||
-                !response_json.contains("provider_name")) {
-                LERROR(UBusRuntime) << "Invalid reponse from master for method request";
-                return false;
-            }
-            int32_t req_socket = 0;
-            if ((req_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-                LERROR(UBusRuntime) << "Failed to create socket";
-                control_sock_ = 0;
-                return false;
-            }
-            sockaddr_in req_sockaddr;
-            bzero(&req_sockaddr, sizeof(req_sockaddr));
-            req_sockaddr.sin_family = AF_INET;
-            req_sockaddr.sin_port = htons(response_json.at("provider_port").get<int32_t>());
-            if (inet_pton(AF_INET, response_json.at("provider_ip").get<std::string>().c_str(),
-                          &req_sockaddr.sin_addr) <= 0) {
-                LERROR(UBusRuntime) << "Failed to convert ip address " << std::string(response_json.at("provider_ip"));
-                return false;
-            }
-
-            int32_t ret_connect;
-            if ((ret_connect =
-                     connect(req_socket, reinterpret_cast<sockaddr *>(&req_sockaddr), sizeof(req_sockaddr))) != 0) {
-                LERROR(UBusRuntime) << "Failed to connect to method provider, ret " << ret_connect;
-                return false;
-            }
-
-            Frame req_frame;
-            req_frame.header.message_type = FRAME_METHOD_CALL;
-            std::string request_string;
-            request.serialize(&request_string);
-            nlohmann::json method_req_json;
-            method_req_json["method"] = method;
-            method_req_json["request_type_id"] = request.id;
-            method_req_json["response_type_id"] = response->id;
-            // method_req_json["request_type_id"] = RequestT::id;
-            // method_req_json["response_type_id"] = ResponseT::id;
-            method_req_json["name"] = name_;
-            method_req_json["request_data"] = request_string;
-            std::string serialized_string = method_req_json.dump();
-            const char *char_struct = serialized_string.c_str();
-            req_frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-            req_frame.data = new uint8_t[ntohl(req_frame.header.data_length)];
-            strncpy(reinterpret_cast<char *>(req_frame.data), char_struct, serialized_string.size());
-
-            int32_t ret;
-            if ((ret = writen(req_socket, static_cast<void *>(&req_frame.header), sizeof(FrameHeader))) < 0) {
-                LDEBUG(UBusRuntime) << "Write returned " << ret;
-            }
-            if ((ret = writen(req_socket, static_cast<void *>(req_frame.data), ntohl(req_frame.header.data_length))) <
-                0) {
-                LDEBUG(UBusRuntime) << "Write returned " << ret;
-            }
+    return call_method_async(method, request, response).get();
+}
 
-            // get response
-            {
-                char header_buff[sizeof(FrameHeader)];
-                size_t read_size = readn(req_socket, &header_buff, sizeof(FrameHeader));
-                if (read_size < sizeof(FrameHeader)) {
-                    LERROR(UBusRuntime) << "Failed to read header";
-                    return false;
-                }
-                FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-                header->data_length = ntohl(header->data_length);
-                if (header->message_type != FRAME_METHOD_RESPONSE) {
-                    LERROR(UBusRuntime) << "Invalid frame type";
-                    return false;
-                }
-                char content_buff[header->data_length];
-                read_size = readn(req_socket, &content_buff, header->data_length);
-                if (read_size < header->data_length) {
-                    LERROR(UBusRuntime) << "Failed to read content";
-                }
-                std::string content(content_buff, header->data_length);
-                try {
-                    nlohmann::json response_json = nlohmann::json::parse(content);
-                    if (response_json.contains("response")) {
-                        if (response_json["response"] == "OK") {
-                            LINFO(UBusRuntime) << "Get response from method provider";
-                            if (!response_json.contains("response_data")) {
-                                LERROR(UBusRuntime) << "Invalid frame format";
-                                return false;
-                            }
-                            LDEBUG(UBusRuntime) << "Response data : " << std::string(response_json.at("response_data"));
-                            response->deserialize(response_json.at("response_data"));
-                        } else {
-                            LERROR(UBusRuntime) << "Error request method : " << std::string(response_json["response"]);
-                            return false;
+template <typename RequestT, typename ResponseT>
+std::future<bool> UBusRuntime::call_method_async(const std::string &method,
+                                                 const RequestT &request,
+                                                 ResponseT *response) {
+    std::shared_ptr<std::promise<bool> > promise = std::make_shared<std::promise<bool> >();
+    std::future<bool> result = promise->get_future();
+    const uint8_t *request_data;
+    size_t request_length;
+    if (!message_payload(request, &payload_buffer(), &request_data, &request_length)) {
+        LERROR(UBusRuntime) << "Failed to serialize request";
+        promise->set_value(false);
+        return result;
+    }
+    call_method_raw(method, request.id, response->id, message_fingerprint<RequestT>(),
+                    message_fingerprint<ResponseT>(), request_data, request_length,
+                    [promise, response](bool ok, const uint8_t *response_data, size_t length) {
+                        if (ok && !deserialize_message(response, response_data, length)) {
+                            LERROR(UBusRuntime) << "Response of unexpected size " << length;
+                            ok = false;
                         }
-                    } else {
-                        LERROR(UBusRuntime) << "Invalid frame format";
-                        return false;
-                    }
-                } catch (nlohmann::json::exception &e) {
-                    LERROR(UBusRuntime) << "Exception in json : " << e.what();
-                    return false;
-                }
-            }
-        } catch (nlohmann::json::exception &e) {
-            LERROR(UBusRuntime) << "Exception in json : " << e.what();
-            return false;
-        }
+                        promise->set_value(ok);
+                    });
+    return result;
+}
+
+template <typename RequestT, typename ResponseT>
+void UBusRuntime::call_method_async(const std::string &method,
+                                    const RequestT &request,
+                                    std::function<void(bool, const ResponseT &)> callback) {
+    const uint8_t *request_data;
+    size_t request_length;
+    if (!message_payload(request, &payload_buffer(), &request_data, &request_length)) {
+        LERROR(UBusRuntime) << "Failed to serialize request";
+        callback(false, ResponseT());
+        return;
     }
-    return true;
+    call_method_raw(method, request.id, ResponseT::id, message_fingerprint<RequestT>(),
+                    message_fingerprint<ResponseT>(), request_data, request_length,
+                    [callback](bool ok, const uint8_t *response_data, size_t length) {
+                        ResponseT response;
+                        if (ok && !deserialize_message(&response, response_data, length)) {
+                            LERROR(UBusRuntime) << "Response of unexpected size " << length;
+                            ok = false;
+                        }
+                        callback(ok, response);
+                    });
 }
@@ -0,0 +1,235 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "compression.hpp"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "frame.hpp"
+
+namespace {
+
+const uint32_t min_match = 4;
+// the last 5 bytes are always literals and the last match starts at least 12 bytes before the end
+const size_t last_literals = 5;
+const size_t match_find_limit = 12;
+const uint32_t max_offset = 65535;
+const uint32_t hash_log = 12;
+// blocks expand at most by this ratio when decompressed
+const uint64_t max_ratio = 255;
+
+inline uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t read64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash_sequence(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - hash_log); }
+
+/// bytes equal at the start of a and b, the first different byte is found in the xor of 8 bytes
+inline size_t common_bytes(uint64_t difference) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctzll(difference) >> 3;
+#else
+    return __builtin_clzll(difference) >> 3;
+#endif
+}
+
+inline uint8_t *write_length(uint8_t *out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+size_t compress_bound(size_t length) { return length + length / 255 + 16; }
+
+/// out holds compress_bound(length) bytes, returns the size of the block
+size_t compress_block(const uint8_t *src, size_t length, uint8_t *out) {
+    uint32_t table[1 << hash_log];
+    memset(table, 0, sizeof(table));
+    uint8_t *op = out;
+    size_t anchor = 0;
+    size_t ip = 0;
+    if (length > match_find_limit) {
+        size_t find_limit = length - match_find_limit;
+        size_t match_limit = length - last_literals;
+        // steps over incompressible data faster the longer no match is found
+        uint32_t misses = 0;
+        while (ip < find_limit) {
+            uint32_t sequence = read32(src + ip);
+            uint32_t &slot = table[hash_sequence(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(ip);
+            if (candidate >= ip || ip - candidate > max_offset || read32(src + candidate) != sequence) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1]) {
+                --ip;
+                --candidate;
+            }
+            size_t match_length = min_match;
+            bool mismatch = false;
+            while (!mismatch && ip + match_length + sizeof(uint64_t) <= match_limit) {
+                uint64_t difference = read64(src + ip + match_length) ^ read64(src + candidate + match_length);
+                if (difference != 0) {
+                    match_length += common_bytes(difference);
+                    mismatch = true;
+                } else {
+                    match_length += sizeof(uint64_t);
+                }
+            }
+            while (!mismatch && ip + match_length < match_limit &&
+                   src[ip + match_length] == src[candidate + match_length]) {
+                ++match_length;
+            }
+            size_t literal_length = ip - anchor;
+            uint8_t *token = op++;
+            *token = static_cast<uint8_t>(literal_length >= 15 ? 15 << 4 : literal_length << 4);
+            if (literal_length >= 15) {
+                op = write_length(op, literal_length - 15);
+            }
+            memcpy(op, src + anchor, literal_length);
+            op += literal_length;
+            uint16_t offset = static_cast<uint16_t>(ip - candidate);
+            *op++ = static_cast<uint8_t>(offset);
+            *op++ = static_cast<uint8_t>(offset >> 8);
+            size_t extra_length = match_length - min_match;
+            *token |= static_cast<uint8_t>(extra_length >= 15 ? 15 : extra_length);
+            if (extra_length >= 15) {
+                op = write_length(op, extra_length - 15);
+            }
+            ip += match_length;
+            anchor = ip;
+            if (ip < find_limit) {
+                // the position just before the next search is a likely match as well
+                table[hash_sequence(read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2);
+            }
+        }
+    }
+    size_t literal_length = length - anchor;
+    uint8_t *token = op++;
+    *token = static_cast<uint8_t>(literal_length >= 15 ? 15 << 4 : literal_length << 4);
+    if (literal_length >= 15) {
+        op = write_length(op, literal_length - 15);
+    }
+    memcpy(op, src + anchor, literal_length);
+    op += literal_length;
+    return op - out;
+}
+
+/// reads the extension bytes of a length, false if the block ends first
+inline bool read_length(const uint8_t *src, size_t size, size_t *ip, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*ip >= size) {
+            return false;
+        }
+        byte = src[(*ip)++];
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool decompress_block(const uint8_t *src, size_t size, uint8_t *out, size_t out_length) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < size) {
+        uint8_t token = src[ip++];
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(src, size, &ip, &literal_length)) {
+            return false;
+        }
+        if (literal_length > size - ip || literal_length > out_length - op) {
+            return false;
+        }
+        memcpy(out + op, src + ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+        if (ip == size) {
+            // the last sequence has no match
+            return op == out_length;
+        }
+        if (size - ip < 2) {
+            return false;
+        }
+        size_t offset = src[ip] | (static_cast<size_t>(src[ip + 1]) << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(src, size, &ip, &match_length)) {
+            return false;
+        }
+        match_length += min_match;
+        if (offset == 0 || offset > op || match_length > out_length - op) {
+            return false;
+        }
+        if (offset >= match_length) {
+            memcpy(out + op, out + op - offset, match_length);
+        } else {
+            // overlapping, repeats the last offset bytes
+            for (size_t i = 0; i < match_length; ++i) {
+                out[op + i] = out[op + i - offset];
+            }
+        }
+        op += match_length;
+    }
+    return false;
+}
+
+}  // namespace
+
+bool compress_payload(const uint8_t *data, size_t length, std::vector<uint8_t> *out) {
+    if (length == 0 || length > UINT32_MAX) {
+        return false;
+    }
+    out->resize(sizeof(uint32_t) + compress_bound(length));
+    uint32_t network_length = htonl(static_cast<uint32_t>(length));
+    memcpy(out->data(), &network_length, sizeof(network_length));
+    size_t block_size = compress_block(data, length, out->data() + sizeof(uint32_t));
+    if (sizeof(uint32_t) + block_size >= length) {
+        return false;
+    }
+    out->resize(sizeof(uint32_t) + block_size);
+    return true;
+}
+
+bool decompressed_size(const uint8_t *data, size_t length, uint32_t *size) {
+    if (length <= sizeof(uint32_t)) {
+        return false;
+    }
+    uint32_t network_length;
+    memcpy(&network_length, data, sizeof(network_length));
+    *size = ntohl(network_length);
+    // refuses sizes no block of this length decompresses to, or no frame could carry uncompressed, before
+    // anything is allocated
+    return *size <= MAX_FRAME_DATA_LENGTH && *size <= (length - sizeof(uint32_t)) * max_ratio;
+}
+
+bool decompress_payload(const uint8_t *data, size_t length, uint8_t *out, size_t out_length) {
+    uint32_t size;
+    if (!decompressed_size(data, length, &size) || size == 0 || size != out_length) {
+        return false;
+    }
+    return decompress_block(data + sizeof(uint32_t), length - sizeof(uint32_t), out, out_length);
+}
+
+bool decompress_payload(const uint8_t *data, size_t length, std::vector<uint8_t> *out) {
+    uint32_t size;
+    if (!decompressed_size(data, length, &size)) {
+        return false;
+    }
+    out->resize(size);
+    return decompress_payload(data, length, out->data(), out->size());
+}
@@ -0,0 +1,219 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "control_message.hpp"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include "nlohmann/json.hpp"
+
+#include "log.hpp"
+
+namespace {
+
+enum ControlFieldKind : uint8_t { CONTROL_FIELD_STRING = 0, CONTROL_FIELD_UINT, CONTROL_FIELD_BOOL };
+
+struct ControlField {
+    const char *key;
+    ControlFieldKind kind;
+};
+
+// json keys of the tags, indexed by ControlTag
+const ControlField control_fields[CONTROL_TAG_MAX] = {
+    {"", CONTROL_FIELD_STRING},
+    {"response", CONTROL_FIELD_STRING},
+    {"name", CONTROL_FIELD_STRING},
+    {"topic", CONTROL_FIELD_STRING},
+    {"type_id", CONTROL_FIELD_UINT},
+    {"method", CONTROL_FIELD_STRING},
+    {"request_type_id", CONTROL_FIELD_UINT},
+    {"response_type_id", CONTROL_FIELD_UINT},
+    {"publisher_ip", CONTROL_FIELD_STRING},
+    {"publisher_port", CONTROL_FIELD_UINT},
+    {"publisher_name", CONTROL_FIELD_STRING},
+    {"publisher_local", CONTROL_FIELD_BOOL},
+    {"provider_ip", CONTROL_FIELD_STRING},
+    {"provider_port", CONTROL_FIELD_UINT},
+    {"provider_name", CONTROL_FIELD_STRING},
+    {"provider_frame_version", CONTROL_FIELD_UINT},
+    {"publisher_unix_path", CONTROL_FIELD_STRING},
+    {"provider_unix_path", CONTROL_FIELD_STRING},
+    {"multicast", CONTROL_FIELD_BOOL},
+    {"multicast_group", CONTROL_FIELD_STRING},
+    {"multicast_port", CONTROL_FIELD_UINT},
+    {"compression", CONTROL_FIELD_UINT},
+    {"compression_min_size", CONTROL_FIELD_UINT},
+    {"type_fingerprint", CONTROL_FIELD_UINT},
+    {"request_fingerprint", CONTROL_FIELD_UINT},
+    {"response_fingerprint", CONTROL_FIELD_UINT},
+};
+
+}  // namespace
+
+void ControlMessage::append(ControlTag tag, const char *value, uint16_t length) {
+    uint16_t network_length = htons(length);
+    buffer_.push_back(static_cast<char>(tag));
+    buffer_.append(reinterpret_cast<const char *>(&network_length), sizeof(network_length));
+    buffer_.append(value, length);
+}
+
+void ControlMessage::set_string(ControlTag tag, const std::string &value) {
+    if (value.size() > UINT16_MAX) {
+        LERROR(ControlMessage) << "Value of tag " << static_cast<int32_t>(tag) << " is too long";
+        return;
+    }
+    append(tag, value.data(), value.size());
+}
+
+void ControlMessage::set_uint(ControlTag tag, uint64_t value) {
+    char bytes[sizeof(uint64_t)];
+    uint16_t length = 0;
+    do {
+        bytes[sizeof(bytes) - 1 - length] = static_cast<char>(value & 0xff);
+        value >>= 8;
+        ++length;
+    } while (value != 0);
+    append(tag, bytes + sizeof(bytes) - length, length);
+}
+
+bool ControlMessage::find(ControlTag tag, const char **value, uint16_t *length) const {
+    size_t offset = 1;
+    while (offset + 3 <= buffer_.size()) {
+        uint16_t field_length;
+        memcpy(&field_length, buffer_.data() + offset + 1, sizeof(field_length));
+        field_length = ntohs(field_length);
+        if (static_cast<uint8_t>(buffer_[offset]) == tag) {
+            if (value != nullptr) {
+                *value = buffer_.data() + offset + 3;
+                *length = field_length;
+            }
+            return true;
+        }
+        offset += 3 + field_length;
+    }
+    return false;
+}
+
+bool ControlMessage::get_string(ControlTag tag, std::string *value) const {
+    const char *data;
+    uint16_t length;
+    if (!find(tag, &data, &length)) {
+        return false;
+    }
+    value->assign(data, length);
+    return true;
+}
+
+std::string ControlMessage::get_string(ControlTag tag) const {
+    std::string value;
+    get_string(tag, &value);
+    return value;
+}
+
+bool ControlMessage::get_uint(ControlTag tag, uint64_t *value) const {
+    const char *data;
+    uint16_t length;
+    if (!find(tag, &data, &length) || length == 0 || length > sizeof(uint64_t)) {
+        return false;
+    }
+    *value = 0;
+    for (uint16_t i = 0; i < length; ++i) {
+        *value = (*value << 8) | static_cast<uint8_t>(data[i]);
+    }
+    return true;
+}
+
+bool ControlMessage::get_uint(ControlTag tag, uint32_t *value) const {
+    uint64_t wide;
+    if (!get_uint(tag, &wide) || wide > UINT32_MAX) {
+        return false;
+    }
+    *value = wide;
+    return true;
+}
+
+bool ControlMessage::get_bool(ControlTag tag, bool *value) const {
+    uint64_t wide;
+    if (!get_uint(tag, &wide)) {
+        return false;
+    }
+    *value = wide != 0;
+    return true;
+}
+
+bool ControlMessage::parse(const uint8_t *data, size_t size) {
+    if (!is_binary(data, size)) {
+        return false;
+    }
+    size_t offset = 1;
+    while (offset < size) {
+        if (offset + 3 > size) {
+            return false;
+        }
+        uint16_t field_length;
+        memcpy(&field_length, data + offset + 1, sizeof(field_length));
+        offset += 3 + ntohs(field_length);
+    }
+    if (offset != size) {
+        return false;
+    }
+    buffer_.assign(reinterpret_cast<const char *>(data), size);
+    return true;
+}
+
+bool ControlMessage::from_json(const std::string &content) {
+    clear();
+    try {
+        nlohmann::json json_struct = nlohmann::json::parse(content);
+        for (uint8_t tag = CONTROL_TAG_RESPONSE; tag < CONTROL_TAG_MAX; ++tag) {
+            auto field = json_struct.find(control_fields[tag].key);
+            if (field == json_struct.end()) {
+                continue;
+            }
+            switch (control_fields[tag].kind) {
+                case CONTROL_FIELD_STRING:
+                    set_string(static_cast<ControlTag>(tag), field->get<std::string>());
+                    break;
+                case CONTROL_FIELD_UINT:
+                    set_uint(static_cast<ControlTag>(tag), field->get<uint64_t>());
+                    break;
+                case CONTROL_FIELD_BOOL:
+                    set_bool(static_cast<ControlTag>(tag), field->get<bool>());
+                    break;
+            }
+        }
+    } catch (nlohmann::json::exception &e) {
+        LERROR(ControlMessage) << "Exception in json : " << e.what();
+        return false;
+    }
+    return true;
+}
+
+std::string ControlMessage::to_json() const {
+    nlohmann::json json_struct = nlohmann::json::object();
+    for (uint8_t tag = CONTROL_TAG_RESPONSE; tag < CONTROL_TAG_MAX; ++tag) {
+        switch (control_fields[tag].kind) {
+            case CONTROL_FIELD_STRING: {
+                std::string value;
+                if (get_string(static_cast<ControlTag>(tag), &value)) {
+                    json_struct[control_fields[tag].key] = value;
+                }
+            } break;
+            case CONTROL_FIELD_UINT: {
+                uint64_t value;
+                if (get_uint(static_cast<ControlTag>(tag), &value)) {
+                    json_struct[control_fields[tag].key] = value;
+                }
+            } break;
+            case CONTROL_FIELD_BOOL: {
+                bool value;
+                if (get_bool(static_cast<ControlTag>(tag), &value)) {
+                    json_struct[control_fields[tag].key] = value;
+                }
+            } break;
+        }
+    }
+    return json_struct.dump();
+}
@@ -0,0 +1,229 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "frame_pool.hpp"
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+struct alignas(16) FrameBuffer::Block {
+    std::atomic<uint32_t> references{1};
+    uint8_t size_class = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    uint8_t *data() { return reinterpret_cast<uint8_t *>(this) + sizeof(Block); }
+};
+
+std::atomic<size_t> FramePool::reserved_bytes_{0};
+
+namespace {
+
+const uint8_t oversize_class = 0xff;
+
+struct SharedCache {
+    std::mutex mtx;
+    std::vector<void *> blocks[FramePool::class_count];
+};
+
+// never destroyed, threads may still release blocks while the process exits
+SharedCache &shared_cache() {
+    static SharedCache *cache = new SharedCache();
+    return *cache;
+}
+
+/// blocks of size_class which fit in bytes, within [2, max_count]
+uint32_t cache_limit(uint8_t size_class, size_t bytes, uint32_t max_count) {
+    size_t count = bytes / (FramePool::min_block_size << size_class);
+    return static_cast<uint32_t>(count < 2 ? 2 : count > max_count ? max_count : count);
+}
+
+uint32_t thread_cache_limit(uint8_t size_class) {
+    return cache_limit(size_class, FramePool::thread_cache_bytes, FramePool::thread_cache_size);
+}
+
+uint32_t shared_cache_limit(uint8_t size_class) {
+    return cache_limit(size_class, FramePool::shared_cache_bytes, UINT32_MAX);
+}
+
+// set once the cache of the thread is destroyed, thread_local objects destroyed after it release their
+// blocks straight to the shared list
+thread_local bool thread_cache_destroyed = false;
+
+}  // namespace
+
+struct FramePool::ThreadCache {
+    ThreadCache() {
+        for (uint8_t size_class = 0; size_class < class_count; ++size_class) {
+            blocks[size_class].reserve(thread_cache_limit(size_class));
+        }
+    }
+    ~ThreadCache() {
+        thread_cache_destroyed = true;
+        for (uint8_t size_class = 0; size_class < class_count; ++size_class) {
+            for (void *block : blocks[size_class]) {
+                release_shared(block, size_class);
+            }
+        }
+    }
+    std::vector<void *> blocks[class_count];
+};
+
+FramePool::ThreadCache *FramePool::thread_cache() {
+    if (thread_cache_destroyed) {
+        return nullptr;
+    }
+    thread_local ThreadCache cache;
+    return &cache;
+}
+
+size_t FramePool::block_size(uint8_t size_class) {
+    return sizeof(FrameBuffer::Block) + (min_block_size << size_class);
+}
+
+void *FramePool::acquire(size_t size, uint8_t *size_class) {
+    uint8_t found = 0;
+    while (found < class_count && (min_block_size << found) < size) {
+        ++found;
+    }
+    if (found == class_count) {
+        *size_class = oversize_class;
+        reserved_bytes_.fetch_add(sizeof(FrameBuffer::Block) + size, std::memory_order_relaxed);
+        return ::operator new(sizeof(FrameBuffer::Block) + size);
+    }
+    *size_class = found;
+
+    ThreadCache *cache = thread_cache();
+    if (cache == nullptr) {
+        // the thread exits, nothing is cached for it anymore
+        SharedCache &shared = shared_cache();
+        std::lock_guard<std::mutex> lock(shared.mtx);
+        std::vector<void *> &blocks = shared.blocks[found];
+        if (!blocks.empty()) {
+            void *block = blocks.back();
+            blocks.pop_back();
+            return block;
+        }
+    } else {
+        std::vector<void *> &local = cache->blocks[found];
+        if (local.empty()) {
+            // take a batch at once, the lock is not taken for every frame
+            SharedCache &shared = shared_cache();
+            std::lock_guard<std::mutex> lock(shared.mtx);
+            std::vector<void *> &blocks = shared.blocks[found];
+            while (!blocks.empty() && local.size() < thread_cache_limit(found) / 2) {
+                local.push_back(blocks.back());
+                blocks.pop_back();
+            }
+        }
+        if (!local.empty()) {
+            void *block = local.back();
+            local.pop_back();
+            return block;
+        }
+    }
+    reserved_bytes_.fetch_add(block_size(found), std::memory_order_relaxed);
+    return ::operator new(block_size(found));
+}
+
+void FramePool::release(void *block, uint8_t size_class) {
+    if (size_class == oversize_class) {
+        FrameBuffer::Block *oversize = static_cast<FrameBuffer::Block *>(block);
+        reserved_bytes_.fetch_sub(sizeof(FrameBuffer::Block) + oversize->capacity, std::memory_order_relaxed);
+        ::operator delete(block);
+        return;
+    }
+    ThreadCache *cache = thread_cache();
+    if (cache == nullptr) {
+        release_shared(block, size_class);
+        return;
+    }
+    std::vector<void *> &local = cache->blocks[size_class];
+    uint32_t limit = thread_cache_limit(size_class);
+    if (local.size() >= limit) {
+        // hand half of the cache over, typically to the thread which keeps taking blocks of this class
+        SharedCache &shared = shared_cache();
+        std::lock_guard<std::mutex> lock(shared.mtx);
+        std::vector<void *> &blocks = shared.blocks[size_class];
+        while (local.size() > limit / 2) {
+            if (blocks.size() < shared_cache_limit(size_class)) {
+                blocks.push_back(local.back());
+            } else {
+                reserved_bytes_.fetch_sub(block_size(size_class), std::memory_order_relaxed);
+                ::operator delete(local.back());
+            }
+            local.pop_back();
+        }
+    }
+    local.push_back(block);
+}
+
+void FramePool::release_shared(void *block, uint8_t size_class) {
+    SharedCache &shared = shared_cache();
+    {
+        std::lock_guard<std::mutex> lock(shared.mtx);
+        if (shared.blocks[size_class].size() < shared_cache_limit(size_class)) {
+            shared.blocks[size_class].push_back(block);
+            return;
+        }
+    }
+    reserved_bytes_.fetch_sub(block_size(size_class), std::memory_order_relaxed);
+    ::operator delete(block);
+}
+
+FrameBuffer::FrameBuffer(size_t size) {
+    uint8_t size_class;
+    void *memory = FramePool::acquire(size, &size_class);
+    block_ = new (memory) Block();
+    block_->size_class = size_class;
+    block_->size = size;
+    block_->capacity = size_class == oversize_class ? size : FramePool::min_block_size << size_class;
+}
+
+FrameBuffer::FrameBuffer(const FrameBuffer &other) : block_(other.block_) {
+    if (block_ != nullptr) {
+        block_->references.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+FrameBuffer &FrameBuffer::operator=(const FrameBuffer &other) {
+    if (this != &other) {
+        FrameBuffer copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+FrameBuffer &FrameBuffer::operator=(FrameBuffer &&other) noexcept {
+    if (this != &other) {
+        reset();
+        block_ = other.block_;
+        other.block_ = nullptr;
+    }
+    return *this;
+}
+
+uint8_t *FrameBuffer::data() const { return block_ != nullptr ? block_->data() : nullptr; }
+
+size_t FrameBuffer::size() const { return block_ != nullptr ? block_->size : 0; }
+
+bool FrameBuffer::resize(size_t size) {
+    if (block_ == nullptr || size > block_->capacity) {
+        return false;
+    }
+    block_->size = size;
+    return true;
+}
+
+void FrameBuffer::reset() {
+    if (block_ == nullptr) {
+        return;
+    }
+    if (block_->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        uint8_t size_class = block_->size_class;
+        FramePool::release(block_, size_class);
+    }
+    block_ = nullptr;
+}
@@ -1,8 +0,0 @@
-#include "message.hpp"
-
-const uint32_t NullMsg::id = 1;
-const uint32_t Int32Msg::id = 2;
-const uint32_t Int64Msg::id = 3;
-const uint32_t Float32Msg::id = 4;
-const uint32_t Float64Msg::id = 5;
-const uint32_t StringMsg::id = 6;
\ No newline at end of file
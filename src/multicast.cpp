@@ -0,0 +1,255 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "multicast.hpp"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+
+#include "log.hpp"
+#include "frame.hpp"
+#include "method_frame.hpp"
+
+namespace {
+
+const uint32_t multicast_magic = 0x55424d43;  // "UBMC"
+// largest UDP payload over IPv4
+const uint32_t max_datagram_size = 65507;
+// datagrams handed to the kernel per sendmmsg
+const size_t send_batch = 64;
+const int32_t socket_buffer_size = 8 * 1024 * 1024;
+
+bool parse_address(const std::string &address, in_addr *result) {
+    if (address.empty()) {
+        result->s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+    return inet_pton(AF_INET, address.c_str(), result) == 1;
+}
+
+}  // namespace
+
+MulticastSender::~MulticastSender() {
+    if (socket_ >= 0) {
+        close(socket_);
+    }
+}
+
+bool MulticastSender::open(const std::string &topic,
+                           const std::string &group,
+                           uint32_t port,
+                           const std::string &interface,
+                           uint32_t datagram_size) {
+    group_address_.sin_family = AF_INET;
+    group_address_.sin_port = htons(static_cast<uint16_t>(port));
+    in_addr interface_address;
+    if (!parse_address(group, &group_address_.sin_addr) || !IN_MULTICAST(ntohl(group_address_.sin_addr.s_addr)) ||
+        !parse_address(interface, &interface_address)) {
+        LERROR(MulticastSender) << "Invalid multicast group " << group << " or interface " << interface;
+        return false;
+    }
+    socket_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        LERROR(MulticastSender) << "Failed to create socket, err " << strerror(errno);
+        return false;
+    }
+    // subscribers on this host receive the datagrams through loopback, they stay on the local link
+    uint8_t loop = 1;
+    uint8_t ttl = 1;
+    setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(socket_, SOL_SOCKET, SO_SNDBUF, &socket_buffer_size, sizeof(socket_buffer_size));
+    if (!interface.empty() &&
+        setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address)) < 0) {
+        LERROR(MulticastSender) << "Failed to send from " << interface << ", err " << strerror(errno);
+        return false;
+    }
+    if (connect(socket_, reinterpret_cast<sockaddr *>(&group_address_), sizeof(group_address_)) < 0) {
+        LERROR(MulticastSender) << "Failed to connect to " << group << ":" << port << ", err " << strerror(errno);
+        return false;
+    }
+    datagram_size = std::min(std::max<uint32_t>(datagram_size, sizeof(MulticastFragmentHeader) + 1), max_datagram_size);
+    fragment_size_ = datagram_size - sizeof(MulticastFragmentHeader);
+    topic_hash_ = method_name_hash(topic);
+    return true;
+}
+
+bool MulticastSender::send(uint64_t sequence, uint64_t timestamp, const uint8_t *data, size_t length) {
+    if (socket_ < 0) {
+        return false;
+    }
+    size_t fragment_count = std::max<size_t>(1, (length + fragment_size_ - 1) / fragment_size_);
+    if (fragment_count > UINT16_MAX || length > UINT32_MAX) {
+        LERROR(MulticastSender) << "Message of " << length << " bytes has too many fragments";
+        return false;
+    }
+    MulticastFragmentHeader headers[send_batch];
+    iovec iov[send_batch][2];
+    mmsghdr messages[send_batch];
+    for (size_t first = 0; first < fragment_count; first += send_batch) {
+        size_t batch = std::min(send_batch, fragment_count - first);
+        for (size_t i = 0; i < batch; ++i) {
+            size_t index = first + i;
+            size_t offset = index * fragment_size_;
+            MulticastFragmentHeader &header = headers[i];
+            header.magic = htonl(multicast_magic);
+            header.topic_hash = htonl(topic_hash_);
+            header.sequence = htobe64(sequence);
+            header.timestamp = htobe64(timestamp);
+            header.total_length = htonl(static_cast<uint32_t>(length));
+            header.offset = htonl(static_cast<uint32_t>(offset));
+            header.fragment_index = htons(static_cast<uint16_t>(index));
+            header.fragment_count = htons(static_cast<uint16_t>(fragment_count));
+            iov[i][0].iov_base = &header;
+            iov[i][0].iov_len = sizeof(header);
+            iov[i][1].iov_base = const_cast<uint8_t *>(data + offset);
+            iov[i][1].iov_len = std::min<size_t>(fragment_size_, length - offset);
+            memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_iov = iov[i];
+            messages[i].msg_hdr.msg_iovlen = 2;
+        }
+        size_t sent = 0;
+        while (sent < batch) {
+            int32_t ret = sendmmsg(socket_, messages + sent, batch - sent, 0);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LDEBUG(MulticastSender) << "Failed to send fragment, err " << strerror(errno);
+                return false;
+            }
+            sent += ret;
+        }
+    }
+    return true;
+}
+
+MulticastReceiver::~MulticastReceiver() {
+    if (socket_ >= 0) {
+        close(socket_);
+    }
+}
+
+bool MulticastReceiver::open(const std::string &topic,
+                             const std::string &group,
+                             uint32_t port,
+                             const std::string &interface) {
+    sockaddr_in group_address = {};
+    group_address.sin_family = AF_INET;
+    group_address.sin_port = htons(static_cast<uint16_t>(port));
+    ip_mreq membership;
+    if (!parse_address(group, &group_address.sin_addr) || !IN_MULTICAST(ntohl(group_address.sin_addr.s_addr)) ||
+        !parse_address(interface, &membership.imr_interface)) {
+        LERROR(MulticastReceiver) << "Invalid multicast group " << group << " or interface " << interface;
+        return false;
+    }
+    membership.imr_multiaddr = group_address.sin_addr;
+    socket_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket_ < 0) {
+        LERROR(MulticastReceiver) << "Failed to create socket, err " << strerror(errno);
+        return false;
+    }
+    // every subscriber of the host binds the same group and port
+    int32_t enable = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &socket_buffer_size, sizeof(socket_buffer_size));
+#ifdef IP_MULTICAST_ALL
+    // only the joined group, not every group some socket of the host joined on this port
+    int32_t disable = 0;
+    setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_ALL, &disable, sizeof(disable));
+#endif
+    if (bind(socket_, reinterpret_cast<sockaddr *>(&group_address), sizeof(group_address)) < 0) {
+        LERROR(MulticastReceiver) << "Failed to bind " << group << ":" << port << ", err " << strerror(errno);
+        return false;
+    }
+    if (setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+        LERROR(MulticastReceiver) << "Failed to join " << group << ", err " << strerror(errno);
+        return false;
+    }
+    topic_hash_ = method_name_hash(topic);
+    datagram_.resize(max_datagram_size);
+    return true;
+}
+
+int32_t MulticastReceiver::receive(uint64_t *sequence, uint64_t *timestamp, std::string_view *message) {
+    while (1) {
+        ssize_t size = recv(socket_, datagram_.data(), datagram_.size(), 0);
+        if (size < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        MulticastFragmentHeader header;
+        if (static_cast<size_t>(size) < sizeof(header)) {
+            continue;
+        }
+        memcpy(&header, datagram_.data(), sizeof(header));
+        if (ntohl(header.magic) != multicast_magic || ntohl(header.topic_hash) != topic_hash_) {
+            continue;
+        }
+        uint64_t fragment_sequence = be64toh(header.sequence);
+        uint32_t total_length = ntohl(header.total_length);
+        uint32_t offset = ntohl(header.offset);
+        uint16_t fragment_index = ntohs(header.fragment_index);
+        uint16_t fragment_count = ntohs(header.fragment_count);
+        size_t length = size - sizeof(header);
+        if (fragment_index >= fragment_count || static_cast<uint64_t>(offset) + length > total_length) {
+            LDEBUG(MulticastReceiver) << "Invalid fragment header";
+            continue;
+        }
+        // total_length comes from the network, it is checked before the message buffer is sized to it
+        if (total_length > MAX_FRAME_DATA_LENGTH ||
+            total_length > static_cast<uint64_t>(fragment_count) * (datagram_.size() - sizeof(header))) {
+            LDEBUG(MulticastReceiver) << "Fragment of an oversized message";
+            continue;
+        }
+        if (missing_fragments_ > 0 && fragment_sequence != sequence_) {
+            if (fragment_sequence < sequence_) {
+                // late fragment of a message already given up
+                continue;
+            }
+            ++incomplete_count_;
+            missing_fragments_ = 0;
+        }
+        *sequence = fragment_sequence;
+        *timestamp = be64toh(header.timestamp);
+        if (fragment_count == 1) {
+            if (length != total_length) {
+                continue;
+            }
+            *message = std::string_view(reinterpret_cast<const char *>(datagram_.data()) + sizeof(header), length);
+            return 1;
+        }
+        if (missing_fragments_ == 0) {
+            if (!fragments_.empty() && fragment_sequence <= sequence_) {
+                // fragment of a message already delivered or given up
+                continue;
+            }
+            sequence_ = fragment_sequence;
+            message_.resize(total_length);
+            fragments_.assign(fragment_count, false);
+            missing_fragments_ = fragment_count;
+        }
+        if (fragments_.size() != fragment_count || message_.size() != total_length) {
+            LDEBUG(MulticastReceiver) << "Fragment does not match its message";
+            continue;
+        }
+        if (fragments_[fragment_index]) {
+            continue;
+        }
+        memcpy(message_.data() + offset, datagram_.data() + sizeof(header), length);
+        fragments_[fragment_index] = true;
+        if (--missing_fragments_ == 0) {
+            *message = std::string_view(reinterpret_cast<const char *>(message_.data()), message_.size());
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,247 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include "shared_memory.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "log.hpp"
+
+namespace {
+
+// changes with the layout of the slots
+const uint32_t shm_ring_magic = 0x55425353;  // "UBSS"
+
+size_t align_up(size_t size, size_t alignment) { return (size + alignment - 1) / alignment * alignment; }
+
+int32_t futex_wait(std::atomic<uint32_t> *word, uint32_t expected, uint32_t timeout_ms) {
+    timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+int32_t futex_wake(std::atomic<uint32_t> *word) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+}  // namespace
+
+SharedMemoryRing::~SharedMemoryRing() {
+    if (header_ != nullptr) {
+        munmap(header_, mapped_size_);
+    }
+    if (owner_) {
+        shm_unlink(name_.c_str());
+    }
+}
+
+std::string SharedMemoryRing::make_name(const std::string &publisher, const std::string &topic) {
+    std::string name = "/ubus." + publisher + "." + topic;
+    for (size_t i = 1; i < name.size(); ++i) {
+        if (name[i] == '/') {
+            name[i] = '_';
+        }
+    }
+    return name;
+}
+
+bool SharedMemoryRing::map(int32_t fd, size_t size) {
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        LERROR(SharedMemoryRing) << "Failed to mmap " << name_ << ", err " << strerror(errno);
+        return false;
+    }
+    header_ = static_cast<RingHeader *>(addr);
+    mapped_size_ = size;
+    return true;
+}
+
+bool SharedMemoryRing::create(const std::string &name, uint32_t slot_count, uint32_t slot_size) {
+    if (header_ != nullptr || slot_count == 0) {
+        return false;
+    }
+    name_ = name;
+    shm_unlink(name_.c_str());
+    int32_t fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        LERROR(SharedMemoryRing) << "Failed to create " << name_ << ", err " << strerror(errno);
+        return false;
+    }
+    uint32_t slot_stride = align_up(sizeof(SlotHeader) + slot_size, 64);
+    size_t size = align_up(sizeof(RingHeader), 64) + static_cast<size_t>(slot_stride) * slot_count;
+    // pages of the segment are only backed once they are written
+    if (ftruncate(fd, size) < 0 || !map(fd, size)) {
+        LERROR(SharedMemoryRing) << "Failed to size " << name_ << ", err " << strerror(errno);
+        close(fd);
+        shm_unlink(name_.c_str());
+        return false;
+    }
+    close(fd);
+    owner_ = true;
+    header_->slot_count = slot_count;
+    header_->slot_size = slot_size;
+    header_->slot_stride = slot_stride;
+    header_->write_sequence.store(0);
+    header_->futex_word.store(0);
+    header_->waiters.store(0);
+    for (uint32_t i = 0; i < slot_count; ++i) {
+        slot(i)->sequence.store(0);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = shm_ring_magic;
+    return true;
+}
+
+bool SharedMemoryRing::open(const std::string &name) {
+    if (header_ != nullptr) {
+        return false;
+    }
+    name_ = name;
+    int32_t fd = shm_open(name_.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        LDEBUG(SharedMemoryRing) << "Failed to open " << name_ << ", err " << strerror(errno);
+        return false;
+    }
+    struct stat shm_stat;
+    if (fstat(fd, &shm_stat) < 0 || static_cast<size_t>(shm_stat.st_size) < sizeof(RingHeader) ||
+        !map(fd, shm_stat.st_size)) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->magic != shm_ring_magic || header_->slot_count == 0 ||
+        header_->slot_stride < sizeof(SlotHeader) + static_cast<size_t>(header_->slot_size) ||
+        align_up(sizeof(RingHeader), 64) + static_cast<size_t>(header_->slot_stride) * header_->slot_count >
+            mapped_size_) {
+        LERROR(SharedMemoryRing) << "Invalid ring layout in " << name_;
+        munmap(header_, mapped_size_);
+        header_ = nullptr;
+        return false;
+    }
+    read_sequence_ = header_->write_sequence.load(std::memory_order_acquire);
+    return true;
+}
+
+uint32_t SharedMemoryRing::slot_size() const { return header_ == nullptr ? 0 : header_->slot_size; }
+
+SharedMemoryRing::SlotHeader *SharedMemoryRing::slot(uint64_t sequence) const {
+    uint8_t *base = reinterpret_cast<uint8_t *>(header_) + align_up(sizeof(RingHeader), 64);
+    return reinterpret_cast<SlotHeader *>(base + (sequence % header_->slot_count) * header_->slot_stride);
+}
+
+bool SharedMemoryRing::write(const void *data, size_t length, uint64_t event_sequence, uint64_t event_timestamp) {
+    uint8_t *target = reserve(length);
+    if (target == nullptr) {
+        return false;
+    }
+    memcpy(target, data, length);
+    return commit(length, event_sequence, event_timestamp);
+}
+
+uint8_t *SharedMemoryRing::reserve(size_t length) {
+    if (header_ == nullptr || !owner_ || reserved_ || length > header_->slot_size) {
+        return nullptr;
+    }
+    uint64_t sequence = header_->write_sequence.load(std::memory_order_relaxed);
+    SlotHeader *target = slot(sequence);
+    // consumers still reading the previous message of the slot see it change and drop it
+    target->sequence.store(2 * sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    reserved_ = true;
+    reserved_length_ = length;
+    return reinterpret_cast<uint8_t *>(target) + sizeof(SlotHeader);
+}
+
+bool SharedMemoryRing::commit(size_t length, uint64_t event_sequence, uint64_t event_timestamp) {
+    if (!reserved_ || length > reserved_length_) {
+        return false;
+    }
+    reserved_ = false;
+    uint64_t sequence = header_->write_sequence.load(std::memory_order_relaxed);
+    SlotHeader *target = slot(sequence);
+    target->length = length;
+    target->event_sequence = event_sequence;
+    target->event_timestamp = event_timestamp;
+    target->sequence.store(2 * sequence + 2, std::memory_order_release);
+    header_->write_sequence.store(sequence + 1, std::memory_order_release);
+
+    header_->futex_word.fetch_add(1);
+    if (header_->waiters.load() > 0) {
+        futex_wake(&header_->futex_word);
+    }
+    return true;
+}
+
+int32_t SharedMemoryRing::read(std::string *data,
+                               uint32_t timeout_ms,
+                               uint64_t *event_sequence,
+                               uint64_t *event_timestamp) {
+    if (header_ == nullptr || data == nullptr) {
+        return -1;
+    }
+    while (1) {
+        uint64_t write_sequence = header_->write_sequence.load(std::memory_order_acquire);
+        if (read_sequence_ >= write_sequence) {
+            uint32_t word = header_->futex_word.load();
+            if (read_sequence_ < header_->write_sequence.load(std::memory_order_acquire)) {
+                continue;
+            }
+            header_->waiters.fetch_add(1);
+            int32_t ret = futex_wait(&header_->futex_word, word, timeout_ms);
+            header_->waiters.fetch_sub(1);
+            if (ret < 0 && errno == ETIMEDOUT) {
+                return 0;
+            }
+            continue;
+        }
+        if (write_sequence - read_sequence_ > header_->slot_count) {
+            overrun_count_ += write_sequence - read_sequence_ - header_->slot_count;
+            read_sequence_ = write_sequence - header_->slot_count;
+        }
+
+        SlotHeader *source = slot(read_sequence_);
+        uint64_t expected = 2 * read_sequence_ + 2;
+        uint64_t before = source->sequence.load(std::memory_order_acquire);
+        if (before != expected) {
+            // already overwritten by the producer
+            ++overrun_count_;
+            ++read_sequence_;
+            continue;
+        }
+        uint32_t length = source->length;
+        if (length > header_->slot_size) {
+            ++overrun_count_;
+            ++read_sequence_;
+            continue;
+        }
+        data->assign(reinterpret_cast<const char *>(source) + sizeof(SlotHeader), length);
+        uint64_t message_sequence = source->event_sequence;
+        uint64_t message_timestamp = source->event_timestamp;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = source->sequence.load(std::memory_order_relaxed);
+        ++read_sequence_;
+        if (after != before) {
+            ++overrun_count_;
+            continue;
+        }
+        if (event_sequence != nullptr) {
+            *event_sequence = message_sequence;
+        }
+        if (event_timestamp != nullptr) {
+            *event_timestamp = message_timestamp;
+        }
+        return 1;
+    }
+}
@@ -4,13 +4,20 @@
 
 #include "ubus_master.hpp"
 
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <thread>
 
 #include "nlohmann/json.hpp"
 
 #include "helpers.hpp"
 #include "frame.hpp"
+#include "frame_reader.hpp"
 #include "shared_lock_guard.hpp"
 
 bool UBusMaster::init(const std::string &ip, uint32_t port) {
@@ -18,6 +25,8 @@ bool UBusMaster::init(const std::string &ip, uint32_t port) {
         LWARN(UBusMaster) << "Already initiated";
         return false;
     }
+    // a dropped participant shows up as a failed write, not as a signal ending the master
+    signal(SIGPIPE, SIG_IGN);
     if ((control_sock_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         LERROR(UBusMaster) << "Failed to create socket";
         control_sock_ = 0;
@@ -31,10 +40,41 @@ bool UBusMaster::init(const std::string &ip, uint32_t port) {
         LERROR(UBusMaster) << "Failed to convert ip address " << ip;
         return false;
     }
+    // a restarted master binds again while connections of the previous one are in TIME_WAIT
+    int reuse = 1;
+    if (setsockopt(control_sock_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+        LWARN(UBusMaster) << "Failed to set SO_REUSEADDR";
+    }
     if (bind(control_sock_, reinterpret_cast<sockaddr *>(&control_addr), sizeof(control_addr)) < 0) {
         LERROR(UBusMaster) << "Failed to convert bind to ip " << ip << " port " << port;
         return false;
     }
+    // connections are queued from now on, participants started before run() do not fail to connect
+    if (listen(control_sock_, 4096) < 0) {
+        LERROR(UBusMaster) << "Failed to start listening";
+        return false;
+    }
+
+    // every participant holds a socket to the master
+    rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max) {
+        fd_limit.rlim_cur = fd_limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &fd_limit) < 0) {
+            LWARN(UBusMaster) << "Failed to raise the limit of open files";
+        }
+    }
+
+    if ((epoll_fd_ = epoll_create1(EPOLL_CLOEXEC)) < 0 || (wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LERROR(UBusMaster) << "Failed to create epoll, err " << strerror(errno);
+        return false;
+    }
+    epoll_event wakeup_event;
+    wakeup_event.events = EPOLLIN;
+    wakeup_event.data.fd = wakeup_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &wakeup_event) < 0) {
+        LERROR(UBusMaster) << "Failed to add eventfd to epoll, err " << strerror(errno);
+        return false;
+    }
     this->initiated_.store(true);
     return true;
 }
@@ -50,417 +90,558 @@ bool UBusMaster::run() {
     return true;
 }
 
-void UBusMaster::process_control_message() {
-    pollfd poll_fd_list[max_connections_];
-    for (int i = 0; i < max_connections_; ++i) {
-        poll_fd_list[i].fd = -1;
+void UBusMaster::wake_up_control_worker() {
+    uint64_t value = 1;
+    if (write(wakeup_fd_, &value, sizeof(value)) < 0) {
+        LERROR(UBusMaster) << "Failed to wake up control worker";
+    }
+}
+
+/// Decodes a control frame from either encoding, binary tells the one used by the participant
+static bool decode_control_message(const std::string &content, ControlMessage *message, bool *binary) {
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(content.data());
+    *binary = ControlMessage::is_binary(data, content.size());
+    if (*binary) {
+        return message->parse(data, content.size());
+    }
+    return message->from_json(content);
+}
+
+/// Participants built before fingerprints, or sending messages without a schema, only have their type ids compared
+static bool fingerprint_matches(uint32_t fingerprint, const ControlMessage &request, ControlTag tag) {
+    uint32_t requested = 0;
+    return fingerprint == 0 || !request.get_uint(tag, &requested) || requested == 0 || requested == fingerprint;
+}
+
+void UBusMaster::send_control_message(int32_t fd, FrameType type, const ControlMessage &message, bool binary) {
+    std::string serialized_string = binary ? message.encoded() : message.to_json();
+    Frame frame;
+    frame.header.message_type = type;
+    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
+    frame.data = reinterpret_cast<uint8_t *>(&serialized_string[0]);
+    send_control_frame(fd, frame);
+}
+
+void UBusMaster::send_control_frame(int32_t fd, const Frame &frame) {
+    int32_t ret;
+    if ((ret = send_frame(fd, frame)) < 0) {
+        // the frame may be cut, the stream is of no use anymore. The control worker sees the socket hang up, the
+        // watchdog releases the participant.
+        LWARN(UBusMaster) << "Write returned " << ret << " on socket " << fd << ", err " << strerror(errno)
+                          << ", drop the participant";
+        shutdown(fd, SHUT_RDWR);
+        dropped_sockets_.insert(fd);
+    }
+}
+
+void UBusMaster::notify_method_resolvers(const std::string &method) {
+    auto resolvers = method_resolvers_.find(method);
+    if (resolvers == method_resolvers_.end()) {
+        return;
     }
+    ControlMessage invalidate;
+    invalidate.set_string(CONTROL_TAG_METHOD, method);
+    for (auto &name : resolvers->second) {
+        auto participant = participant_list_.find(name);
+        if (participant == participant_list_.end()) {
+            continue;
+        }
+        LDEBUG(UBusMaster) << "Invalidate method " << method << " for " << name;
+        send_control_message(participant->second->socket, FRAME_METHOD_INVALIDATE, invalidate,
+                             participant->second->binary_control);
+    }
+    // resolvers register again with their next query
+    method_resolvers_.erase(resolvers);
+}
+
+void UBusMaster::process_control_message() {
+    std::unordered_map<int32_t, FrameReader> readers;
+    // accepted sockets which did not join yet, they belong to this thread until then
+    std::unordered_map<int32_t, sockaddr_in> initiating;
 
+    const int32_t max_events = 256;
+    epoll_event events[max_events];
     while (1) {
-        {
-            std::lock_guard<std::mutex> lock(unprocessed_dead_participants_mtx_);
-            while (!unprocessed_dead_participants_.empty()) {
-                WritingSharedLockGuard shared_lock(participant_info_mtx_);
-                auto &participant = unprocessed_dead_participants_.front();
-                for (int i = 0; i < max_connections_; ++i) {
-                    if (poll_fd_list[i].fd == participant_list_.at(participant)->socket) {
-                        poll_fd_list[i].fd = -1;
-                        break;
-                    }
+        int32_t ret = epoll_wait(epoll_fd_, events, max_events, -1);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                LERROR(UBusMaster) << "Error in epoll_wait, err " << strerror(errno);
+            }
+            continue;
+        }
+        for (int32_t i = 0; i < ret; ++i) {
+            int32_t fd = events[i].data.fd;
+            if (fd == wakeup_fd_) {
+                uint64_t value;
+                if (read(wakeup_fd_, &value, sizeof(value)) < 0) {
+                    LDEBUG(UBusMaster) << "Failed to read wake up event";
                 }
-                auto ite = participant_list_.find(participant);
-                if (ite != participant_list_.end()) {
-                    {
-                        std::lock_guard<std::mutex> lock_event(event_list_mtx_);
-                        for (auto &event : ite->second->published_topic_list) {
-                            event_list_.erase(event.first);
-                        }
-                    }
-                    {
-                        std::lock_guard<std::mutex> lock_method(method_list_mtx_);
-                        for (auto &method : ite->second->method_list) {
-                            method_list_.erase(method.first);
-                        }
-                    }
+                process_participant_changes(&readers, &initiating);
+                continue;
+            }
 
-                    auto socket = ite->second->socket;
-                    participant_list_.erase(ite);
-                    auto ite2 = socket_participant_mapping_.find(socket);
-                    if (ite2 != socket_participant_mapping_.end()) {
-                        socket_participant_mapping_.erase(ite2);
+            auto reader = readers.find(fd);
+            if (reader == readers.end()) {
+                // removed earlier in this round
+                continue;
+            }
+            LTRACE(UBusMaster) << "Socket " << fd << " is readable";
+            // edge triggered, fill reads until the socket is drained
+            bool alive = reader->second.fill(fd);
+            auto initiating_connection = initiating.find(fd);
+            FrameHeader header;
+            const uint8_t *data = nullptr;
+            while (reader->second.next(&header, &data)) {
+                if (dropped_sockets_.count(fd) > 0) {
+                    // the frames still buffered would only be answered into a shut down socket
+                    alive = false;
+                    break;
+                }
+                std::string content(reinterpret_cast<const char *>(data), header.data_length);
+                // binary control messages are TLV, not text
+                LDEBUG(UBusMaster) << "Control frame " << static_cast<int32_t>(header.message_type) << ", "
+                                   << header.data_length << " bytes";
+                if (initiating_connection != initiating.end()) {
+                    if (!process_initiation(fd, initiating_connection->second, header, content)) {
+                        alive = false;
+                        break;
                     }
+                    initiating.erase(initiating_connection);
+                    initiating_connection = initiating.end();
+                    continue;
+                }
+                try {
+                    process_control_frame(fd, header, content);
+                } catch (nlohmann::json::exception &e) {
+                    LERROR(UBusMaster) << "Exception in json : " << e.what();
                 }
-                unprocessed_dead_participants_.pop();
+            }
+            if (reader->second.failed()) {
+                LERROR(UBusMaster) << "Oversized control frame on socket " << fd;
+                // the stream cannot be read any further, hang up so that the peer notices
+                shutdown(fd, SHUT_RDWR);
+                alive = false;
+            }
+            if (!alive) {
+                LWARN(UBusMaster) << "Peer is closed, remove from epoll.";
+                epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+                readers.erase(fd);
+                dropped_sockets_.erase(fd);
+                if (initiating.erase(fd) > 0) {
+                    // never joined, nobody else holds the socket
+                    close(fd);
+                }
+                // otherwise the watchdog will declare the participant dead and release the socket
             }
         }
+    }
+}
 
-        {
-            std::lock_guard<std::mutex> lock(unprocessed_new_participants_mtx_);
-            while (!unprocessed_new_participants_.empty()) {
-                ReadingSharedLockGuard shared_lock(participant_info_mtx_);
-                auto &participant = unprocessed_new_participants_.front();
-                for (int i = 0; i < max_connections_; ++i) {
-                    if (poll_fd_list[i].fd == -1) {
-                        poll_fd_list[i].fd = participant_list_.at(participant)->socket;
-                        poll_fd_list[i].events = POLLIN;
-                        poll_fd_list[i].revents = 0;
-                        break;
+void UBusMaster::process_participant_changes(std::unordered_map<int32_t, FrameReader> *readers,
+                                             std::unordered_map<int32_t, sockaddr_in> *initiating) {
+    {
+        std::lock_guard<std::mutex> lock(unprocessed_dead_participants_mtx_);
+        while (!unprocessed_dead_participants_.empty()) {
+            WritingSharedLockGuard shared_lock(participant_info_mtx_);
+            auto ite = participant_list_.find(unprocessed_dead_participants_.front());
+            unprocessed_dead_participants_.pop();
+            if (ite == participant_list_.end()) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock_event(event_list_mtx_);
+                for (auto &event : ite->second->published_topic_list) {
+                    event_list_.erase(event.first);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock_method(method_list_mtx_);
+                // its name may be taken by a newcomer, which must not get the invalidations of its predecessor
+                for (auto resolvers = method_resolvers_.begin(); resolvers != method_resolvers_.end();) {
+                    resolvers->second.erase(ite->first);
+                    if (resolvers->second.empty()) {
+                        resolvers = method_resolvers_.erase(resolvers);
+                    } else {
+                        ++resolvers;
                     }
                 }
-                unprocessed_new_participants_.pop();
+                for (auto &method : ite->second->method_list) {
+                    method_list_.erase(method.first);
+                    notify_method_resolvers(method.first);
+                }
             }
+
+            int32_t socket = ite->second->socket;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket, nullptr);
+            readers->erase(socket);
+            dropped_sockets_.erase(socket);
+            close(socket);
+            participant_list_.erase(ite);
+            socket_participant_mapping_.erase(socket);
         }
-        int ret;
-        {
-            ReadingSharedLockGuard shared_lock(participant_info_mtx_);
-            ret = poll(poll_fd_list, participant_list_.size(), 1000);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(unprocessed_new_connections_mtx_);
+        while (!unprocessed_new_connections_.empty()) {
+            int32_t socket = unprocessed_new_connections_.front().first;
+            sockaddr_in address = unprocessed_new_connections_.front().second;
+            unprocessed_new_connections_.pop();
+            epoll_event event;
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+            event.data.fd = socket;
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket, &event) < 0) {
+                LERROR(UBusMaster) << "Failed to add socket to epoll, err " << strerror(errno);
+                close(socket);
+                continue;
+            }
+            readers->emplace(socket, FrameReader(max_control_data_length_));
+            (*initiating)[socket] = address;
         }
-        if (ret < 0) {
-            LERROR(UBusMaster) << "Error in poll";
-        } else if (ret == 0) {
-            LTRACE(UBusMaster) << "Poll timeout";
-        } else {
-            for (int i = 0; i < max_connections_; ++i) {
-                if (poll_fd_list[i].revents & POLLIN && poll_fd_list[i].fd >= 0) {
-                    LTRACE(UBusMaster) << "Socket " << poll_fd_list[i].fd << " is readable";
-                    LTRACE(UBusMaster) << "Revents is " << poll_fd_list[i].revents;
-                    char header_buff[sizeof(FrameHeader)];
-                    size_t read_size = read(poll_fd_list[i].fd, &header_buff, sizeof(FrameHeader));
-                    if (read_size == 0) {
-                        LWARN(UBusMaster) << "Peer is closed, remove from poll.";
-                        poll_fd_list[i].fd = -1;
-                        continue;
-                    } else if (read_size < sizeof(FrameHeader)) {
-                        LERROR(UBusMaster) << "Failed to read header, size of data read : " << read_size;
-                        continue;
+    }
+}
+
+void UBusMaster::process_control_frame(int32_t fd, const FrameHeader &header, const std::string &content) {
+    switch (header.message_type) {
+        case FRAME_INITIATION:
+            LERROR(UBusMaster) << "Invalid frame header";
+            break;
+        case FRAME_KEEP_ALIVE: {
+            LTRACE(UBusMaster) << "Keep alive message";
+            WritingSharedLockGuard shared_lock(participant_info_mtx_);
+            auto participant = socket_participant_mapping_.find(fd);
+            if (participant != socket_participant_mapping_.end()) {
+                participant->second->watchdog_counter = 0;
+            }
+        } break;
+        case FRAME_EVENT_REGISTER:
+            LINFO(UBusMaster) << "New publish message";
+            {
+                std::string response;
+                std::string multicast_group;
+                ControlMessage request;
+                bool binary = false;
+                uint32_t type_id = 0;
+                ReadingSharedLockGuard shared_lock(participant_info_mtx_);
+                std::lock_guard<std::mutex> lock_event(event_list_mtx_);
+                if (!decode_control_message(content, &request, &binary) || !request.contains(CONTROL_TAG_TOPIC) ||
+                    !request.get_uint(CONTROL_TAG_TYPE_ID, &type_id)) {
+                    LDEBUG(UBusMaster) << "Invalid frame";
+                    response = "INVALID";
+                } else if (event_list_.find(request.get_string(CONTROL_TAG_TOPIC)) != event_list_.end()) {
+                    response = "DUPLICATE";
+                } else {
+                    EventInfo event_info;
+                    event_info.name = request.get_string(CONTROL_TAG_TOPIC);
+                    event_info.type = type_id;
+                    request.get_uint(CONTROL_TAG_TYPE_FINGERPRINT, &event_info.fingerprint);
+                    event_info.publisher = socket_participant_mapping_[fd];
+                    bool multicast = false;
+                    if (request.get_bool(CONTROL_TAG_MULTICAST, &multicast) && multicast) {
+                        // administratively scoped, wraps around after 65534 topics
+                        uint32_t index = multicast_group_count_++ % 65534 + 1;
+                        multicast_group = "239.255." + std::to_string(index >> 8) + "." + std::to_string(index & 0xff);
+                        event_info.multicast_group = multicast_group;
+                        event_info.multicast_port = multicast_port_;
+                        LINFO(UBusMaster) << "Topic " << event_info.name << " uses multicast group " << multicast_group;
                     }
-                    std::string content;
-                    FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-                    header->data_length = ntohl(header->data_length);
-                    if (header->data_length > 0) {
-                        LDEBUG(UBusMaster) << "Size of data to read : " << header->data_length;
-                        char content_buff[header->data_length];
-                        read_size = readn(poll_fd_list[i].fd, &content_buff, header->data_length);
-                        if (read_size < header->data_length) {
-                            LERROR(UBusMaster) << "Failed to read content";
-                            continue;
+                    event_list_[event_info.name] = event_info;
+                    event_info.publisher->published_topic_list[event_info.name] = event_info.type;
+                    response = "OK";
+                }
+                ControlMessage reply;
+                reply.set_string(CONTROL_TAG_RESPONSE, response);
+                if (!multicast_group.empty()) {
+                    reply.set_string(CONTROL_TAG_MULTICAST_GROUP, multicast_group);
+                    reply.set_uint(CONTROL_TAG_MULTICAST_PORT, multicast_port_);
+                }
+                send_control_message(fd, header.message_type, reply, binary);
+            }
+            break;
+        case FRAME_EVENT_SUBSCRIBE:
+            LINFO(UBusMaster) << "New subscribe message";
+            {
+                std::string response;
+                std::string publisher_ip;
+                uint32_t publisher_port = 0;
+                std::string publisher_name;
+                std::string publisher_unix_path;
+                bool publisher_local = false;
+                std::string multicast_group;
+                uint32_t multicast_port = 0;
+                ControlMessage request;
+                bool binary = false;
+                uint32_t type_id = 0;
+                if (!decode_control_message(content, &request, &binary) || !request.contains(CONTROL_TAG_TOPIC) ||
+                    !request.get_uint(CONTROL_TAG_TYPE_ID, &type_id)) {
+                    LDEBUG(UBusMaster) << "Invalid frame";
+                    response = "INVALID";
+                } else {
+                    ReadingSharedLockGuard shared_lock(participant_info_mtx_);
+                    std::lock_guard<std::mutex> lock_event(event_list_mtx_);
+                    auto event_info = event_list_.find(request.get_string(CONTROL_TAG_TOPIC));
+                    if (event_info == event_list_.end()) {
+                        response = "NOT_PUBLISHED";
+                    } else if (event_info->second.type != type_id ||
+                               !fingerprint_matches(event_info->second.fingerprint, request,
+                                                    CONTROL_TAG_TYPE_FINGERPRINT)) {
+                        LWARN(UBusMaster) << "Subscriber of " << event_info->first << " expects another message type";
+                        response = "TYPE_MISMATCH";
+                    } else {
+                        publisher_ip = event_info->second.publisher->listening_ip;
+                        publisher_port = event_info->second.publisher->listening_port;
+                        publisher_name = event_info->second.publisher->name;
+                        auto subscriber = socket_participant_mapping_.find(fd);
+                        publisher_local = subscriber != socket_participant_mapping_.end() &&
+                                          !event_info->second.publisher->host_id.empty() &&
+                                          event_info->second.publisher->host_id ==
+                                              subscriber->second->host_id;
+                        if (publisher_local) {
+                            publisher_unix_path = event_info->second.publisher->unix_path;
                         }
-                        content = std::string(content_buff, header->data_length);
-                        LINFO(UBusMaster) << "Content : " << content;
+                        multicast_group = event_info->second.multicast_group;
+                        multicast_port = event_info->second.multicast_port;
+                        response = "OK";
                     }
-
-                    switch (header->message_type) {
-                        case FRAME_INITIATION:
-                            LERROR(UBusMaster) << "Invalid frame header";
-                            break;
-                        case FRAME_KEEP_ALIVE: {
-                            LTRACE(UBusMaster) << "Keep alive message";
-                            WritingSharedLockGuard shared_lock(participant_info_mtx_);
-                            socket_participant_mapping_[poll_fd_list[i].fd]->watchdog_counter = 0;
-                        } break;
-                        case FRAME_EVENT_REGISTER:
-                            LINFO(UBusMaster) << "New publish message";
-                            {
-                                std::string response;
-                                nlohmann::json content_json = nlohmann::json::parse(content);
-                                ReadingSharedLockGuard shared_lock(participant_info_mtx_);
-                                std::lock_guard<std::mutex> lock_event(event_list_mtx_);
-                                if (!content_json.contains("topic") || !content_json.contains("type_id")) {
-                                    LDEBUG(UBusMaster) << "Invalid frame";
-                                    response = "INVALID";
-                                } else if (event_list_.find(content_json.at("topic")) != event_list_.end()) {
-                                    response = "DUPLICATE";
-                                } else {
-                                    EventInfo event_info;
-                                    event_info.name = content_json.at("topic");
-                                    event_info.type = content_json.at("type_id");
-                                    event_info.publisher = socket_participant_mapping_[poll_fd_list[i].fd];
-                                    event_list_[content_json.at("topic")] = event_info;
-                                    event_info.publisher->published_topic_list[event_info.name] = event_info.type;
-                                    response = "OK";
-                                }
-                                Frame frame;
-                                nlohmann::json response_json;
-                                response_json["response"] = response;
-                                std::string serialized_string = response_json.dump();
-                                const char *char_struct = serialized_string.c_str();
-                                frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                                frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                                strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                                int32_t ret;
-                                if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(&frame.header),
-                                                  sizeof(FrameHeader))) < 0) {
-                                    LINFO(UBusMaster) << "Write returned " << ret;
-                                }
-                                if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(frame.data),
-                                                  ntohl(frame.header.data_length))) < 0) {
-                                    LINFO(UBusRuntime) << "Write returned " << ret;
-                                }
-                                delete[] frame.data;
-                            }
-                            break;
-                        case FRAME_EVENT_SUBSCRIBE:
-                            LINFO(UBusMaster) << "New subscribe message";
-                            {
-                                std::string response;
-                                std::string publisher_ip;
-                                int32_t publisher_port;
-                                std::string publisher_name;
-                                nlohmann::json content_json = nlohmann::json::parse(content);
-                                if (!content_json.contains("topic") || !content_json.contains("type_id")) {
-                                    LDEBUG(UBusMaster) << "Invalid frame";
-                                    response = "INVALID";
-                                } else {
-                                    std::lock_guard<std::mutex> lock_event(event_list_mtx_);
-                                    auto event_info = event_list_.find(content_json.at("topic"));
-                                    if (event_info == event_list_.end()) {
-                                        response = "NOT_PUBLISHED";
-                                    } else {
-                                        publisher_ip = event_info->second.publisher->listening_ip;
-                                        publisher_port = event_info->second.publisher->listening_port;
-                                        publisher_name = event_info->second.publisher->name;
-                                        response = "OK";
-                                    }
-                                }
-                                Frame frame;
-                                nlohmann::json response_json;
-                                response_json["response"] = response;
-                                if (response == "OK") {
-                                    response_json["publisher_ip"] = publisher_ip;
-                                    response_json["publisher_port"] = publisher_port;
-                                    response_json["publisher_name"] = publisher_name;
-                                }
-
-                                std::string serialized_string = response_json.dump();
-                                const char *char_struct = serialized_string.c_str();
-                                frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                                frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                                strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                                int32_t ret;
-                                if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(&frame.header),
-                                                  sizeof(FrameHeader))) < 0) {
-                                    LDEBUG(UBusMaster) << "Write returned " << ret;
-                                }
-                                if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(frame.data),
-                                                  ntohl(frame.header.data_length))) < 0) {
-                                    LDEBUG(UBusRuntime) << "Write returned " << ret;
-                                }
-                                delete[] frame.data;
-                            }
-                            break;
-                        case FRAME_METHOD_PROVIDE: {
-                            std::string response;
-                            nlohmann::json content_json = nlohmann::json::parse(content);
-                            ReadingSharedLockGuard shared_lock(participant_info_mtx_);
-                            std::lock_guard<std::mutex> lock_method(method_list_mtx_);
-                            if (!content_json.contains("method") || !content_json.contains("request_type_id") ||
-                                !content_json.contains("response_type_id")) {
-                                LDEBUG(UBusMaster) << "Invalid frame";
-                                response = "INVALID";
-                            } else if (method_list_.find(content_json.at("method")) != method_list_.end()) {
-                                response = "DUPLICATE";
-                            } else {
-                                MethodInfo method_info;
-                                method_info.name = content_json.at("method");
-                                method_info.request_type = content_json.at("request_type_id");
-                                method_info.response_type = content_json.at("response_type_id");
-                                method_info.provider = socket_participant_mapping_[poll_fd_list[i].fd];
-                                method_list_[content_json.at("method")] = method_info;
-                                method_info.provider->method_list[method_info.name] =
-                                    std::make_pair(method_info.request_type, method_info.response_type);
-                                response = "OK";
-                            }
-                            Frame frame;
-                            nlohmann::json response_json;
-                            response_json["response"] = response;
-                            std::string serialized_string = response_json.dump();
-                            const char *char_struct = serialized_string.c_str();
-                            frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                            frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                            strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                            int32_t ret;
-                            if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(&frame.header),
-                                              sizeof(FrameHeader))) < 0) {
-                                LINFO(UBusMaster) << "Write returned " << ret;
-                            }
-                            if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(frame.data),
-                                              ntohl(frame.header.data_length))) < 0) {
-                                LINFO(UBusMaster) << "Write returned " << ret;
-                            }
-                            delete[] frame.data;
-                        } break;
-                        case FRAME_METHOD_QUERY:
-                            LINFO(UBusMaster) << "New method query message";
-                            {
-                                std::string response;
-                                std::string provider_ip;
-                                int32_t provider_port;
-                                std::string provider_name;
-                                nlohmann::json content_json = nlohmann::json::parse(content);
-                                if (!content_json.contains("method") || !content_json.contains("request_type_id") ||
-                                    !content_json.contains("response_type_id")) {
-                                    LDEBUG(UBusMaster) << "Invalid frame";
-                                    response = "INVALID";
-                                } else {
-                                    std::lock_guard<std::mutex> lock_method(method_list_mtx_);
-                                    auto method_info = method_list_.find(content_json.at("method"));
-                                    if (method_info == method_list_.end()) {
-                                        response = "NOT_PUBLISHED";
-                                    } else {
-                                        provider_ip = method_info->second.provider->listening_ip;
-                                        provider_port = method_info->second.provider->listening_port;
-                                        provider_name = method_info->second.provider->name;
-                                        response = "OK";
-                                    }
-                                }
-                                Frame frame;
-                                nlohmann::json response_json;
-                                response_json["response"] = response;
-                                if (response == "OK") {
-                                    response_json["provider_ip"] = provider_ip;
-                                    response_json["provider_port"] = provider_port;
-                                    response_json["provider_name"] = provider_name;
-                                }
-
-                                std::string serialized_string = response_json.dump();
-                                const char *char_struct = serialized_string.c_str();
-                                frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                                frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                                strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                                int32_t ret;
-                                if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(&frame.header),
-                                                  sizeof(FrameHeader))) < 0) {
-                                    LDEBUG(UBusMaster) << "Write returned " << ret;
-                                }
-                                if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(frame.data),
-                                                  ntohl(frame.header.data_length))) < 0) {
-                                    LDEBUG(UBusMaster) << "Write returned " << ret;
-                                }
-                                delete[] frame.data;
-                            }
-                            break;
-                        case FRAME_DEBUG: {
-                            std::string response;
-                            process_debug_message(content, &response);
-                            Frame frame;
-                            frame.header.message_type = FRAME_DEBUG;
-                            const char *char_struct = response.c_str();
-                            frame.header.data_length = htonl(static_cast<uint32_t>(response.size()));
-                            frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                            strncpy(reinterpret_cast<char *>(frame.data), char_struct, response.size());
-                            int32_t ret;
-                            if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(&frame.header),
-                                              sizeof(FrameHeader))) < 0) {
-                                LINFO(UBusMaster) << "Write returned " << ret;
-                            }
-                            if ((ret = writen(poll_fd_list[i].fd, static_cast<void *>(frame.data),
-                                              ntohl(frame.header.data_length))) < 0) {
-                                LINFO(UBusMaster) << "Write returned " << ret;
+                }
+                ControlMessage reply;
+                reply.set_string(CONTROL_TAG_RESPONSE, response);
+                if (response == "OK") {
+                    reply.set_string(CONTROL_TAG_PUBLISHER_IP, publisher_ip);
+                    reply.set_uint(CONTROL_TAG_PUBLISHER_PORT, publisher_port);
+                    reply.set_string(CONTROL_TAG_PUBLISHER_NAME, publisher_name);
+                    reply.set_bool(CONTROL_TAG_PUBLISHER_LOCAL, publisher_local);
+                    if (!publisher_unix_path.empty()) {
+                        reply.set_string(CONTROL_TAG_PUBLISHER_UNIX_PATH, publisher_unix_path);
+                    }
+                    if (!multicast_group.empty()) {
+                        reply.set_string(CONTROL_TAG_MULTICAST_GROUP, multicast_group);
+                        reply.set_uint(CONTROL_TAG_MULTICAST_PORT, multicast_port);
+                    }
+                }
+                send_control_message(fd, header.message_type, reply, binary);
+            }
+            break;
+        case FRAME_METHOD_PROVIDE: {
+            std::string response;
+            ControlMessage request;
+            bool binary = false;
+            uint32_t request_type = 0;
+            uint32_t response_type = 0;
+            ReadingSharedLockGuard shared_lock(participant_info_mtx_);
+            std::lock_guard<std::mutex> lock_method(method_list_mtx_);
+            if (!decode_control_message(content, &request, &binary) || !request.contains(CONTROL_TAG_METHOD) ||
+                !request.get_uint(CONTROL_TAG_REQUEST_TYPE_ID, &request_type) ||
+                !request.get_uint(CONTROL_TAG_RESPONSE_TYPE_ID, &response_type)) {
+                LDEBUG(UBusMaster) << "Invalid frame";
+                response = "INVALID";
+            } else if (method_list_.find(request.get_string(CONTROL_TAG_METHOD)) != method_list_.end()) {
+                response = "DUPLICATE";
+            } else {
+                MethodInfo method_info;
+                method_info.name = request.get_string(CONTROL_TAG_METHOD);
+                method_info.request_type = request_type;
+                method_info.response_type = response_type;
+                request.get_uint(CONTROL_TAG_REQUEST_FINGERPRINT, &method_info.request_fingerprint);
+                request.get_uint(CONTROL_TAG_RESPONSE_FINGERPRINT, &method_info.response_fingerprint);
+                method_info.provider = socket_participant_mapping_[fd];
+                request.get_uint(CONTROL_TAG_COMPRESSION, &method_info.compression);
+                request.get_uint(CONTROL_TAG_COMPRESSION_MIN_SIZE, &method_info.compression_min_size);
+                method_list_[method_info.name] = method_info;
+                method_info.provider->method_list[method_info.name] =
+                    std::make_pair(method_info.request_type, method_info.response_type);
+                notify_method_resolvers(method_info.name);
+                response = "OK";
+            }
+            ControlMessage reply;
+            reply.set_string(CONTROL_TAG_RESPONSE, response);
+            send_control_message(fd, header.message_type, reply, binary);
+        } break;
+        case FRAME_METHOD_QUERY:
+            LINFO(UBusMaster) << "New method query message";
+            {
+                std::string response;
+                std::string provider_ip;
+                uint32_t provider_port = 0;
+                std::string provider_name;
+                std::string provider_unix_path;
+                uint8_t provider_frame_version = FRAME_VERSION_1;
+                uint32_t compression = 0;
+                uint32_t compression_min_size = 0;
+                ControlMessage request;
+                bool binary = false;
+                uint32_t request_type = 0;
+                uint32_t response_type = 0;
+                if (!decode_control_message(content, &request, &binary) || !request.contains(CONTROL_TAG_METHOD) ||
+                    !request.get_uint(CONTROL_TAG_REQUEST_TYPE_ID, &request_type) ||
+                    !request.get_uint(CONTROL_TAG_RESPONSE_TYPE_ID, &response_type)) {
+                    LDEBUG(UBusMaster) << "Invalid frame";
+                    response = "INVALID";
+                } else {
+                    ReadingSharedLockGuard shared_lock(participant_info_mtx_);
+                    std::lock_guard<std::mutex> lock_method(method_list_mtx_);
+                    auto method_info = method_list_.find(request.get_string(CONTROL_TAG_METHOD));
+                    if (method_info == method_list_.end()) {
+                        response = "NOT_PUBLISHED";
+                    } else if (method_info->second.request_type != request_type ||
+                               method_info->second.response_type != response_type ||
+                               !fingerprint_matches(method_info->second.request_fingerprint, request,
+                                                    CONTROL_TAG_REQUEST_FINGERPRINT) ||
+                               !fingerprint_matches(method_info->second.response_fingerprint, request,
+                                                    CONTROL_TAG_RESPONSE_FINGERPRINT)) {
+                        LWARN(UBusMaster) << "Caller of " << method_info->first << " expects other message types";
+                        response = "TYPE_MISMATCH";
+                    } else {
+                        provider_ip = method_info->second.provider->listening_ip;
+                        provider_port = method_info->second.provider->listening_port;
+                        provider_name = method_info->second.provider->name;
+                        provider_frame_version = method_info->second.provider->frame_version;
+                        compression = method_info->second.compression;
+                        compression_min_size = method_info->second.compression_min_size;
+                        response = "OK";
+                        // the requester caches the provider from now on
+                        auto requester = socket_participant_mapping_.find(fd);
+                        if (requester != socket_participant_mapping_.end()) {
+                            method_resolvers_[method_info->first].insert(requester->second->name);
+                            if (!method_info->second.provider->host_id.empty() &&
+                                method_info->second.provider->host_id == requester->second->host_id) {
+                                provider_unix_path = method_info->second.provider->unix_path;
                             }
-                            delete[] frame.data;
-                        } break;
-                        default:
-                            break;
+                        }
                     }
                 }
+                ControlMessage reply;
+                reply.set_string(CONTROL_TAG_RESPONSE, response);
+                if (response == "OK") {
+                    reply.set_string(CONTROL_TAG_PROVIDER_IP, provider_ip);
+                    reply.set_uint(CONTROL_TAG_PROVIDER_PORT, provider_port);
+                    reply.set_string(CONTROL_TAG_PROVIDER_NAME, provider_name);
+                    reply.set_uint(CONTROL_TAG_PROVIDER_FRAME_VERSION, provider_frame_version);
+                    if (!provider_unix_path.empty()) {
+                        reply.set_string(CONTROL_TAG_PROVIDER_UNIX_PATH, provider_unix_path);
+                    }
+                    if (compression != 0) {
+                        reply.set_uint(CONTROL_TAG_COMPRESSION, compression);
+                        reply.set_uint(CONTROL_TAG_COMPRESSION_MIN_SIZE, compression_min_size);
+                    }
+                }
+                send_control_message(fd, header.message_type, reply, binary);
             }
-        }
-        usleep(100000);
+            break;
+        case FRAME_DEBUG: {
+            std::string response;
+            process_debug_message(content, &response);
+            Frame frame;
+            frame.header.message_type = FRAME_DEBUG;
+            frame.header.data_length = htonl(static_cast<uint32_t>(response.size()));
+            memcpy(frame.allocate(response.size()), response.data(), response.size());
+            send_control_frame(fd, frame);
+        } break;
+        default:
+            break;
     }
 }
 
 void UBusMaster::accept_new_connection() {
-    if (listen(control_sock_, 4096) < 0) {
-        LDEBUG(UBusMaster) << "Failed to start listening";
-        return;
-    }
-
     sockaddr_in incoming_addr;
     bzero(&incoming_addr, sizeof(incoming_addr));
     uint32_t ret_size = sizeof(incoming_addr);
     int32_t fd = 0;
+    // only accepts, the initiation is read by the control worker so that a slow or silent peer blocks nobody
     while ((fd = accept(control_sock_, reinterpret_cast<sockaddr *>(&incoming_addr), &ret_size)) >= 0) {
         if (ret_size > sizeof(incoming_addr)) {
             LWARN(UBusMaster) << "Unexpected ret_size of accept()";
         }
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(fd, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusMaster) << "Failed to read header";
-        } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            if (header->message_type != FRAME_INITIATION) {
-                LERROR(UBusMaster) << "Invalid frame header";
-                continue;
-            }
-            LDEBUG(UBusMaster) << "Size of data to read : " << header->data_length;
-            char content_buff[header->data_length];
-            read_size = readn(fd, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LERROR(UBusMaster) << "Failed to read content";
-            }
-            std::string content(content_buff, header->data_length);
-            LDEBUG(UBusMaster) << "Content : " << content;
-            try {
-                nlohmann::json json_struct = nlohmann::json::parse(content);
-                std::string response;
-                if (json_struct.contains("name") && json_struct.contains("listening_ip") &&
-                    json_struct.contains("listening_port") && json_struct.contains("api_version")) {
-                    std::lock_guard<std::mutex> lock(unprocessed_new_participants_mtx_);
-                    WritingSharedLockGuard lock_shared(participant_info_mtx_);
-                    if (json_struct["api_version"] != api_version_) {
-                        response = "VERSION_MISMATCH";
-                    } else if (participant_list_.find(json_struct["name"].get<std::string>()) ==
-                               participant_list_.end()) {
-                        std::shared_ptr<UBusParticipantInfo> participant_info = std::make_shared<UBusParticipantInfo>();
-                        participant_info->name = json_struct["name"].get<std::string>();
-                        participant_info->ip = std::string(inet_ntoa(incoming_addr.sin_addr));
-                        participant_info->port = ntohs(incoming_addr.sin_port);
-                        participant_info->listening_ip = json_struct["listening_ip"].get<std::string>();
-                        participant_info->listening_port = json_struct["listening_port"].get<uint32_t>();
-                        participant_info->socket = fd;
-                        participant_list_[participant_info->name] = participant_info;
-                        socket_participant_mapping_[fd] = participant_info;
-                        LINFO(UBusMaster) << "Registered new participant :" << participant_info->name << "\n"
-                                          << "Ip :" << participant_info->ip << "\n"
-                                          << "Port :" << participant_info->port;
-                        unprocessed_new_participants_.push(json_struct["name"].get<std::string>());
-                        response = "OK";
-                    } else {
-                        LERROR(UBusMaster) << "Duplicate request for " << std::string(json_struct["name"]);
-                        response = "DUPLICATE";
-                    }
-                } else {
-                    LERROR(UBusMaster) << "Invalid joining request";
-                    response = "INVALID";
+        set_tcp_nodelay(fd);
+        // replies are written by the single control worker, a participant which stops reading must not stall it
+        timeval send_timeout;
+        send_timeout.tv_sec = control_send_timeout_ms_ / 1000;
+        send_timeout.tv_usec = (control_send_timeout_ms_ % 1000) * 1000;
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) < 0) {
+            LWARN(UBusMaster) << "Failed to set send timeout, err " << strerror(errno);
+        }
+        {
+            std::lock_guard<std::mutex> lock(unprocessed_new_connections_mtx_);
+            unprocessed_new_connections_.emplace(fd, incoming_addr);
+        }
+        wake_up_control_worker();
+        ret_size = sizeof(incoming_addr);
+    }
+}
+
+bool UBusMaster::process_initiation(int32_t fd,
+                                    const sockaddr_in &address,
+                                    const FrameHeader &header,
+                                    const std::string &content) {
+    if (header.message_type != FRAME_INITIATION) {
+        LERROR(UBusMaster) << "Invalid frame header";
+        return false;
+    }
+    LDEBUG(UBusMaster) << "Size of data read : " << header.data_length;
+    std::string response;
+    try {
+        nlohmann::json json_struct = nlohmann::json::parse(content);
+        bool binary_control = false;
+        if (json_struct.contains("name") && json_struct.contains("listening_ip") &&
+            json_struct.contains("listening_port") && json_struct.contains("api_version")) {
+            WritingSharedLockGuard lock_shared(participant_info_mtx_);
+            if (json_struct["api_version"] != api_version_) {
+                response = "VERSION_MISMATCH";
+            } else if (participant_list_.find(json_struct["name"].get<std::string>()) == participant_list_.end()) {
+                std::shared_ptr<UBusParticipantInfo> participant_info = std::make_shared<UBusParticipantInfo>();
+                participant_info->name = json_struct["name"].get<std::string>();
+                participant_info->ip = std::string(inet_ntoa(address.sin_addr));
+                participant_info->port = ntohs(address.sin_port);
+                participant_info->listening_ip = json_struct["listening_ip"].get<std::string>();
+                participant_info->listening_port = json_struct["listening_port"].get<uint32_t>();
+                if (json_struct.contains("host_id")) {
+                    participant_info->host_id = json_struct["host_id"].get<std::string>();
                 }
-                Frame frame;
-                nlohmann::json response_json;
-                response_json["response"] = response;
-                std::string serialized_string = response_json.dump();
-                const char *char_struct = serialized_string.c_str();
-                frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                LDEBUG(UBusMaster) << "Data length : " << ntohl(frame.header.data_length);
-                frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                int32_t ret;
-                if ((ret = writen(fd, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-                    LINFO(UBusMaster) << "Write returned " << ret;
+                if (json_struct.contains("unix_path")) {
+                    participant_info->unix_path = json_struct["unix_path"].get<std::string>();
                 }
-                if ((ret = writen(fd, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
-                    LINFO(UBusRuntime) << "Write returned " << ret;
+                binary_control = json_struct.contains("control_version") &&
+                                 json_struct["control_version"].get<uint32_t>() == ControlMessage::version;
+                participant_info->binary_control = binary_control;
+                if (json_struct.contains("frame_version")) {
+                    participant_info->frame_version = json_struct["frame_version"].get<uint8_t>();
                 }
-                delete[] frame.data;
-            } catch (nlohmann::json::exception &e) {
-                LERROR(UBusMaster) << "Exception in json : " << e.what();
+                participant_info->socket = fd;
+                participant_list_[participant_info->name] = participant_info;
+                socket_participant_mapping_[fd] = participant_info;
+                LINFO(UBusMaster) << "Registered new participant :" << participant_info->name << "\n"
+                                  << "Ip :" << participant_info->ip << "\n"
+                                  << "Port :" << participant_info->port;
+                response = "OK";
+            } else {
+                LERROR(UBusMaster) << "Duplicate request for " << std::string(json_struct["name"]);
+                response = "DUPLICATE";
             }
+        } else {
+            LERROR(UBusMaster) << "Invalid joining request";
+            response = "INVALID";
         }
+        Frame frame;
+        nlohmann::json response_json;
+        response_json["response"] = response;
+        if (binary_control) {
+            response_json["control_version"] = ControlMessage::version;
+        }
+        std::string serialized_string = response_json.dump();
+        frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
+        LDEBUG(UBusMaster) << "Data length : " << ntohl(frame.header.data_length);
+        memcpy(frame.allocate(serialized_string.size()), serialized_string.data(), serialized_string.size());
+        send_control_frame(fd, frame);
+    } catch (nlohmann::json::exception &e) {
+        LERROR(UBusMaster) << "Exception in json : " << e.what();
+        return false;
     }
+    return response == "OK";
 }
 
 void UBusMaster::keep_alive_worker() {
     while (1) {
+        bool found_dead = false;
         {
             std::lock_guard<std::mutex> lock(unprocessed_dead_participants_mtx_);
             ReadingSharedLockGuard lock_shared(participant_info_mtx_);
@@ -468,9 +649,13 @@ void UBusMaster::keep_alive_worker() {
                 if (++participant.second->watchdog_counter >= 3) {
                     LINFO(UBusMaster) << participant.second->name << " is dead";
                     unprocessed_dead_participants_.push(participant.first);
+                    found_dead = true;
                 }
             }
         }
+        if (found_dead) {
+            wake_up_control_worker();
+        }
         sleep(1);
     }
 }
@@ -5,9 +5,16 @@
 #include "ubus_runtime.hpp"
 
 #include <unistd.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <errno.h>
 #include <signal.h>
+
+#include <algorithm>
+
 #include "nlohmann/json.hpp"
 
 #include "helpers.hpp"
@@ -17,6 +24,28 @@
 
 void sigpipe_handler(int input) { LWARN(UBusRuntime) << "SIGPIPE Caught."; }
 
+/// identifies the machine (boot) we run on, the master uses it to tell which participants share a host
+static std::string get_host_id() {
+    char buff[64];
+    FILE *boot_id = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (boot_id != nullptr) {
+        bool ok = fgets(buff, sizeof(buff), boot_id) != nullptr;
+        fclose(boot_id);
+        if (ok) {
+            std::string host_id(buff);
+            while (!host_id.empty() && host_id.back() == '\n') {
+                host_id.pop_back();
+            }
+            return host_id;
+        }
+    }
+    if (gethostname(buff, sizeof(buff)) == 0) {
+        buff[sizeof(buff) - 1] = '\0';
+        return buff;
+    }
+    return "";
+}
+
 bool UBusRuntime::init(const std::string &name, const std::string &ip, uint32_t port) {
     signal(SIGPIPE, sigpipe_handler);
     if (this->initiated_.load()) {
@@ -57,6 +86,23 @@ bool UBusRuntime::init(const std::string &name, const std::string &ip, uint32_t
     std::string listening_ip = inet_ntoa(socket_addr.sin_addr);
     int32_t listening_port = ntohs(socket_addr.sin_port);
 
+    if (unix_socket_enabled_) {
+        // pid in the name, participants of different masters may share a name
+        unix_path_ = "ubus." + name + "." + std::to_string(getpid());
+        sockaddr_un unix_addr;
+        socklen_t unix_addr_length = make_unix_address(unix_path_, &unix_addr);
+        if (unix_addr_length == 0 || (unix_listening_sock_ = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+            bind(unix_listening_sock_, reinterpret_cast<sockaddr *>(&unix_addr), unix_addr_length) < 0 ||
+            listen(unix_listening_sock_, 4096) < 0) {
+            LWARN(UBusRuntime) << "Failed to listen on unix socket " << unix_path_ << ", err " << strerror(errno);
+            if (unix_listening_sock_ >= 0) {
+                close(unix_listening_sock_);
+                unix_listening_sock_ = -1;
+            }
+            unix_path_.clear();
+        }
+    }
+
     // init control_sock
     if ((control_sock_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         LERROR(UBusRuntime) << "Failed to create socket";
@@ -77,6 +123,7 @@ bool UBusRuntime::init(const std::string &name, const std::string &ip, uint32_t
         LERROR(UBusRuntime) << "Failed to connect to master, ret is " << ret << ", err " << strerror(errno);
         return false;
     }
+    set_tcp_nodelay(control_sock_);
 
     Frame frame;
     frame.header.message_type = FRAME_INITIATION;
@@ -84,46 +131,41 @@ bool UBusRuntime::init(const std::string &name, const std::string &ip, uint32_t
     json_struct["name"] = name;
     json_struct["listening_ip"] = listening_ip;
     json_struct["listening_port"] = listening_port;
+    json_struct["host_id"] = get_host_id();
+    if (!unix_path_.empty()) {
+        json_struct["unix_path"] = unix_path_;
+    }
     json_struct["api_version"] = STRING(UBUS_API_VERSION_MAJOR) "." STRING(UBUS_APT_VERSION_MINOR);
+    // binary control frames if the master supports them
+    json_struct["control_version"] = ControlMessage::version;
+    // method callers learn it from the master
+    json_struct["frame_version"] = FRAME_VERSION_2;
     LINFO(UBusRuntime) << "UBUS API version " << json_struct["api_version"].get<std::string>();
     std::string serialized_string = json_struct.dump();
-    const char *char_struct = serialized_string.c_str();
     frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
     LDEBUG(UBusRuntime) << "Data length : " << ntohl(frame.header.data_length);
-    frame.data = new uint8_t[ntohl(frame.header.data_length)];
-    strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-    if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-        LDEBUG(UBusRuntime) << "Write returned " << ret;
-    }
-    if ((ret = writen(control_sock_, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
+    memcpy(frame.allocate(serialized_string.size()), serialized_string.data(), serialized_string.size());
+    if ((ret = send_frame(control_sock_, frame)) < 0) {
         LDEBUG(UBusRuntime) << "Write returned " << ret;
     }
     LDEBUG(UBusRuntime) << "Debug content "
                         << std::string(reinterpret_cast<char *>(frame.data), ntohl(frame.header.data_length));
-    delete[] frame.data;
 
     {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(control_sock_, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LERROR(UBusRuntime) << "Failed to read header";
+        FrameHeader header;
+        std::string content;
+        if (!read_frame(control_sock_, &header, &content)) {
+            LERROR(UBusRuntime) << "Failed to read response from master";
             return false;
         } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-            char content_buff[header->data_length];
-            read_size = readn(control_sock_, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LERROR(UBusRuntime) << "Failed to read content";
-                return false;
-            }
-            std::string content(content_buff, header->data_length);
+            LDEBUG(UBusRuntime) << "Size of data read : " << header.data_length;
             try {
                 nlohmann::json response_json = nlohmann::json::parse(content);
                 if (response_json.contains("response")) {
                     if (response_json["response"] == "OK") {
                         LINFO(UBusRuntime) << "Registered to master";
+                        binary_control_ = response_json.contains("control_version") &&
+                                          response_json["control_version"].get<uint32_t>() == ControlMessage::version;
                     } else {
                         LERROR(UBusRuntime) << "Error from master : " << std::string(response_json["response"]);
                         return false;
@@ -139,6 +181,41 @@ bool UBusRuntime::init(const std::string &name, const std::string &ip, uint32_t
         }
     }
 
+    if ((event_epoll_fd_ = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (event_wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LERROR(UBusRuntime) << "Failed to create epoll, err " << strerror(errno);
+        return false;
+    }
+    epoll_event wakeup_event;
+    wakeup_event.events = EPOLLIN;
+    wakeup_event.data.fd = event_wakeup_fd_;
+    if (epoll_ctl(event_epoll_fd_, EPOLL_CTL_ADD, event_wakeup_fd_, &wakeup_event) < 0) {
+        LERROR(UBusRuntime) << "Failed to add eventfd to epoll, err " << strerror(errno);
+        return false;
+    }
+    if (!start_publish_worker()) {
+        return false;
+    }
+
+    if ((batch_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+        LERROR(UBusRuntime) << "Failed to create timerfd, err " << strerror(errno);
+        return false;
+    }
+
+    if ((method_epoll_fd_ = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        LERROR(UBusRuntime) << "Failed to create epoll, err " << strerror(errno);
+        return false;
+    }
+    method_worker_ = std::make_shared<std::thread>(&UBusRuntime::process_method_response, this);
+    method_worker_->detach();
+
+    if (method_executor_threads_ > 0) {
+        method_executor_ = std::make_shared<ThreadPool>(method_executor_threads_);
+    }
+    if (event_executor_threads_ > 0) {
+        event_executor_ = std::make_shared<ThreadPool>(event_executor_threads_);
+    }
+
     listening_worker_ = std::make_shared<std::thread>(&UBusRuntime::start_listening_socket, this);
     listening_worker_->detach();
 
@@ -148,256 +225,1927 @@ bool UBusRuntime::init(const std::string &name, const std::string &ip, uint32_t
     event_worker_ = std::make_shared<std::thread>(&UBusRuntime::process_event_message, this);
     event_worker_->detach();
 
+    batch_worker_ = std::make_shared<std::thread>(&UBusRuntime::process_batch_timer, this);
+    batch_worker_->detach();
+
+    // from here on only control_worker_ reads from control_sock_
+    control_worker_ = std::make_shared<std::thread>(&UBusRuntime::process_control_message, this);
+    control_worker_->detach();
+
     this->initiated_.store(true);
     return true;
 }
 
+bool UBusRuntime::start_publish_worker() {
+    if ((publish_epoll_fd_ = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (publish_wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        LERROR(UBusRuntime) << "Failed to create epoll, err " << strerror(errno);
+        return false;
+    }
+    epoll_event wakeup_event;
+    wakeup_event.events = EPOLLIN;
+    wakeup_event.data.fd = publish_wakeup_fd_;
+    if (epoll_ctl(publish_epoll_fd_, EPOLL_CTL_ADD, publish_wakeup_fd_, &wakeup_event) < 0) {
+        LERROR(UBusRuntime) << "Failed to add eventfd to epoll, err " << strerror(errno);
+        return false;
+    }
+    publish_worker_ = std::make_shared<std::thread>(&UBusRuntime::process_publish_queue, this);
+    publish_worker_->detach();
+    return true;
+}
+
 void UBusRuntime::keep_alive_sender() {
     while (1) {
         Frame frame;
         frame.header.message_type = FRAME_KEEP_ALIVE;
         frame.header.data_length = 0;
         int32_t ret;
-        if ((ret = writen(control_sock_, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
+        {
+            std::lock_guard<std::mutex> lock(control_write_mtx_);
+            ret = send_frame(control_sock_, frame);
+        }
+        if (ret < 0) {
             LWARN(UBusRuntime) << "Write returned " << ret;
         }
         sleep(1);
     }
 }
 
+void UBusRuntime::process_control_message() {
+    std::string content;
+    while (1) {
+        FrameHeader header;
+        // a frame announcing more than MAX_FRAME_DATA_LENGTH ends the connection like a closed one
+        if (!read_frame(control_sock_, &header, &content)) {
+            break;
+        }
+        if (header.message_type == FRAME_METHOD_INVALIDATE) {
+            ControlMessage invalidate;
+            const uint8_t *data = reinterpret_cast<const uint8_t *>(content.data());
+            if (ControlMessage::is_binary(data, content.size()) ? invalidate.parse(data, content.size())
+                                                                 : invalidate.from_json(content)) {
+                LDEBUG(UBusRuntime) << "Provider of " << invalidate.get_string(CONTROL_TAG_METHOD) << " changed";
+                invalidate_method(invalidate.get_string(CONTROL_TAG_METHOD));
+            } else {
+                LERROR(UBusRuntime) << "Invalid invalidation from master";
+            }
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(control_response_mtx_);
+        control_response_.swap(content);
+        control_response_ready_ = true;
+        control_response_cv_.notify_all();
+    }
+    LERROR(UBusRuntime) << "Connection to master is lost";
+    std::lock_guard<std::mutex> lock(control_response_mtx_);
+    control_closed_ = true;
+    control_response_cv_.notify_all();
+}
+
+bool UBusRuntime::control_request(const Frame &request, std::string *response) {
+    std::lock_guard<std::mutex> request_lock(control_request_mtx_);
+    {
+        std::lock_guard<std::mutex> lock(control_response_mtx_);
+        control_response_ready_ = false;
+    }
+    int32_t ret;
+    {
+        std::lock_guard<std::mutex> lock(control_write_mtx_);
+        ret = send_frame(control_sock_, request);
+    }
+    if (ret < 0) {
+        LINFO(UBusRuntime) << "Write returned " << ret;
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(control_response_mtx_);
+    control_response_cv_.wait(lock, [this] { return control_response_ready_ || control_closed_; });
+    if (!control_response_ready_) {
+        return false;
+    }
+    response->swap(control_response_);
+    control_response_ready_ = false;
+    return true;
+}
+
+bool UBusRuntime::control_request(FrameType type, const ControlMessage &request, ControlMessage *response) {
+    std::string serialized_string = binary_control_ ? request.encoded() : request.to_json();
+    Frame frame;
+    frame.header.message_type = type;
+    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
+    frame.data = reinterpret_cast<uint8_t *>(&serialized_string[0]);
+    std::string content;
+    if (!control_request(frame, &content)) {
+        return false;
+    }
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(content.data());
+    if (ControlMessage::is_binary(data, content.size())) {
+        return response->parse(data, content.size());
+    }
+    return response->from_json(content);
+}
+
 void UBusRuntime::start_listening_socket() {
     if (listen(listening_sock_, 4096) < 0) {
         LDEBUG(UBusMaster) << "Failed to start listening";
         return;
     }
+    int32_t epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LERROR(UBusRuntime) << "Failed to create epoll, err " << strerror(errno);
+        return;
+    }
+    epoll_event listening_event;
+    listening_event.events = EPOLLIN;
+    listening_event.data.fd = listening_sock_;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listening_sock_, &listening_event) < 0) {
+        LERROR(UBusRuntime) << "Failed to add listening socket to epoll, err " << strerror(errno);
+        return;
+    }
+    if (unix_listening_sock_ >= 0) {
+        listening_event.data.fd = unix_listening_sock_;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_listening_sock_, &listening_event) < 0) {
+            LERROR(UBusRuntime) << "Failed to add unix listening socket to epoll, err " << strerror(errno);
+            return;
+        }
+    }
 
-    sockaddr_in incoming_addr;
-    bzero(&incoming_addr, sizeof(incoming_addr));
-    uint32_t ret_size;
-    int32_t fd = 0;
-    while ((fd = accept(listening_sock_, reinterpret_cast<sockaddr *>(&incoming_addr), &ret_size)) >= 0) {
-        char header_buff[sizeof(FrameHeader)];
-        size_t read_size = readn(fd, &header_buff, sizeof(FrameHeader));
-        if (read_size < sizeof(FrameHeader)) {
-            LDEBUG(UBusMaster) << "Failed to read header";
-        } else {
-            FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-            header->data_length = ntohl(header->data_length);
-            char content_buff[header->data_length];
-            read_size = readn(fd, &content_buff, header->data_length);
-            if (read_size < header->data_length) {
-                LDEBUG(UBusMaster) << "Failed to read content";
-            }
-            std::string content(content_buff, header->data_length);
-            switch (header->message_type) {
-                case FRAME_EVENT_SUBSCRIBE: {
-                    std::string response;
-                    try {
-                        nlohmann::json subscribe_json = nlohmann::json::parse(content);
-                        if (subscribe_json.contains("topic") && subscribe_json.contains("type_id") &&
-                            subscribe_json.contains("name")) {
-                            LDEBUG(UBusRuntime) << "New subscriber arrived " << std::string(subscribe_json.at("name"));
-                            auto pub_event_info = pub_list_.find(subscribe_json.at("topic"));
-                            if (pub_event_info == pub_list_.end()) {
-                                LERROR(UBusRuntime) << "Error wrong topic";
-                                response = "INVALID";
-                            } else if (pub_event_info->second.type != subscribe_json.at("type_id").get<uint32_t>()) {
-                                LERROR(UBusRuntime) << "Error wrong type id";
-                                response = "INVALID";
-                            } else if (pub_event_info->second.client_socket_map.find(subscribe_json.at("name")) !=
-                                       pub_event_info->second.client_socket_map.end()) {
-                                LERROR(UBusRuntime) << "Error duplicate";
-                                response = "DUPLICATE";
-                            } else {
-                                LINFO(UBusRuntime)
-                                    << "Registered new subscriber " << std::string(subscribe_json.at("name"));
-                                pub_event_info->second.client_socket_map[subscribe_json.at("name")] = fd;
-                                response = "OK";
-                            }
+    // connections stay open, method callers reuse them for their following calls
+    std::unordered_map<int32_t, FrameReader> readers;
+    std::unordered_map<int32_t, std::shared_ptr<PeerConnection>> connections;
+    // handed over sockets of subscribers skipped by the socket fan-out, by topic and name
+    std::unordered_map<int32_t, std::pair<std::string, std::string>> watched_subscribers;
+    const int32_t max_events = 64;
+    epoll_event events[max_events];
+    while (1) {
+        int32_t ret = epoll_wait(epoll_fd, events, max_events, -1);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                LERROR(UBusRuntime) << "Error in epoll_wait, err " << strerror(errno);
+            }
+            continue;
+        }
+        for (int32_t i = 0; i < ret; ++i) {
+            int32_t fd = events[i].data.fd;
+            if (fd == listening_sock_ || fd == unix_listening_sock_) {
+                // peers are served the same way whichever socket they came through
+                int32_t new_fd = accept(fd, nullptr, nullptr);
+                if (new_fd < 0) {
+                    LWARN(UBusRuntime) << "Failed to accept, err " << strerror(errno);
+                    continue;
+                }
+                if (fd == listening_sock_) {
+                    set_tcp_nodelay(new_fd);
+                }
+                epoll_event event;
+                event.events = EPOLLIN;
+                event.data.fd = new_fd;
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_fd, &event) < 0) {
+                    LERROR(UBusRuntime) << "Failed to add socket to epoll, err " << strerror(errno);
+                    close(new_fd);
+                    continue;
+                }
+                readers[new_fd];
+                connections[new_fd] = std::make_shared<PeerConnection>(new_fd);
+                continue;
+            }
 
-                        } else {
-                            LDEBUG(UBusRuntime) << "Invalid subscription request";
-                            response = "INVALID";
+            auto watched = watched_subscribers.find(fd);
+            if (watched != watched_subscribers.end()) {
+                // nothing is sent by a subscriber after the handshake, it hung up
+                LINFO(UBusRuntime) << "Subscriber " << watched->second.second << " of " << watched->second.first
+                                   << " hung up";
+                {
+                    std::lock_guard<std::mutex> lock(pub_list_mtx_);
+                    auto pub_event_info = pub_list_.find(watched->second.first);
+                    if (pub_event_info != pub_list_.end()) {
+                        auto client = pub_event_info->second.client_socket_map.find(watched->second.second);
+                        if (client != pub_event_info->second.client_socket_map.end() && client->second == fd) {
+                            remove_subscribers(watched->second.first, {watched->second.second});
                         }
-                    } catch (nlohmann::json::exception &e) {
-                        LDEBUG(UBusRuntime) << "Exception in json : " << e.what();
-                        response = "INVALID";
                     }
-                    {
-                        Frame frame;
-                        frame.header.message_type = FRAME_EVENT_SUBSCRIBE;
-
-                        nlohmann::json json_struct;
-                        json_struct["response"] = response;
-                        std::string serialized_string = json_struct.dump();
-
-                        const char *char_struct = serialized_string.c_str();
-                        frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                        frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                        strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                        int32_t ret;
-                        if ((ret = writen(fd, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-                            LDEBUG(UBusRuntime) << "Write returned " << ret;
-                        }
-                        if ((ret = writen(fd, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) < 0) {
-                            LDEBUG(UBusRuntime) << "Write returned " << ret;
+                }
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                // shut down only, like the other subscriber sockets, a publisher may still hold it in its targets
+                shutdown(fd, SHUT_RDWR);
+                watched_subscribers.erase(watched);
+                continue;
+            }
+
+            auto reader = readers.find(fd);
+            if (reader == readers.end()) {
+                continue;
+            }
+            std::shared_ptr<PeerConnection> connection = connections[fd];
+            bool alive = reader->second.fill(fd);
+            FrameHeader header;
+            FrameHeaderV2 extended;
+            const uint8_t *data = nullptr;
+            while (!connection->handed_over && reader->second.next(&header, &data, &extended)) {
+                process_incoming_frame(connection, extended, data);
+            }
+            if (reader->second.failed()) {
+                LERROR(UBusRuntime) << "Oversized frame on socket " << fd << ", close the connection";
+                shutdown(fd, SHUT_RDWR);
+                alive = false;
+            }
+            if (connection->handed_over && alive && !connection->watched_subscriber.empty()) {
+                epoll_event event;
+                event.events = EPOLLRDHUP;
+                event.data.fd = fd;
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0) {
+                    watched_subscribers[fd] = {connection->watched_topic, connection->watched_subscriber};
+                    readers.erase(fd);
+                    connections.erase(fd);
+                    continue;
+                }
+                LERROR(UBusRuntime) << "Failed to watch socket " << fd << ", err " << strerror(errno);
+            }
+            if (connection->handed_over || !alive) {
+                // a handed over socket belongs to a publisher, nothing is read from it anymore, otherwise it is
+                // closed once the calls still running on it are answered
+                LDEBUG(UBusRuntime) << "Remove socket " << fd << " from epoll.";
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                readers.erase(fd);
+                connections.erase(fd);
+            }
+        }
+    }
+}
+
+void UBusRuntime::process_incoming_frame(const std::shared_ptr<PeerConnection> &connection,
+                                         const FrameHeaderV2 &header,
+                                         const uint8_t *data) {
+    int32_t fd = connection->socket;
+    switch (header.message_type) {
+        case FRAME_EVENT_SUBSCRIBE: {
+            std::string response;
+            std::string topic;
+            std::string subscriber;
+            bool shm = false;
+            bool multicast = false;
+            std::unique_lock<std::mutex> lock(pub_list_mtx_);
+            try {
+                nlohmann::json subscribe_json = nlohmann::json::parse(data, data + header.data_length);
+                if (subscribe_json.contains("topic") && subscribe_json.contains("type_id") &&
+                    subscribe_json.contains("name")) {
+                    LDEBUG(UBusRuntime) << "New subscriber arrived " << std::string(subscribe_json.at("name"));
+                    auto pub_event_info = pub_list_.find(subscribe_json.at("topic"));
+                    if (pub_event_info == pub_list_.end()) {
+                        LERROR(UBusRuntime) << "Error wrong topic";
+                        response = "INVALID";
+                    } else if (pub_event_info->second.type != subscribe_json.at("type_id").get<uint32_t>()) {
+                        LERROR(UBusRuntime) << "Error wrong type id";
+                        response = "INVALID";
+                    } else if (subscribe_json.contains("fingerprint") && pub_event_info->second.fingerprint != 0 &&
+                               subscribe_json.at("fingerprint").get<uint32_t>() !=
+                                   pub_event_info->second.fingerprint) {
+                        LERROR(UBusRuntime) << "Error wrong message fingerprint";
+                        response = "INVALID";
+                    } else if (pub_event_info->second.client_socket_map.find(subscribe_json.at("name")) !=
+                               pub_event_info->second.client_socket_map.end()) {
+                        LERROR(UBusRuntime) << "Error duplicate";
+                        response = "DUPLICATE";
+                    } else {
+                        LINFO(UBusRuntime) << "Registered new subscriber " << std::string(subscribe_json.at("name"));
+                        pub_event_info->second.client_socket_map[subscribe_json.at("name")] = fd;
+                        topic = pub_event_info->first;
+                        subscriber = subscribe_json.at("name");
+                        if (subscribe_json.contains("transport") && subscribe_json.at("transport") == "shm" &&
+                            pub_event_info->second.shm_ring != nullptr) {
+                            LINFO(UBusRuntime) << "Subscriber reads from shared memory";
+                            pub_event_info->second.shm_subscribers.insert(subscribe_json.at("name"));
+                            shm = true;
                         }
-                        delete[] frame.data;
-                    }
-                } break;
-                case FRAME_METHOD_CALL: {
-                    std::string response;
-                    std::string response_data;
-                    try {
-                        nlohmann::json resq_json = nlohmann::json::parse(content);
-                        if (resq_json.contains("method") && resq_json.contains("request_type_id") &&
-                            resq_json.contains("response_type_id") && resq_json.contains("request_data")) {
-                            LDEBUG(UBusRuntime) << "New method request arrived " << std::string(resq_json.at("name"));
-                            auto method_info = method_list_.find(resq_json.at("method"));
-                            if (method_info == method_list_.end()) {
-                                LERROR(UBusRuntime) << "Error wrong method";
-                                response = "INVALID";
-                            } else if (method_info->second.request_type !=
-                                           resq_json.at("request_type_id").get<uint32_t>() ||
-                                       method_info->second.response_type !=
-                                           resq_json.at("response_type_id").get<uint32_t>()) {
-                                LERROR(UBusRuntime) << "Error wrong type id";
-                                response = "INVALID";
-                            } else {
-                                (*method_info->second.callback)(resq_json.at("request_data").get<std::string>(),
-                                                                &response_data);
-                                response = "OK";
-                            }
-                        } else {
-                            LDEBUG(UBusRuntime) << "Invalid subscription request";
-                            response = "INVALID";
+                        if (subscribe_json.contains("transport") && subscribe_json.at("transport") == "multicast" &&
+                            pub_event_info->second.multicast != nullptr) {
+                            LINFO(UBusRuntime) << "Subscriber reads from the multicast group";
+                            pub_event_info->second.multicast_subscribers.insert(subscribe_json.at("name"));
+                            multicast = true;
                         }
-                        {
-                            Frame frame;
-                            frame.header.message_type = FRAME_METHOD_RESPONSE;
-
-                            nlohmann::json json_struct;
-                            json_struct["response"] = response;
-                            if (response == "OK") {
-                                json_struct["response_data"] = response_data;
-                            }
-                            std::string serialized_string = json_struct.dump();
-
-                            const char *char_struct = serialized_string.c_str();
-                            frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
-                            frame.data = new uint8_t[ntohl(frame.header.data_length)];
-                            strncpy(reinterpret_cast<char *>(frame.data), char_struct, serialized_string.size());
-                            int32_t ret;
-                            if ((ret = writen(fd, static_cast<void *>(&frame.header), sizeof(FrameHeader))) < 0) {
-                                LDEBUG(UBusRuntime) << "Write returned " << ret;
+                        if (subscribe_json.contains("frame_version") &&
+                            subscribe_json.at("frame_version").get<uint8_t>() >= FRAME_VERSION_2) {
+                            pub_event_info->second.v2_subscribers.insert(subscribe_json.at("name"));
+                            // batches rely on the sequence of the version 2 header
+                            if (subscribe_json.contains("batch") && subscribe_json.at("batch").get<bool>()) {
+                                pub_event_info->second.batch_subscribers.insert(subscribe_json.at("name"));
                             }
-                            if ((ret = writen(fd, static_cast<void *>(frame.data), ntohl(frame.header.data_length))) <
-                                0) {
-                                LDEBUG(UBusRuntime) << "Write returned " << ret;
+                            // so does the flags byte
+                            if (subscribe_json.contains("compression") && subscribe_json.at("compression") == "lz4") {
+                                pub_event_info->second.lz4_subscribers.insert(subscribe_json.at("name"));
                             }
-                            delete[] frame.data;
                         }
-                    } catch (nlohmann::json::exception &e) {
-                        LDEBUG(UBusRuntime) << "Exception in json : " << e.what();
-                        response = "INVALID";
+                        response = "OK";
                     }
-                } break;
-                default:
-                    LWARN(UBusRuntime) << "Unsupported frame type";
+
+                } else {
+                    LDEBUG(UBusRuntime) << "Invalid subscription request";
+                    response = "INVALID";
+                }
+            } catch (nlohmann::json::exception &e) {
+                LDEBUG(UBusRuntime) << "Exception in json : " << e.what();
+                response = "INVALID";
+            }
+            lock.unlock();
+            {
+                Frame frame;
+                frame.header.message_type = FRAME_EVENT_SUBSCRIBE;
+
+                nlohmann::json json_struct;
+                json_struct["response"] = response;
+                if (multicast) {
+                    // confirms the group is written to, the subscriber leaves it otherwise
+                    json_struct["transport"] = "multicast";
+                }
+                std::string serialized_string = json_struct.dump();
+
+                frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
+                memcpy(frame.allocate(serialized_string.size()), serialized_string.data(), serialized_string.size());
+                int32_t ret;
+                if ((ret = send_frame(fd, frame)) < 0) {
+                    LDEBUG(UBusRuntime) << "Write returned " << ret;
+                }
+            }
+            if (response == "OK") {
+                connection->handed_over = true;
+                if (shm || multicast) {
+                    connection->watched_topic = topic;
+                    connection->watched_subscriber = subscriber;
+                }
+                // the queue is only attached now, so that queued events never overtake the response
+                lock.lock();
+                auto pub_event_info = pub_list_.find(topic);
+                if (pub_event_info != pub_list_.end() && pub_event_info->second.options.async_publish &&
+                    pub_event_info->second.client_socket_map.count(subscriber) > 0) {
+                    auto queue = std::make_shared<SendQueue>();
+                    queue->socket = fd;
+                    queue->depth = pub_event_info->second.options.queue_depth;
+                    queue->overflow_policy = pub_event_info->second.options.overflow_policy;
+                    pub_event_info->second.send_queues[subscriber] = queue;
+                }
+            }
+        } break;
+        case FRAME_METHOD_CALL: {
+            MethodFrameHeader request_header;
+            if (!parse_method_header(data, header.data_length, &request_header)) {
+                // most likely a peer of another version, dropping the connection fails its pending calls
+                LERROR(UBusRuntime) << "Invalid method request";
+                shutdown(fd, SHUT_RDWR);
+                break;
+            }
+            MethodFrameHeader response_header = request_header;
+            {
+                std::lock_guard<std::mutex> lock(connection->write_mtx);
+                connection->frame_version = header.version;
+            }
+            MethodInfo method_info;
+            {
+                std::lock_guard<std::mutex> lock(method_list_mtx_);
+                auto ite = method_list_.find(request_header.method_id);
+                if (ite != method_list_.end()) {
+                    method_info = ite->second;
+                }
+            }
+            if (method_info.callback == nullptr) {
+                LERROR(UBusRuntime) << "Error wrong method";
+                response_header.status = METHOD_STATUS_INVALID;
+            } else if (method_info.request_type != request_header.request_type_id ||
+                       method_info.response_type != request_header.response_type_id) {
+                LERROR(UBusRuntime) << "Error wrong type id";
+                response_header.status = METHOD_STATUS_INVALID;
+            } else {
+                LDEBUG(UBusRuntime) << "New method request arrived " << method_info.method;
+                std::shared_ptr<MethodCallbackHolderBase> callback = method_info.callback;
+                // the frame reader reuses its buffer, the request is copied (or decompressed) once for the executor
+                const uint8_t *payload = data + sizeof(MethodFrameHeader);
+                size_t payload_length = header.data_length - sizeof(MethodFrameHeader);
+                FrameBuffer request_data;
+                bool valid = true;
+                if (header.flags & FRAME_FLAG_LZ4) {
+                    uint32_t size = 0;
+                    valid = decompressed_size(payload, payload_length, &size);
+                    if (valid) {
+                        request_data = FrameBuffer(size);
+                        valid = decompress_payload(payload, payload_length, request_data.data(), request_data.size());
+                    }
+                } else {
+                    request_data = FrameBuffer(payload_length);
+                    memcpy(request_data.data(), payload, payload_length);
+                }
+                if (!valid) {
+                    LERROR(UBusRuntime) << "Invalid compressed request";
+                    response_header.status = METHOD_STATUS_INVALID;
+                    send_method_response(connection, response_header, nullptr, 0);
                     break;
+                }
+                // responses are compressed only for callers which asked for it
+                bool compress = method_info.options.compression == COMPRESSION_LZ4 &&
+                                (header.flags & FRAME_FLAG_ACCEPT_LZ4) && header.version >= FRAME_VERSION_2;
+                uint32_t compression_min_size = method_info.options.compression_min_size;
+                dispatch_method_call(method_info, [this, connection, response_header, callback, request_data, compress,
+                                                   compression_min_size]() {
+                    MethodFrameHeader result_header = response_header;
+                    std::vector<uint8_t> &response_data = payload_buffer();
+                    if (!(*callback)(request_data.data(), request_data.size(), &response_data) ||
+                        response_data.size() > MAX_FRAME_DATA_LENGTH - sizeof(MethodFrameHeader)) {
+                        result_header.status = METHOD_STATUS_ERROR;
+                        response_data.clear();
+                    }
+                    std::vector<uint8_t> &compressed = compression_buffer();
+                    if (compress && response_data.size() >= compression_min_size &&
+                        compress_payload(response_data.data(), response_data.size(), &compressed)) {
+                        send_method_response(connection, result_header, compressed.data(), compressed.size(),
+                                             FRAME_FLAG_LZ4);
+                    } else {
+                        send_method_response(connection, result_header, response_data.data(), response_data.size());
+                    }
+                });
+                return;
             }
+            send_method_response(connection, response_header, nullptr, 0);
+        } break;
+        default:
+            LWARN(UBusRuntime) << "Unsupported frame type";
+            break;
+    }
+}
+
+void UBusRuntime::send_method_response(const std::shared_ptr<PeerConnection> &connection,
+                                       const MethodFrameHeader &header,
+                                       const uint8_t *data,
+                                       size_t length,
+                                       uint8_t flags) {
+    int32_t ret;
+    {
+        std::lock_guard<std::mutex> lock(connection->write_mtx);
+        ret = send_method_frame(connection->socket, connection->frame_version, FRAME_METHOD_RESPONSE, header, data,
+                                length, ++connection->sequence, flags);
+    }
+    if (ret < 0) {
+        LDEBUG(UBusRuntime) << "Write returned " << ret;
+    }
+}
+
+void UBusRuntime::dispatch_method_call(const MethodInfo &method_info, std::function<void()> task) {
+    if (method_executor_ == nullptr) {
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(method_info.call_queue->mtx);
+        if (method_info.options.max_concurrency > 0 &&
+            method_info.call_queue->running >= method_info.options.max_concurrency) {
+            method_info.call_queue->pending.push(std::move(task));
+            return;
         }
+        ++method_info.call_queue->running;
     }
+    run_method_call(method_info.call_queue, std::move(task));
 }
 
-void UBusRuntime::process_event_message() {
-    pollfd poll_fd_list[max_connections_];
-    for (int i = 0; i < max_connections_; ++i) {
-        poll_fd_list[i].fd = -1;
+void UBusRuntime::run_method_call(const std::shared_ptr<MethodCallQueue> &call_queue, std::function<void()> task) {
+    method_executor_->submit([this, call_queue, task]() {
+        task();
+        // hand the slot over to the next waiting call of the same method
+        std::function<void()> next;
+        {
+            std::lock_guard<std::mutex> lock(call_queue->mtx);
+            if (call_queue->pending.empty()) {
+                --call_queue->running;
+                return;
+            }
+            next = std::move(call_queue->pending.front());
+            call_queue->pending.pop();
+        }
+        run_method_call(call_queue, std::move(next));
+    });
+}
+
+bool UBusRuntime::get_event_stats(const std::string &topic, EventStats *stats) {
+    std::lock_guard<std::mutex> lock(sub_list_mtx_);
+    auto ite = sub_list_.find(topic);
+    if (ite == sub_list_.end()) {
+        return false;
+    }
+    *stats = ite->second.stats;
+    for (const std::shared_ptr<EventQueue> &queue : {ite->second.event_queue, ite->second.shm_event_queue}) {
+        if (queue != nullptr) {
+            stats->queue_depth += queue->pending.load(std::memory_order_relaxed);
+            stats->queue_dropped += queue->dropped.load(std::memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+void UBusRuntime::add_sub_event(const SubEventInfo &event_info) {
+    SubEventInfo replaced;
+    bool replacing = false;
+    {
+        std::lock_guard<std::mutex> lock(sub_list_mtx_);
+        auto ite = sub_list_.find(event_info.topic);
+        if (ite != sub_list_.end()) {
+            // e.g. subscribed again after the publisher restarted, the reader of its old ring is stopped below
+            replaced = std::move(ite->second);
+            replacing = true;
+        }
+        SubEventInfo &added = sub_list_[event_info.topic];
+        added = event_info;
+        if (added.shm_ring != nullptr) {
+            added.shm_reader = std::make_shared<SharedMemoryReader>();
+            added.shm_reader->thread = std::thread(&UBusRuntime::process_shared_memory_event, this, added.topic,
+                                                   added.shm_ring, added.shm_reader);
+        }
+        unprocessed_new_sub_events_.push(event_info.topic);
+    }
+    stop_shared_memory_reader(&replaced);
+    if (replacing) {
+        // its socket and multicast receiver would otherwise go on delivering to the new subscription
+        std::lock_guard<std::mutex> lock(sub_list_mtx_);
+        unprocessed_replaced_sub_events_.push(std::move(replaced));
+    }
+    uint64_t value = 1;
+    if (write(event_wakeup_fd_, &value, sizeof(value)) < 0) {
+        LERROR(UBusRuntime) << "Failed to wake up event worker";
+    }
+}
+
+void UBusRuntime::stop_shared_memory_reader(SubEventInfo *event_info) {
+    if (event_info->shm_reader != nullptr) {
+        event_info->shm_reader->stop.store(true);
+        if (event_info->shm_reader->thread.get_id() == std::this_thread::get_id()) {
+            // removed from a callback run by the reader itself, it returns once the callback does
+            event_info->shm_reader->thread.detach();
+        } else if (event_info->shm_reader->thread.joinable()) {
+            event_info->shm_reader->thread.join();
+        }
+        event_info->shm_reader.reset();
     }
+    // unmapped with the last reference
+    event_info->shm_ring.reset();
+}
 
+void UBusRuntime::process_event_message() {
+    std::unordered_map<int32_t, FrameReader> readers;
+    // kept here as well, the receiver is only read by this thread
+    std::unordered_map<int32_t, std::shared_ptr<MulticastReceiver>> multicast_receivers;
+    std::unordered_map<int32_t, std::string> socket_topic_map;
+    // events flagged FRAME_FLAG_LZ4 are decompressed here, valid until the next one
+    std::vector<uint8_t> decompressed;
+    auto remove_socket = [&](int32_t fd) {
+        epoll_ctl(event_epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        readers.erase(fd);
+        socket_topic_map.erase(fd);
+    };
+    auto remove_multicast = [&](const SubEventInfo &event_info) {
+        if (event_info.multicast != nullptr) {
+            // closed by the receiver
+            epoll_ctl(event_epoll_fd_, EPOLL_CTL_DEL, event_info.multicast->socket(), nullptr);
+            multicast_receivers.erase(event_info.multicast->socket());
+            socket_topic_map.erase(event_info.multicast->socket());
+        }
+    };
+    const int32_t max_events = 64;
+    epoll_event events[max_events];
     while (1) {
-        while (!unprocessed_dead_sub_events_.empty()) {
-            auto &sub_event = unprocessed_dead_sub_events_.front();
-            unprocessed_dead_sub_events_.pop();
-            for (int i = 0; i < max_connections_; ++i) {
-                if (poll_fd_list[i].fd == sub_list_.at(sub_event).socket) {
-                    poll_fd_list[i].fd = -1;
-                    break;
-                }
-            }
-            auto ite = sub_list_.find(sub_event);
-            if (ite != sub_list_.end()) {
-                auto socket = ite->second.socket;
-                sub_list_.erase(ite);
+        int32_t ret = epoll_wait(event_epoll_fd_, events, max_events, -1);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                LERROR(UBusRuntime) << "Error in epoll_wait, err " << strerror(errno);
             }
+            continue;
         }
-        while (!unprocessed_new_sub_events_.empty()) {
-            auto &sub_event = unprocessed_new_sub_events_.front();
-            unprocessed_new_sub_events_.pop();
-            for (int i = 0; i < max_connections_; ++i) {
-                if (poll_fd_list[i].fd == -1) {
-                    poll_fd_list[i].fd = sub_list_.at(sub_event).socket;
-                    poll_fd_list[i].events = POLLIN;
-                    poll_fd_list[i].revents = 0;
-                    break;
+        for (int32_t i = 0; i < ret; ++i) {
+            int32_t fd = events[i].data.fd;
+            if (fd == event_wakeup_fd_) {
+                uint64_t value;
+                if (read(event_wakeup_fd_, &value, sizeof(value)) < 0) {
+                    LDEBUG(UBusRuntime) << "Failed to read wake up event";
                 }
-            }
-        }
-        int ret = poll(poll_fd_list, sub_list_.size(), 1000);
-        if (ret < 0) {
-            LDEBUG(UBusRuntime) << "Error in poll";
-        } else if (ret == 0) {
-            LTRACE(UBusRuntime) << "Poll timeout";
-        } else {
-            for (int i = 0; i < max_connections_; ++i) {
-                if (poll_fd_list[i].revents & POLLIN) {
-                    LDEBUG(UBusRuntime) << "Socket " << poll_fd_list[i].fd << " is readable";
-                    LDEBUG(UBusRuntime) << "Revents is " << poll_fd_list[i].revents;
-                    char header_buff[sizeof(FrameHeader)];
-                    size_t read_size = read(poll_fd_list[i].fd, &header_buff, sizeof(FrameHeader));
-                    if (read_size == 0) {
-                        LWARN(UBusRuntime) << "Peer is closed, remove from poll.";
-                        poll_fd_list[i].fd = -1;
+                std::vector<SubEventInfo> removed;
+                std::unique_lock<std::mutex> lock(sub_list_mtx_);
+                while (!unprocessed_dead_sub_events_.empty()) {
+                    auto ite = sub_list_.find(unprocessed_dead_sub_events_.front());
+                    unprocessed_dead_sub_events_.pop();
+                    if (ite != sub_list_.end()) {
+                        remove_socket(ite->second.socket);
+                        remove_multicast(ite->second);
+                        removed.push_back(std::move(ite->second));
+                        sub_list_.erase(ite);
+                    }
+                }
+                while (!unprocessed_replaced_sub_events_.empty()) {
+                    remove_socket(unprocessed_replaced_sub_events_.front().socket);
+                    remove_multicast(unprocessed_replaced_sub_events_.front());
+                    unprocessed_replaced_sub_events_.pop();
+                }
+                while (!unprocessed_new_sub_events_.empty()) {
+                    auto ite = sub_list_.find(unprocessed_new_sub_events_.front());
+                    unprocessed_new_sub_events_.pop();
+                    if (ite == sub_list_.end()) {
+                        continue;
+                    }
+                    epoll_event event;
+                    event.events = EPOLLIN;
+                    event.data.fd = ite->second.socket;
+                    if (epoll_ctl(event_epoll_fd_, EPOLL_CTL_ADD, ite->second.socket, &event) < 0) {
+                        LERROR(UBusRuntime) << "Failed to add socket to epoll, err " << strerror(errno);
                         continue;
-                    } else if (read_size < sizeof(FrameHeader)) {
-                        LDEBUG(UBusRuntime) << "Failed to read header, size of data read : " << read_size;
                     }
-                    std::string content;
-                    FrameHeader *header = reinterpret_cast<FrameHeader *>(header_buff);
-                    header->data_length = ntohl(header->data_length);
-                    if (header->data_length > 0) {
-                        LDEBUG(UBusRuntime) << "Size of data to read : " << header->data_length;
-                        char content_buff[header->data_length];
-                        read_size = readn(poll_fd_list[i].fd, &content_buff, header->data_length);
-                        if (read_size < header->data_length) {
-                            LDEBUG(UBusRuntime) << "Failed to read content";
+                    readers[ite->second.socket];
+                    socket_topic_map[ite->second.socket] = ite->first;
+                    if (ite->second.multicast != nullptr) {
+                        event.data.fd = ite->second.multicast->socket();
+                        if (epoll_ctl(event_epoll_fd_, EPOLL_CTL_ADD, event.data.fd, &event) < 0) {
+                            LERROR(UBusRuntime) << "Failed to add multicast socket to epoll, err " << strerror(errno);
+                            continue;
                         }
-                        content = std::string(content_buff, header->data_length);
-                        LDEBUG(UBusRuntime) << "Content : " << content;
+                        multicast_receivers[event.data.fd] = ite->second.multicast;
+                        socket_topic_map[event.data.fd] = ite->first;
                     }
+                }
+                lock.unlock();
+                for (auto &event_info : removed) {
+                    stop_shared_memory_reader(&event_info);
+                }
+                continue;
+            }
+
+            auto receiver = multicast_receivers.find(fd);
+            if (receiver != multicast_receivers.end()) {
+                // the receiver may be released by a callback unsubscribing
+                std::shared_ptr<MulticastReceiver> multicast = receiver->second;
+                std::string topic = socket_topic_map[fd];
+                uint64_t sequence = 0;
+                uint64_t timestamp = 0;
+                std::string_view message;
+                int32_t received;
+                while ((received = multicast->receive(&sequence, &timestamp, &message)) > 0) {
+                    // the message stays in the receiver until the next receive
+                    dispatch_event(topic, sequence, timestamp, message, false);
+                }
+                if (received < 0) {
+                    LERROR(UBusRuntime) << "Failed to read from multicast group of " << topic << ", err "
+                                        << strerror(errno);
+                }
+                continue;
+            }
 
-                    switch (header->message_type) {
-                        case FRAME_EVENT:
-                            LDEBUG(UBusRuntime) << "New event message";
-                            {
-                                // find the corresponding sub_event_info
-                                for (auto &sub_event_info : sub_list_) {
-                                    if (sub_event_info.second.socket == poll_fd_list[i].fd) {
-                                        LDEBUG(UBusRuntime) << "Topic is " << sub_event_info.second.topic;
-                                        (*sub_event_info.second.callback)(content);
-                                        break;
-                                    }
-                                }
+            auto reader = readers.find(fd);
+            if (reader == readers.end()) {
+                // removed earlier in this round
+                continue;
+            }
+            LDEBUG(UBusRuntime) << "Socket " << fd << " is readable";
+            bool alive = reader->second.fill(fd);
+            FrameHeader header;
+            FrameHeaderV2 extended;
+            const uint8_t *data = nullptr;
+            while (reader->second.next(&header, &data, &extended)) {
+                if (extended.flags & FRAME_FLAG_LZ4) {
+                    if (!decompress_payload(data, header.data_length, &decompressed)) {
+                        LDEBUG(UBusRuntime) << "Invalid compressed event";
+                        continue;
+                    }
+                    data = decompressed.data();
+                    header.data_length = static_cast<uint32_t>(decompressed.size());
+                }
+                switch (header.message_type) {
+                    case FRAME_EVENT:
+                        LDEBUG(UBusRuntime) << "New event message";
+                        // the payload is handed over in place, it stays in the reader until the next fill
+                        dispatch_event(socket_topic_map[fd], extended.sequence, extended.timestamp,
+                                       std::string_view(reinterpret_cast<const char *>(data), header.data_length),
+                                       false);
+                        break;
+                    case FRAME_EVENT_BATCH: {
+                        LDEBUG(UBusRuntime) << "New event batch";
+                        const uint8_t *entry = data;
+                        const uint8_t *end = data + header.data_length;
+                        uint64_t sequence = extended.sequence;
+                        const std::string &topic = socket_topic_map[fd];
+                        while (end - entry >= static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+                            uint32_t length;
+                            memcpy(&length, entry, sizeof(length));
+                            length = ntohl(length);
+                            entry += sizeof(length);
+                            if (length > static_cast<size_t>(end - entry)) {
+                                LDEBUG(UBusRuntime) << "Truncated event batch";
+                                break;
                             }
-                            break;
-                        default:
-                            LDEBUG(UBusRuntime) << "Invalid frame header";
-                            break;
+                            dispatch_event(topic, sequence++, extended.timestamp,
+                                           std::string_view(reinterpret_cast<const char *>(entry), length), false);
+                            entry += length;
+                        }
+                    } break;
+                    default:
+                        LDEBUG(UBusRuntime) << "Invalid frame header";
+                        break;
+                }
+            }
+            if (reader->second.failed()) {
+                LERROR(UBusRuntime) << "Oversized event frame of topic " << socket_topic_map[fd];
+                alive = false;
+            }
+            if (!alive) {
+                LWARN(UBusRuntime) << "Peer is closed, remove from epoll.";
+                SubEventInfo removed;
+                {
+                    std::lock_guard<std::mutex> lock(sub_list_mtx_);
+                    auto ite = sub_list_.find(socket_topic_map[fd]);
+                    if (ite != sub_list_.end() && ite->second.socket == fd) {
+                        remove_multicast(ite->second);
+                        removed = std::move(ite->second);
+                        sub_list_.erase(ite);
+                        remove_socket(fd);
+                    } else {
+                        // a replaced subscription, closed along with its multicast receiver from
+                        // unprocessed_replaced_sub_events_
+                        epoll_ctl(event_epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+                        readers.erase(fd);
                     }
                 }
+                // the publisher is gone, so is the producer of the ring
+                stop_shared_memory_reader(&removed);
+            }
+        }
+    }
+}
+
+void UBusRuntime::dispatch_event(const std::string &topic,
+                                 uint64_t sequence,
+                                 uint64_t timestamp,
+                                 std::string_view data,
+                                 bool shared_memory) {
+    std::shared_ptr<EventCallbackHolderBase> callback;
+    std::shared_ptr<std::mutex> callback_mtx;
+    std::shared_ptr<EventQueue> event_queue;
+    {
+        std::lock_guard<std::mutex> lock(sub_list_mtx_);
+        auto sub_event_info = sub_list_.find(topic);
+        if (sub_event_info == sub_list_.end()) {
+            return;
+        }
+        LDEBUG(UBusRuntime) << "Topic is " << sub_event_info->second.topic;
+        sub_event_info->second.stats.update(sequence, timestamp, monotonic_now_ns());
+        callback = sub_event_info->second.callback;
+        callback_mtx = sub_event_info->second.callback_mtx;
+        event_queue = shared_memory ? sub_event_info->second.shm_event_queue : sub_event_info->second.event_queue;
+    }
+    if (event_queue == nullptr) {
+        std::lock_guard<std::mutex> lock(*callback_mtx);
+        (*callback)(data);
+        return;
+    }
+    // data only lives until the next read, the executor gets a copy
+    FrameBuffer event(data.size());
+    memcpy(event.data(), data.data(), data.size());
+    if (!event_queue->events.push(std::move(event))) {
+        event_queue->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (event_queue->pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        event_executor_->submit([this, event_queue, callback, callback_mtx]() {
+            drain_event_queue(event_queue, callback, callback_mtx);
+        });
+    }
+}
+
+void UBusRuntime::drain_event_queue(std::shared_ptr<EventQueue> queue,
+                                    std::shared_ptr<EventCallbackHolderBase> callback,
+                                    std::shared_ptr<std::mutex> callback_mtx) {
+    // a busy or slow topic gives the thread back after its time slice, the other topics get their turn in between
+    const uint64_t time_slice_ns = 1000000;
+    uint64_t deadline_ns = monotonic_now_ns() + time_slice_ns;
+    FrameBuffer event;
+    do {
+        // every counted event is already in the queue, its producer pushes before counting
+        if (!queue->events.pop(&event)) {
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(*callback_mtx);
+            (*callback)(std::string_view(reinterpret_cast<const char *>(event.data()), event.size()));
+        }
+        event.reset();
+        if (queue->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // the next push schedules the next drain
+            return;
+        }
+    } while (monotonic_now_ns() < deadline_ns);
+    event_executor_->submit([this, queue, callback, callback_mtx]() {
+        drain_event_queue(queue, callback, callback_mtx);
+    });
+}
+
+void UBusRuntime::process_shared_memory_event(std::string topic,
+                                              std::shared_ptr<SharedMemoryRing> shm_ring,
+                                              std::shared_ptr<SharedMemoryReader> reader) {
+    std::string content;
+    uint64_t sequence = 0;
+    uint64_t timestamp = 0;
+    // the timeout bounds how long stopping the reader takes
+    while (!reader->stop.load()) {
+        int32_t ret = shm_ring->read(&content, 100, &sequence, &timestamp);
+        if (ret < 0) {
+            LERROR(UBusRuntime) << "Failed to read from " << shm_ring->name();
+            return;
+        } else if (ret == 0 || reader->stop.load()) {
+            LTRACE(UBusRuntime) << "Shared memory read timeout";
+            continue;
+        }
+        LDEBUG(UBusRuntime) << "New event message from " << shm_ring->name();
+        dispatch_event(topic, sequence, timestamp, content, true);
+    }
+}
+
+bool UBusRuntime::subscribe_payload(const std::string &topic,
+                                    uint32_t type,
+                                    std::shared_ptr<EventCallbackHolderBase> callback,
+                                    uint32_t fingerprint) {
+    ControlMessage request;
+    request.set_string(CONTROL_TAG_TOPIC, topic);
+    request.set_uint(CONTROL_TAG_TYPE_ID, type);
+    if (fingerprint != 0) {
+        request.set_uint(CONTROL_TAG_TYPE_FINGERPRINT, fingerprint);
+    }
+    request.set_string(CONTROL_TAG_NAME, name_);
+
+    ControlMessage response;
+    if (!control_request(FRAME_EVENT_SUBSCRIBE, request, &response)) {
+        LERROR(UBusRuntime) << "Failed to read response from master";
+        return false;
+    }
+    std::string result = response.get_string(CONTROL_TAG_RESPONSE);
+    if (result != "OK") {
+        LERROR(UBusRuntime) << "Error from master : " << (result.empty() ? "invalid response" : result);
+        return false;
+    }
+    LINFO(UBusRuntime) << "Topic subscription registered to master";
+    uint32_t publisher_port = 0;
+    if (!response.contains(CONTROL_TAG_PUBLISHER_IP) || !response.contains(CONTROL_TAG_PUBLISHER_NAME) ||
+        !response.get_uint(CONTROL_TAG_PUBLISHER_PORT, &publisher_port)) {
+        LERROR(UBusRuntime) << "Invalid reponse from master for subscription";
+        return false;
+    }
+    // the master only tells the unix name of a publisher on this host, tcp stays the fallback
+    int32_t sub_socket = -1;
+    std::string publisher_unix_path;
+    if (unix_socket_enabled_ && response.get_string(CONTROL_TAG_PUBLISHER_UNIX_PATH, &publisher_unix_path) &&
+        (sub_socket = connect_unix(publisher_unix_path)) >= 0) {
+        LDEBUG(UBusRuntime) << "Connected to publisher through unix socket " << publisher_unix_path;
+    } else if ((sub_socket = connect_tcp(response.get_string(CONTROL_TAG_PUBLISHER_IP), publisher_port)) < 0) {
+        LERROR(UBusRuntime) << "Failed to connect to publisher, err " << strerror(errno);
+        return false;
+    }
+
+    SubEventInfo event_info;
+    event_info.topic = topic;
+    event_info.type = type;
+    event_info.socket = sub_socket;
+    event_info.publisher = response.get_string(CONTROL_TAG_PUBLISHER_NAME);
+    event_info.callback = callback;
+    if (event_executor_ != nullptr) {
+        event_info.event_queue = std::make_shared<EventQueue>(event_queue_depth_);
+    }
+
+    // the handshake with the publisher stays json
+    nlohmann::json json_struct;
+    json_struct["topic"] = topic;
+    json_struct["type_id"] = type;
+    json_struct["name"] = name_;
+    // read from the publisher's ring when the master reports it runs on this host
+    json_struct["transport"] = "tcp";
+    json_struct["frame_version"] = FRAME_VERSION_2;
+    // the event worker unpacks FRAME_EVENT_BATCH and decompresses FRAME_FLAG_LZ4
+    json_struct["batch"] = true;
+    json_struct["compression"] = "lz4";
+    if (fingerprint != 0) {
+        json_struct["fingerprint"] = fingerprint;
+    }
+    bool publisher_local = false;
+    if (shm_slot_count_ > 0 && response.get_bool(CONTROL_TAG_PUBLISHER_LOCAL, &publisher_local) && publisher_local) {
+        event_info.shm_ring = std::make_shared<SharedMemoryRing>();
+        if (event_info.shm_ring->open(SharedMemoryRing::make_name(event_info.publisher, topic))) {
+            LINFO(UBusRuntime) << "Using shared memory for " << topic;
+            json_struct["transport"] = "shm";
+            if (event_executor_ != nullptr) {
+                event_info.shm_event_queue = std::make_shared<EventQueue>(event_queue_depth_);
             }
+        } else {
+            LWARN(UBusRuntime) << "Shared memory unavailable for " << topic;
+            event_info.shm_ring.reset();
         }
-        usleep(100000);
     }
-}
\ No newline at end of file
+    // otherwise join the group of a multicast topic
+    std::string multicast_group;
+    uint32_t multicast_port = 0;
+    if (event_info.shm_ring == nullptr && response.get_string(CONTROL_TAG_MULTICAST_GROUP, &multicast_group) &&
+        response.get_uint(CONTROL_TAG_MULTICAST_PORT, &multicast_port)) {
+        event_info.multicast = std::make_shared<MulticastReceiver>();
+        if (event_info.multicast->open(topic, multicast_group, multicast_port, multicast_interface_)) {
+            json_struct["transport"] = "multicast";
+        } else {
+            LWARN(UBusRuntime) << "Multicast unavailable for " << topic;
+            event_info.multicast.reset();
+        }
+    }
+    std::string serialized_string = json_struct.dump();
+    Frame frame;
+    frame.header.message_type = FRAME_EVENT_SUBSCRIBE;
+    frame.header.data_length = htonl(static_cast<uint32_t>(serialized_string.size()));
+    frame.data = reinterpret_cast<uint8_t *>(&serialized_string[0]);
+
+    // send subscribe message to publisher
+    int32_t ret;
+    if ((ret = send_frame(sub_socket, frame)) < 0) {
+        LINFO(UBusRuntime) << "Write returned " << ret;
+    }
+
+    FrameHeader header;
+    std::string content;
+    if (!read_frame(sub_socket, &header, &content)) {
+        LERROR(UBusRuntime) << "Failed to read response from publisher";
+        close(sub_socket);
+        return false;
+    }
+    try {
+        nlohmann::json response_json = nlohmann::json::parse(content);
+        if (response_json.contains("response") && response_json["response"] == "OK") {
+            LINFO(UBusRuntime) << "Registered with publisher";
+            if (event_info.multicast != nullptr &&
+                !(response_json.contains("transport") && response_json["transport"] == "multicast")) {
+                LWARN(UBusRuntime) << "Publisher does not use multicast for " << topic;
+                event_info.multicast.reset();
+            } else if (event_info.multicast != nullptr) {
+                LINFO(UBusRuntime) << "Using multicast group " << multicast_group << " for " << topic;
+            }
+            add_sub_event(event_info);
+            return true;
+        }
+    } catch (nlohmann::json::exception &e) {
+        LERROR(UBusRuntime) << "Exception in json : " << e.what();
+    }
+    LERROR(UBusRuntime) << "Failed to connect to publisher";
+    close(sub_socket);
+    return false;
+}
+
+bool UBusRuntime::publish_payload(const std::string &topic,
+                                  uint32_t type,
+                                  const uint8_t *data,
+                                  size_t length,
+                                  SharedMemoryRing *loaned_ring,
+                                  uint64_t *published_sequence) {
+    if (length > MAX_FRAME_DATA_LENGTH) {
+        // subscribers would drop the connection on it
+        LERROR(UBusRuntime) << "Event of " << length << " bytes exceeds the frame limit";
+        return false;
+    }
+    // reused between calls so that publishing does not allocate
+    thread_local std::vector<EventTarget> targets;
+    targets.clear();
+    std::shared_ptr<std::mutex> transport_mtx;
+    {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        auto pub_event_info = pub_list_.find(topic);
+        if (pub_event_info == pub_list_.end()) {
+            LERROR(UBusRuntime) << "Error topic unregistered";
+            return false;
+        }
+        transport_mtx = pub_event_info->second.transport_mtx;
+    }
+    // shm_ring and multicast are written without pub_list_mtx_, this keeps them in sequence order
+    std::lock_guard<std::mutex> transport_lock(*transport_mtx);
+    EventOptions options;
+    bool batching = false;
+    bool batch_full = false;
+    uint64_t sequence = 0;
+    bool shm_sent = false;
+    std::shared_ptr<SharedMemoryRing> shm_ring;
+    std::shared_ptr<MulticastSender> multicast;
+    {
+        std::unique_lock<std::mutex> lock(pub_list_mtx_);
+        std::unordered_map<std::string, PubEventInfo>::iterator pub_event_info;
+        while (1) {
+            pub_event_info = pub_list_.find(topic);
+            if (pub_event_info == pub_list_.end()) {
+                LERROR(UBusRuntime) << "Error topic unregistered";
+                return false;
+            }
+            if (type != pub_event_info->second.type) {
+                LERROR(UBusRuntime) << "Error wrong event type";
+                return false;
+            }
+            if (pub_event_info->second.client_socket_map.size() == 0) {
+                LINFO(UBusRuntime) << "No subscribers";
+                return true;
+            }
+            PubEventInfo &event_info = pub_event_info->second;
+            if (event_info.options.batch_max_bytes == 0 || event_info.batch.empty()) {
+                break;
+            }
+            // a batch goes through the sockets to the subscribers of shm_ring or multicast as soon as one of its
+            // events did not reach them otherwise, the pending one is sent first if this event takes another path
+            bool shm_expected = loaned_ring != nullptr && loaned_ring == event_info.shm_ring.get();
+            if (loaned_ring == nullptr && event_info.shm_ring != nullptr && !event_info.shm_loaned) {
+                shm_expected = length <= event_info.shm_ring->slot_size();
+            }
+            shm_expected = shm_expected && !event_info.shm_subscribers.empty();
+            bool multicast_expected = event_info.multicast != nullptr && !event_info.multicast_subscribers.empty();
+            if (shm_expected == event_info.batch_shm_sent && multicast_expected == event_info.batch_multicast_sent) {
+                break;
+            }
+            lock.unlock();
+            flush(topic);
+            lock.lock();
+        }
+        PubEventInfo &event_info = pub_event_info->second;
+        options = event_info.options;
+        sequence = ++event_info.sequence;
+        if (loaned_ring != nullptr) {
+            // already in the ring, committed once the other transports are done with it
+            shm_sent = loaned_ring == event_info.shm_ring.get() && !event_info.shm_subscribers.empty();
+        } else if (event_info.shm_ring != nullptr && !event_info.shm_loaned && !event_info.shm_subscribers.empty()) {
+            shm_ring = event_info.shm_ring;
+        }
+        if (event_info.multicast != nullptr && !event_info.multicast_subscribers.empty()) {
+            multicast = event_info.multicast;
+        }
+        batching = event_info.options.batch_max_bytes > 0;
+        if (!batching) {
+            // the subscribers of shm_ring and multicast are dropped below once the event reached them that way
+            collect_event_targets(event_info, shm_sent, false, &targets);
+        }
+    }
+
+    if (published_sequence != nullptr) {
+        *published_sequence = sequence;
+    }
+    uint64_t timestamp = monotonic_now_ns();
+    if (shm_ring != nullptr) {
+        shm_sent = shm_ring->write(data, length, sequence, timestamp);
+    }
+    // one send for every subscriber in the group, a failed one falls back to the sockets
+    bool multicast_sent = multicast != nullptr && multicast->send(sequence, timestamp, data, length);
+
+    if (batching) {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        auto pub_event_info = pub_list_.find(topic);
+        if (pub_event_info == pub_list_.end()) {
+            LERROR(UBusRuntime) << "Error topic unregistered";
+            return false;
+        }
+        PubEventInfo &event_info = pub_event_info->second;
+        if (event_info.batch.empty()) {
+            event_info.batch_sequence = sequence;
+            event_info.batch_deadline_ns = monotonic_now_ns() + event_info.options.batch_max_delay_us * 1000ull;
+            event_info.batch_shm_sent = true;
+            event_info.batch_multicast_sent = true;
+            pending_batches_.insert(topic);
+            arm_batch_timer(event_info.batch_deadline_ns);
+        }
+        uint32_t network_length = htonl(static_cast<uint32_t>(length));
+        const uint8_t *length_bytes = reinterpret_cast<const uint8_t *>(&network_length);
+        event_info.batch.insert(event_info.batch.end(), length_bytes, length_bytes + sizeof(network_length));
+        event_info.batch.insert(event_info.batch.end(), data, data + length);
+        event_info.batch_shm_sent = event_info.batch_shm_sent && shm_sent;
+        event_info.batch_multicast_sent = event_info.batch_multicast_sent && multicast_sent;
+        batch_full = event_info.batch.size() >= event_info.options.batch_max_bytes;
+    } else if (shm_sent || multicast_sent) {
+        targets.erase(std::remove_if(targets.begin(), targets.end(),
+                                     [shm_sent, multicast_sent](const EventTarget &target) {
+                                         return (shm_sent && target.shm) || (multicast_sent && target.multicast);
+                                     }),
+                      targets.end());
+    }
+
+    if (batch_full) {
+        flush(topic);
+    } else if (!targets.empty()) {
+        send_event_frame(topic, options, targets, FRAME_EVENT, data, length, sequence);
+    }
+    return true;
+}
+
+LoanedEvent UBusRuntime::loan_payload(const std::string &topic, uint32_t type, size_t size) {
+    LoanedEvent event;
+    std::shared_ptr<std::mutex> transport_mtx;
+    {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        auto pub_event_info = pub_list_.find(topic);
+        if (pub_event_info == pub_list_.end()) {
+            LERROR(UBusRuntime) << "Error topic unregistered";
+            return event;
+        }
+        transport_mtx = pub_event_info->second.transport_mtx;
+    }
+    {
+        // the slot is reserved between the writes of publish_payload
+        std::lock_guard<std::mutex> transport_lock(*transport_mtx);
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        auto pub_event_info = pub_list_.find(topic);
+        if (pub_event_info == pub_list_.end()) {
+            LERROR(UBusRuntime) << "Error topic unregistered";
+            return event;
+        }
+        if (type != pub_event_info->second.type) {
+            LERROR(UBusRuntime) << "Error wrong event type";
+            return event;
+        }
+        PubEventInfo &event_info = pub_event_info->second;
+        if (event_info.shm_ring != nullptr && !event_info.shm_loaned) {
+            event.data_ = event_info.shm_ring->reserve(size);
+            if (event.data_ != nullptr) {
+                event_info.shm_loaned = true;
+                event.shm_ring_ = event_info.shm_ring;
+            }
+        }
+    }
+    if (event.data_ == nullptr) {
+        event.buffer_ = FrameBuffer(size);
+        event.data_ = event.buffer_.data();
+    }
+    event.runtime_ = this;
+    event.topic_ = topic;
+    event.type_ = type;
+    event.size_ = size;
+    event.capacity_ = size;
+    return event;
+}
+
+bool UBusRuntime::publish(LoanedEvent &&event) {
+    LoanedEvent loaned(std::move(event));
+    if (!loaned.valid() || loaned.runtime_ != this) {
+        LERROR(UBusRuntime) << "Error invalid loan";
+        return false;
+    }
+    uint64_t sequence = 0;
+    bool ret =
+        publish_payload(loaned.topic_, loaned.type_, loaned.data_, loaned.size_, loaned.shm_ring_.get(), &sequence);
+    if (loaned.shm_ring_ != nullptr) {
+        finish_loan(loaned, ret, sequence);
+        loaned.shm_ring_.reset();
+    }
+    return ret;
+}
+
+void UBusRuntime::finish_loan(const LoanedEvent &event, bool commit, uint64_t sequence) {
+    std::lock_guard<std::mutex> lock(pub_list_mtx_);
+    if (commit) {
+        event.shm_ring_->commit(event.size_, sequence, monotonic_now_ns());
+    } else {
+        event.shm_ring_->abort();
+    }
+    auto pub_event_info = pub_list_.find(event.topic_);
+    if (pub_event_info != pub_list_.end() && pub_event_info->second.shm_ring == event.shm_ring_) {
+        pub_event_info->second.shm_loaned = false;
+    }
+}
+
+LoanedEvent &LoanedEvent::operator=(LoanedEvent &&other) noexcept {
+    if (this != &other) {
+        release();
+        runtime_ = other.runtime_;
+        topic_ = std::move(other.topic_);
+        type_ = other.type_;
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        shm_ring_ = std::move(other.shm_ring_);
+        buffer_ = std::move(other.buffer_);
+        other.runtime_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+bool LoanedEvent::resize(size_t size) {
+    if (size > capacity_) {
+        return false;
+    }
+    size_ = size;
+    return true;
+}
+
+void LoanedEvent::release() {
+    if (runtime_ != nullptr && shm_ring_ != nullptr) {
+        runtime_->finish_loan(*this, false);
+    }
+    runtime_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    shm_ring_.reset();
+    buffer_.reset();
+}
+
+bool UBusRuntime::flush(const std::string &topic) {
+    thread_local std::vector<EventTarget> targets;
+    thread_local std::vector<EventTarget> unpacking_targets;
+    // swapped with the batch of the topic, both keep their capacity
+    thread_local std::vector<uint8_t> batch;
+    std::shared_ptr<std::mutex> flush_mtx;
+    {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        auto pub_event_info = pub_list_.find(topic);
+        if (pub_event_info == pub_list_.end()) {
+            LERROR(UBusRuntime) << "Error topic unregistered";
+            return false;
+        }
+        flush_mtx = pub_event_info->second.flush_mtx;
+    }
+    std::lock_guard<std::mutex> flush_lock(*flush_mtx);
+    targets.clear();
+    unpacking_targets.clear();
+    batch.clear();
+    EventOptions options;
+    uint64_t sequence = 0;
+    {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        auto pub_event_info = pub_list_.find(topic);
+        if (pub_event_info == pub_list_.end()) {
+            return false;
+        }
+        PubEventInfo &event_info = pub_event_info->second;
+        pending_batches_.erase(topic);
+        if (event_info.batch.empty()) {
+            return true;
+        }
+        batch.swap(event_info.batch);
+        sequence = event_info.batch_sequence;
+        options = event_info.options;
+        collect_event_targets(event_info, event_info.batch_shm_sent, event_info.batch_multicast_sent, &targets);
+    }
+
+    // subscribers which do not unpack batches get the events one by one
+    for (auto ite = targets.begin(); ite != targets.end();) {
+        if (ite->batch) {
+            ++ite;
+        } else {
+            unpacking_targets.push_back(*ite);
+            ite = targets.erase(ite);
+        }
+    }
+    if (!targets.empty()) {
+        send_event_frame(topic, options, targets, FRAME_EVENT_BATCH, batch.data(), batch.size(), sequence);
+    }
+    size_t offset = 0;
+    while (!unpacking_targets.empty() && offset + sizeof(uint32_t) <= batch.size()) {
+        uint32_t length;
+        memcpy(&length, batch.data() + offset, sizeof(length));
+        offset += sizeof(length);
+        length = ntohl(length);
+        send_event_frame(topic, options, unpacking_targets, FRAME_EVENT, batch.data() + offset, length, sequence++);
+        offset += length;
+    }
+    return true;
+}
+
+void UBusRuntime::flush() {
+    std::vector<std::string> topics;
+    {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        topics.assign(pending_batches_.begin(), pending_batches_.end());
+    }
+    for (auto &topic : topics) {
+        flush(topic);
+    }
+}
+
+void UBusRuntime::collect_event_targets(const PubEventInfo &event_info,
+                                        bool shm_sent,
+                                        bool multicast_sent,
+                                        std::vector<EventTarget> *targets) {
+    for (auto &p : event_info.client_socket_map) {
+        if (shm_sent && event_info.shm_subscribers.count(p.first) > 0) {
+            continue;
+        }
+        if (multicast_sent && event_info.multicast_subscribers.count(p.first) > 0) {
+            continue;
+        }
+        EventTarget target;
+        target.name = p.first;
+        target.socket = p.second;
+        target.shm = event_info.shm_subscribers.count(p.first) > 0;
+        target.multicast = event_info.multicast_subscribers.count(p.first) > 0;
+        target.frame_version = event_info.v2_subscribers.count(p.first) > 0 ? FRAME_VERSION_2 : FRAME_VERSION_1;
+        target.batch = event_info.batch_subscribers.count(p.first) > 0;
+        target.lz4 = event_info.lz4_subscribers.count(p.first) > 0;
+        if (event_info.options.async_publish) {
+            auto queue = event_info.send_queues.find(p.first);
+            if (queue == event_info.send_queues.end()) {
+                continue;
+            }
+            target.queue = queue->second;
+        }
+        targets->push_back(target);
+    }
+}
+
+void UBusRuntime::send_event_frame(const std::string &topic,
+                                   const EventOptions &options,
+                                   const std::vector<EventTarget> &targets,
+                                   FrameType type,
+                                   const uint8_t *data,
+                                   size_t length,
+                                   uint64_t sequence) {
+    // compressed once, on the first subscriber reading it, and dropped if it does not get smaller
+    bool compress = options.compression == COMPRESSION_LZ4 && length >= options.compression_min_size;
+    const std::vector<uint8_t> *compressed = nullptr;
+    // sockets are written without the lock, a slow subscriber must not stall the listener
+    // queued frames are shared by the subscribers reading the same header version and payload
+    FrameBuffer queued_frames[FRAME_VERSION_2 + 1][2];
+    std::vector<std::string> dead_subscribers;
+    for (auto &target : targets) {
+        LINFO(UBusRuntime) << "Sending event to subscriber " << target.name;
+        // only the version 2 header carries the flags
+        bool lz4 = compress && target.lz4 && target.frame_version >= FRAME_VERSION_2;
+        if (lz4 && compressed == nullptr) {
+            if (compress_payload(data, length, &compression_buffer())) {
+                compressed = &compression_buffer();
+            } else {
+                compress = lz4 = false;
+            }
+        }
+        const uint8_t *payload = lz4 ? compressed->data() : data;
+        size_t payload_length = lz4 ? compressed->size() : length;
+        uint8_t flags = lz4 ? FRAME_FLAG_LZ4 : 0;
+        if (options.async_publish) {
+            FrameBuffer &queued_frame = queued_frames[target.frame_version][lz4];
+            if (queued_frame.empty()) {
+                queued_frame = FrameBuffer(MAX_FRAME_HEADER_SIZE + payload_length);
+                size_t header_size = encode_frame_header(target.frame_version, type,
+                                                         static_cast<uint32_t>(payload_length), sequence,
+                                                         queued_frame.data(), flags);
+                memcpy(queued_frame.data() + header_size, payload, payload_length);
+                queued_frame.resize(header_size + payload_length);
+            }
+            if (!enqueue_frame(target.queue, queued_frame)) {
+                dead_subscribers.push_back(target.name);
+            }
+            continue;
+        }
+        int32_t ret = send_frame(target.socket, target.frame_version, type, payload, payload_length, sequence, flags);
+        if (ret < 0) {
+            LDEBUG(UBusRuntime) << "Write returned " << ret;
+        }
+        if (ret < 0 && errno == EPIPE) {
+            LINFO(UBusRuntime) << "EPIPE returned, socket is closed by peer, will remove from subscriber list: "
+                               << target.name;
+            dead_subscribers.push_back(target.name);
+        }
+    }
+    if (!dead_subscribers.empty()) {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        remove_subscribers(topic, dead_subscribers);
+    }
+}
+
+void UBusRuntime::remove_subscribers(const std::string &topic, const std::vector<std::string> &subscribers) {
+    auto pub_event_info = pub_list_.find(topic);
+    if (pub_event_info == pub_list_.end()) {
+        return;
+    }
+    for (auto &p : subscribers) {
+        pub_event_info->second.client_socket_map.erase(p);
+        pub_event_info->second.shm_subscribers.erase(p);
+        pub_event_info->second.multicast_subscribers.erase(p);
+        pub_event_info->second.send_queues.erase(p);
+        pub_event_info->second.v2_subscribers.erase(p);
+        pub_event_info->second.batch_subscribers.erase(p);
+        pub_event_info->second.lz4_subscribers.erase(p);
+    }
+}
+
+void UBusRuntime::arm_batch_timer(uint64_t deadline_ns) {
+    if (deadline_ns >= batch_timer_deadline_ns_) {
+        return;
+    }
+    batch_timer_deadline_ns_ = deadline_ns;
+    itimerspec deadline;
+    bzero(&deadline, sizeof(deadline));
+    deadline.it_value.tv_sec = deadline_ns / 1000000000ull;
+    deadline.it_value.tv_nsec = deadline_ns % 1000000000ull;
+    if (timerfd_settime(batch_timer_fd_, TFD_TIMER_ABSTIME, &deadline, nullptr) < 0) {
+        LERROR(UBusRuntime) << "Failed to arm batch timer, err " << strerror(errno);
+    }
+}
+
+void UBusRuntime::flush_due_batches() {
+    std::vector<std::string> due_topics;
+    {
+        std::lock_guard<std::mutex> lock(pub_list_mtx_);
+        uint64_t now = monotonic_now_ns();
+        batch_timer_deadline_ns_ = UINT64_MAX;
+        for (auto &topic : pending_batches_) {
+            auto pub_event_info = pub_list_.find(topic);
+            if (pub_event_info == pub_list_.end()) {
+                continue;
+            }
+            if (pub_event_info->second.batch_deadline_ns <= now) {
+                due_topics.push_back(topic);
+            } else {
+                arm_batch_timer(pub_event_info->second.batch_deadline_ns);
+            }
+        }
+    }
+    for (auto &topic : due_topics) {
+        flush(topic);
+    }
+}
+
+bool UBusRuntime::enqueue_frame(const std::shared_ptr<SendQueue> &queue, const FrameBuffer &frame) {
+    {
+        std::unique_lock<std::mutex> lock(queue->mtx);
+        if (queue->dead) {
+            return false;
+        }
+        if (queue->frames.size() >= queue->depth) {
+            switch (queue->overflow_policy) {
+                case OVERFLOW_DROP_NEWEST:
+                    ++queue->dropped;
+                    LDEBUG(UBusRuntime) << "Send queue full, dropped newest frame, " << queue->dropped << " in total";
+                    return true;
+                case OVERFLOW_DROP_OLDEST: {
+                    // a partially written frame has to be finished to keep the stream intact
+                    auto oldest = queue->frames.begin();
+                    if (queue->offset > 0) {
+                        ++oldest;
+                    }
+                    if (oldest == queue->frames.end()) {
+                        ++queue->dropped;
+                        return true;
+                    }
+                    queue->frames.erase(oldest);
+                    ++queue->dropped;
+                    LDEBUG(UBusRuntime) << "Send queue full, dropped oldest frame, " << queue->dropped << " in total";
+                } break;
+                case OVERFLOW_BLOCK:
+                    queue->space_cv.wait(lock, [&] { return queue->dead || queue->frames.size() < queue->depth; });
+                    if (queue->dead) {
+                        return false;
+                    }
+                    break;
+            }
+        }
+        queue->frames.push_back(frame);
+        if (queue->frames.size() > 1) {
+            // publish_worker_ is already draining this queue
+            return true;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(pending_send_queues_mtx_);
+        pending_send_queues_.push_back(queue);
+    }
+    uint64_t value = 1;
+    if (write(publish_wakeup_fd_, &value, sizeof(value)) < 0) {
+        LERROR(UBusRuntime) << "Failed to wake up publish worker";
+    }
+    return true;
+}
+
+void UBusRuntime::flush_send_queue(const std::shared_ptr<SendQueue> &queue,
+                                   std::unordered_map<int32_t, std::shared_ptr<SendQueue>> *writable_waiters) {
+    std::lock_guard<std::mutex> lock(queue->mtx);
+    const size_t max_iov = 64;
+    iovec iov[max_iov];
+    while (!queue->frames.empty() && !queue->dead) {
+        // gather as many queued frames as possible into a single syscall
+        size_t iovcnt = 0;
+        for (auto ite = queue->frames.begin(); ite != queue->frames.end() && iovcnt < max_iov; ++ite, ++iovcnt) {
+            size_t skip = iovcnt == 0 ? queue->offset : 0;
+            iov[iovcnt].iov_base = ite->data() + skip;
+            iov[iovcnt].iov_len = ite->size() - skip;
+        }
+        msghdr message;
+        bzero(&message, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = iovcnt;
+        ssize_t ret = sendmsg(queue->socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!queue->waiting_writable) {
+                    epoll_event event;
+                    event.events = EPOLLOUT;
+                    event.data.fd = queue->socket;
+                    if (epoll_ctl(publish_epoll_fd_, EPOLL_CTL_ADD, queue->socket, &event) < 0) {
+                        LERROR(UBusRuntime) << "Failed to add socket to epoll, err " << strerror(errno);
+                    } else {
+                        queue->waiting_writable = true;
+                        (*writable_waiters)[queue->socket] = queue;
+                    }
+                }
+                return;
+            }
+            LINFO(UBusRuntime) << "Failed to send queued frames, err " << strerror(errno);
+            queue->dead = true;
+            queue->frames.clear();
+            break;
+        }
+        size_t written = ret;
+        while (written > 0) {
+            size_t remaining = queue->frames.front().size() - queue->offset;
+            if (written < remaining) {
+                queue->offset += written;
+                break;
+            }
+            written -= remaining;
+            queue->offset = 0;
+            queue->frames.pop_front();
+        }
+        queue->space_cv.notify_all();
+    }
+    if (queue->waiting_writable) {
+        epoll_ctl(publish_epoll_fd_, EPOLL_CTL_DEL, queue->socket, nullptr);
+        queue->waiting_writable = false;
+        writable_waiters->erase(queue->socket);
+    }
+    queue->space_cv.notify_all();
+}
+
+void UBusRuntime::process_publish_queue() {
+    std::unordered_map<int32_t, std::shared_ptr<SendQueue>> writable_waiters;
+    std::vector<std::shared_ptr<SendQueue>> pending;
+    const int32_t max_events = 64;
+    epoll_event events[max_events];
+    while (1) {
+        int32_t ret = epoll_wait(publish_epoll_fd_, events, max_events, -1);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                LERROR(UBusRuntime) << "Error in epoll_wait, err " << strerror(errno);
+            }
+            continue;
+        }
+        for (int32_t i = 0; i < ret; ++i) {
+            int32_t fd = events[i].data.fd;
+            if (fd == publish_wakeup_fd_) {
+                uint64_t value;
+                if (read(publish_wakeup_fd_, &value, sizeof(value)) < 0) {
+                    LDEBUG(UBusRuntime) << "Failed to read wake up event";
+                }
+                {
+                    std::lock_guard<std::mutex> lock(pending_send_queues_mtx_);
+                    pending.swap(pending_send_queues_);
+                }
+                for (auto &queue : pending) {
+                    flush_send_queue(queue, &writable_waiters);
+                }
+                pending.clear();
+                continue;
+            }
+            auto queue = writable_waiters.find(fd);
+            if (queue != writable_waiters.end()) {
+                // flush_send_queue may erase the entry
+                std::shared_ptr<SendQueue> writable = queue->second;
+                flush_send_queue(writable, &writable_waiters);
+            }
+        }
+    }
+}
+
+void UBusRuntime::process_batch_timer() {
+    uint64_t expirations;
+    while (1) {
+        if (read(batch_timer_fd_, &expirations, sizeof(expirations)) < 0) {
+            if (errno != EINTR) {
+                LERROR(UBusRuntime) << "Failed to read batch timer, err " << strerror(errno);
+            }
+            continue;
+        }
+        flush_due_batches();
+    }
+}
+
+bool UBusRuntime::resolve_method(const std::string &method,
+                                 uint32_t request_type,
+                                 uint32_t response_type,
+                                 uint32_t request_fingerprint,
+                                 uint32_t response_fingerprint,
+                                 MethodProviderInfo *provider,
+                                 bool *cached) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(method_cache_mtx_);
+        auto ite = method_cache_.find(method);
+        if (ite != method_cache_.end() && ite->second.request_type == request_type &&
+            ite->second.response_type == response_type && ite->second.request_fingerprint == request_fingerprint &&
+            ite->second.response_fingerprint == response_fingerprint) {
+            *provider = ite->second;
+            *cached = true;
+            return true;
+        }
+        generation = method_cache_generation_;
+    }
+    *cached = false;
+
+    ControlMessage request;
+    request.set_string(CONTROL_TAG_METHOD, method);
+    request.set_uint(CONTROL_TAG_REQUEST_TYPE_ID, request_type);
+    request.set_uint(CONTROL_TAG_RESPONSE_TYPE_ID, response_type);
+    if (request_fingerprint != 0) {
+        request.set_uint(CONTROL_TAG_REQUEST_FINGERPRINT, request_fingerprint);
+    }
+    if (response_fingerprint != 0) {
+        request.set_uint(CONTROL_TAG_RESPONSE_FINGERPRINT, response_fingerprint);
+    }
+    request.set_string(CONTROL_TAG_NAME, name_);
+    ControlMessage response;
+    if (!control_request(FRAME_METHOD_QUERY, request, &response)) {
+        LERROR(UBusRuntime) << "Failed to read response from master";
+        return false;
+    }
+    std::string result;
+    if (!response.get_string(CONTROL_TAG_RESPONSE, &result)) {
+        LERROR(UBusRuntime) << "Invalid response from master";
+        return false;
+    }
+    if (result != "OK") {
+        LERROR(UBusRuntime) << "Master returned " << result;
+        return false;
+    }
+    LINFO(UBusRuntime) << "Method request is validated by master.";
+    if (!response.get_string(CONTROL_TAG_PROVIDER_NAME, &provider->name) ||
+        !response.get_string(CONTROL_TAG_PROVIDER_IP, &provider->ip) ||
+        !response.get_uint(CONTROL_TAG_PROVIDER_PORT, &provider->port)) {
+        LERROR(UBusRuntime) << "Invalid reponse from master for method request";
+        return false;
+    }
+    provider->unix_path.clear();
+    response.get_string(CONTROL_TAG_PROVIDER_UNIX_PATH, &provider->unix_path);
+    uint32_t frame_version = FRAME_VERSION_1;
+    if (response.get_uint(CONTROL_TAG_PROVIDER_FRAME_VERSION, &frame_version)) {
+        provider->frame_version = frame_version >= FRAME_VERSION_2 ? FRAME_VERSION_2 : FRAME_VERSION_1;
+    }
+    provider->request_type = request_type;
+    provider->response_type = response_type;
+    provider->request_fingerprint = request_fingerprint;
+    provider->response_fingerprint = response_fingerprint;
+    uint32_t compression = COMPRESSION_NONE;
+    provider->compression = COMPRESSION_NONE;
+    if (response.get_uint(CONTROL_TAG_COMPRESSION, &compression) && compression == COMPRESSION_LZ4) {
+        provider->compression = COMPRESSION_LZ4;
+        response.get_uint(CONTROL_TAG_COMPRESSION_MIN_SIZE, &provider->compression_min_size);
+    }
+    std::lock_guard<std::mutex> lock(method_cache_mtx_);
+    if (method_cache_enabled_ && generation == method_cache_generation_) {
+        method_cache_[method] = *provider;
+    }
+    return true;
+}
+
+void UBusRuntime::invalidate_method(const std::string &method) {
+    std::lock_guard<std::mutex> lock(method_cache_mtx_);
+    method_cache_.erase(method);
+    ++method_cache_generation_;
+}
+
+void UBusRuntime::call_method_raw(const std::string &method,
+                                  uint32_t request_type,
+                                  uint32_t response_type,
+                                  uint32_t request_fingerprint,
+                                  uint32_t response_fingerprint,
+                                  const uint8_t *data,
+                                  size_t length,
+                                  MethodResponseCallback done) {
+    if (length > MAX_FRAME_DATA_LENGTH - sizeof(MethodFrameHeader)) {
+        LERROR(UBusRuntime) << "Request of " << length << " bytes exceeds the frame limit";
+        done(false, nullptr, 0);
+        return;
+    }
+    MethodFrameHeader header;
+    header.method_id = method_name_hash(method);
+    header.request_type_id = request_type;
+    header.response_type_id = response_type;
+
+    // a cached provider may have died before the master told us, ask the master again once
+    for (int32_t attempt = 0; attempt < 2; ++attempt) {
+        MethodProviderInfo provider;
+        bool cached = false;
+        if (!resolve_method(method, request_type, response_type, request_fingerprint, response_fingerprint, &provider,
+                            &cached)) {
+            break;
+        }
+        // only the version 2 header carries the flags
+        const uint8_t *payload = data;
+        size_t payload_length = length;
+        uint8_t flags = 0;
+        if (provider.frame_version >= FRAME_VERSION_2) {
+            flags = FRAME_FLAG_ACCEPT_LZ4;
+            std::vector<uint8_t> &compressed = compression_buffer();
+            if (provider.compression == COMPRESSION_LZ4 && length >= provider.compression_min_size &&
+                compress_payload(data, length, &compressed)) {
+                payload = compressed.data();
+                payload_length = compressed.size();
+                flags |= FRAME_FLAG_LZ4;
+            }
+        }
+        std::shared_ptr<ProviderChannel> channel = acquire_provider_channel(provider);
+        header.request_id = next_request_id_.fetch_add(1);
+        if (channel != nullptr && send_method_call(channel, header, payload, payload_length, flags, done)) {
+            return;
+        }
+        invalidate_method(method);
+        if (!cached) {
+            break;
+        }
+    }
+    done(false, nullptr, 0);
+}
+
+std::shared_ptr<UBusRuntime::ProviderChannel> UBusRuntime::acquire_provider_channel(
+    const MethodProviderInfo &provider) {
+    std::string address = provider.ip + ":" + std::to_string(provider.port);
+    {
+        std::lock_guard<std::mutex> lock(provider_channels_mtx_);
+        auto ite = provider_channels_.find(address);
+        if (ite != provider_channels_.end()) {
+            std::lock_guard<std::mutex> channel_lock(ite->second->mtx);
+            if (!ite->second->closed) {
+                return ite->second;
+            }
+        }
+    }
+
+    int32_t fd = -1;
+    if (unix_socket_enabled_ && !provider.unix_path.empty() && (fd = connect_unix(provider.unix_path)) >= 0) {
+        LDEBUG(UBusRuntime) << "Connected to method provider through unix socket " << provider.unix_path;
+    } else if ((fd = connect_tcp(provider.ip, provider.port)) < 0) {
+        LERROR(UBusRuntime) << "Failed to connect to method provider, err " << strerror(errno);
+        return nullptr;
+    }
+
+    // owns fd from now on
+    std::shared_ptr<ProviderChannel> channel = std::make_shared<ProviderChannel>();
+    channel->socket = fd;
+    channel->address = address;
+    channel->frame_version = provider.frame_version;
+    std::lock_guard<std::mutex> lock(provider_channels_mtx_);
+    auto ite = provider_channels_.find(address);
+    if (ite != provider_channels_.end()) {
+        // another caller connected meanwhile, keep a single channel per provider
+        std::lock_guard<std::mutex> channel_lock(ite->second->mtx);
+        if (!ite->second->closed) {
+            return ite->second;
+        }
+    }
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = channel.get();
+    if (epoll_ctl(method_epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+        LERROR(UBusRuntime) << "Failed to add socket to epoll, err " << strerror(errno);
+        return nullptr;
+    }
+    provider_channels_[address] = channel;
+    live_provider_channels_[channel.get()] = channel;
+    return channel;
+}
+
+bool UBusRuntime::send_method_call(const std::shared_ptr<ProviderChannel> &channel,
+                                   const MethodFrameHeader &header,
+                                   const uint8_t *data,
+                                   size_t length,
+                                   uint8_t flags,
+                                   MethodResponseCallback done) {
+    {
+        // registered before sending, the response may arrive before send_frame returns
+        std::lock_guard<std::mutex> lock(channel->mtx);
+        if (channel->closed) {
+            return false;
+        }
+        channel->pending_calls[header.request_id] = std::move(done);
+    }
+    int32_t ret;
+    {
+        std::lock_guard<std::mutex> lock(channel->write_mtx);
+        ret = send_method_frame(channel->socket, channel->frame_version, FRAME_METHOD_CALL, header, data, length,
+                                ++channel->sequence, flags);
+    }
+    if (ret >= 0) {
+        return true;
+    }
+    LDEBUG(UBusRuntime) << "Write returned " << ret << ", err " << strerror(errno);
+    // method_worker_ fails the other pending calls once it sees the connection closing
+    shutdown(channel->socket, SHUT_RDWR);
+    std::lock_guard<std::mutex> lock(channel->mtx);
+    if (channel->pending_calls.erase(header.request_id) == 0) {
+        // already failed by method_worker_, which called done
+        return true;
+    }
+    return false;
+}
+
+void UBusRuntime::close_provider_channel(ProviderChannel *channel) {
+    std::unordered_map<uint64_t, MethodResponseCallback> pending_calls;
+    {
+        std::lock_guard<std::mutex> lock(channel->mtx);
+        channel->closed = true;
+        pending_calls.swap(channel->pending_calls);
+    }
+    // wakes up callers blocked in a write, closing here could hand the number to a new socket while they still
+    // write to it, the last reference closes it instead
+    shutdown(channel->socket, SHUT_RDWR);
+    epoll_ctl(method_epoll_fd_, EPOLL_CTL_DEL, channel->socket, nullptr);
+    for (auto &call : pending_calls) {
+        call.second(false, nullptr, 0);
+    }
+}
+
+void UBusRuntime::process_method_response() {
+    // channels closed in a round are released after it, later events of the round may still point to them
+    std::vector<std::shared_ptr<ProviderChannel>> closed_channels;
+    // responses flagged FRAME_FLAG_LZ4 are decompressed here, reused between responses
+    std::vector<uint8_t> decompressed;
+    const int32_t max_events = 64;
+    epoll_event events[max_events];
+    while (1) {
+        int32_t ret = epoll_wait(method_epoll_fd_, events, max_events, -1);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                LERROR(UBusRuntime) << "Error in epoll_wait, err " << strerror(errno);
+            }
+            continue;
+        }
+        for (int32_t i = 0; i < ret; ++i) {
+            ProviderChannel *channel = static_cast<ProviderChannel *>(events[i].data.ptr);
+            {
+                std::lock_guard<std::mutex> lock(channel->mtx);
+                if (channel->closed) {
+                    continue;
+                }
+            }
+            bool alive = channel->reader.fill(channel->socket);
+            FrameHeader header;
+            FrameHeaderV2 extended;
+            const uint8_t *data = nullptr;
+            while (channel->reader.next(&header, &data, &extended)) {
+                if (header.message_type != FRAME_METHOD_RESPONSE) {
+                    LERROR(UBusRuntime) << "Invalid frame type";
+                    continue;
+                }
+                MethodFrameHeader response_header;
+                if (!parse_method_header(data, header.data_length, &response_header)) {
+                    // most likely a provider of another version, drop the connection and fail its calls
+                    LERROR(UBusRuntime) << "Invalid frame format";
+                    alive = false;
+                    break;
+                }
+                MethodResponseCallback done;
+                {
+                    std::lock_guard<std::mutex> lock(channel->mtx);
+                    auto call = channel->pending_calls.find(response_header.request_id);
+                    if (call == channel->pending_calls.end()) {
+                        LWARN(UBusRuntime) << "Response to an unknown request";
+                        continue;
+                    }
+                    done = std::move(call->second);
+                    channel->pending_calls.erase(call);
+                }
+                if (response_header.status == METHOD_STATUS_OK) {
+                    LINFO(UBusRuntime) << "Get response from method provider";
+                } else {
+                    LERROR(UBusRuntime) << "Error request method : " << static_cast<int32_t>(response_header.status);
+                }
+                // the response is deserialized straight from the reader's buffer
+                const uint8_t *payload = data + sizeof(MethodFrameHeader);
+                size_t payload_length = header.data_length - sizeof(MethodFrameHeader);
+                bool ok = response_header.status == METHOD_STATUS_OK;
+                if (ok && (extended.flags & FRAME_FLAG_LZ4)) {
+                    if (decompress_payload(payload, payload_length, &decompressed)) {
+                        payload = decompressed.data();
+                        payload_length = decompressed.size();
+                    } else {
+                        LERROR(UBusRuntime) << "Invalid compressed response";
+                        ok = false;
+                    }
+                }
+                done(ok, payload, payload_length);
+            }
+            if (channel->reader.failed()) {
+                LERROR(UBusRuntime) << "Oversized frame from method provider";
+                alive = false;
+            }
+            if (!alive || (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                LDEBUG(UBusRuntime) << "Connection to method provider is closed";
+                close_provider_channel(channel);
+                std::lock_guard<std::mutex> lock(provider_channels_mtx_);
+                auto live = live_provider_channels_.find(channel);
+                if (live != live_provider_channels_.end()) {
+                    closed_channels.push_back(live->second);
+                    live_provider_channels_.erase(live);
+                }
+                // the next call connects again, callers still holding the channel keep it alive until they return
+                auto cached = provider_channels_.find(channel->address);
+                if (cached != provider_channels_.end() && cached->second.get() == channel) {
+                    provider_channels_.erase(cached);
+                }
+            }
+        }
+        closed_channels.clear();
+    }
+}
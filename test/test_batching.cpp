@@ -0,0 +1,138 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <stdio.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "test_fixture.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+/// payloads of the same length, so that batch_max_bytes counts events
+std::string payload(int32_t i) {
+    char text[16];
+    snprintf(text, sizeof(text), "event %03d", i);
+    return text;
+}
+
+const size_t batched_event_size = sizeof(uint32_t) + 9;
+
+/// the events of a topic as its callback got them
+struct Received {
+    std::mutex mtx;
+    std::vector<std::string> events;
+    std::chrono::steady_clock::time_point first;
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return events.size();
+    }
+};
+
+struct BatchedTopic {
+    UBusRuntime *publisher = nullptr;
+    UBusRuntime *subscriber = nullptr;
+    Received received;
+};
+
+/// both over sockets, where batches are sent as FRAME_EVENT_BATCH
+bool connect_topic(const std::string &topic, const EventOptions &options, BatchedTopic *batched) {
+    auto socket_only = [](UBusRuntime *runtime) { runtime->configure_shared_memory(0, 0); };
+    batched->publisher = participant(topic + "_pub", socket_only);
+    batched->subscriber = participant(topic + "_sub", socket_only);
+    Received *received = &batched->received;
+    auto callback = [received](const StringMsg &event) {
+        std::lock_guard<std::mutex> lock(received->mtx);
+        if (received->events.empty()) {
+            received->first = std::chrono::steady_clock::now();
+        }
+        received->events.push_back(event.data);
+    };
+    return batched->publisher != nullptr && batched->subscriber != nullptr &&
+           batched->publisher->advertise_event<StringMsg>(topic, options) &&
+           batched->subscriber->subscribe_event(topic, std::function<void(const StringMsg &)>(callback));
+}
+
+void publish(BatchedTopic *batched, const std::string &topic, int32_t from, int32_t to) {
+    for (int32_t i = from; i < to; ++i) {
+        StringMsg event;
+        event.data = payload(i);
+        EXPECT(batched->publisher->publish_event(topic, event));
+    }
+}
+
+/// every event arrived once and in order, each with its own sequence although they shared a frame
+void expect_in_order(BatchedTopic *batched, const std::string &topic, int32_t count) {
+    EXPECT(wait_until([&] { return batched->received.size() == static_cast<size_t>(count); }));
+    {
+        std::lock_guard<std::mutex> lock(batched->received.mtx);
+        for (int32_t i = 0; i < count && i < static_cast<int32_t>(batched->received.events.size()); ++i) {
+            EXPECT(batched->received.events[i] == payload(i));
+        }
+    }
+    EventStats stats;
+    EXPECT(batched->subscriber->get_event_stats(topic, &stats));
+    EXPECT(stats.received == static_cast<uint64_t>(count));
+    EXPECT(stats.last_sequence == static_cast<uint64_t>(count));
+    EXPECT(stats.dropped == 0);
+}
+
+}  // namespace
+
+/// a batch goes out once batch_max_bytes of events are pending, the rest waits for flush
+static void test_flush_on_size(const std::string &topic) {
+    EventOptions options;
+    options.batch_max_bytes = 4 * batched_event_size;
+    // far beyond the test, only the size or an explicit flush sends the batch
+    options.batch_max_delay_us = 60000000;
+    BatchedTopic batched;
+    EXPECT(connect_topic(topic, options, &batched));
+    if (batched.publisher == nullptr || batched.subscriber == nullptr) {
+        return;
+    }
+    publish(&batched, topic, 0, 4);
+    expect_in_order(&batched, topic, 4);
+
+    publish(&batched, topic, 4, 7);
+    EXPECT(batched.received.size() == 4);
+    EXPECT(batched.publisher->flush(topic));
+    expect_in_order(&batched, topic, 7);
+
+    publish(&batched, topic, 7, 9);
+    batched.publisher->flush();
+    expect_in_order(&batched, topic, 9);
+    EXPECT(!batched.publisher->flush(topic + "_unknown"));
+}
+
+/// a batch which does not fill up goes out batch_max_delay_us after its first event
+static void test_flush_on_delay(const std::string &topic) {
+    EventOptions options;
+    options.batch_max_bytes = 1 << 20;
+    options.batch_max_delay_us = 100000;
+    BatchedTopic batched;
+    EXPECT(connect_topic(topic, options, &batched));
+    if (batched.publisher == nullptr || batched.subscriber == nullptr) {
+        return;
+    }
+    auto published = std::chrono::steady_clock::now();
+    publish(&batched, topic, 0, 3);
+    expect_in_order(&batched, topic, 3);
+    std::lock_guard<std::mutex> lock(batched.received.mtx);
+    EXPECT(batched.received.first - published >= std::chrono::microseconds(options.batch_max_delay_us));
+}
+
+int main() {
+    g_log_manager.SetLogLevel(3);
+    if (!start_master()) {
+        return 1;
+    }
+    test_flush_on_size("batch_size");
+    test_flush_on_delay("batch_delay");
+    return unit_test_result();
+}
@@ -0,0 +1,59 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "message.hpp"
+#include "unit_test.hpp"
+
+/// the buffer interface writes the bytes of the std::string one, which older peers parse
+template <typename MessageT, typename ValueT>
+static void expect_same_text(ValueT value) {
+    MessageT message;
+    message.data = value;
+    std::string text;
+    message.serialize(&text);
+    EXPECT(message.serialized_size() == text.size());
+    std::vector<uint8_t> buffer;
+    EXPECT(serialize_message(message, &buffer));
+    EXPECT(std::string(buffer.begin(), buffer.end()) == text);
+    if (!text.empty()) {
+        EXPECT(!message.serialize(buffer.data(), text.size() - 1));
+    }
+
+    MessageT parsed;
+    parsed.data = 0;
+    EXPECT(deserialize_message(&parsed, buffer.data(), buffer.size()));
+    std::string reparsed;
+    parsed.serialize(&reparsed);
+    EXPECT(reparsed == text);
+}
+
+static void test_integers() {
+    expect_same_text<Int32Msg>(int32_t(0));
+    expect_same_text<Int32Msg>(int32_t(-42));
+    expect_same_text<Int32Msg>(std::numeric_limits<int32_t>::min());
+    expect_same_text<Int32Msg>(std::numeric_limits<int32_t>::max());
+    expect_same_text<Int64Msg>(int64_t(123456789012345));
+    expect_same_text<Int64Msg>(std::numeric_limits<int64_t>::min());
+    expect_same_text<Int64Msg>(std::numeric_limits<int64_t>::max());
+}
+
+static void test_floats() {
+    expect_same_text<Float32Msg>(0.0f);
+    expect_same_text<Float32Msg>(-3.25f);
+    expect_same_text<Float32Msg>(1e-9f);
+    expect_same_text<Float32Msg>(std::numeric_limits<float32_t>::max());
+    expect_same_text<Float64Msg>(2.718281828);
+    expect_same_text<Float64Msg>(-1e300);
+    expect_same_text<Float64Msg>(std::numeric_limits<float64_t>::lowest());
+}
+
+int main() {
+    test_integers();
+    test_floats();
+    return unit_test_result();
+}
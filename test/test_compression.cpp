@@ -0,0 +1,160 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "compression.hpp"
+#include "frame.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+std::vector<uint8_t> bytes(const std::string &text) { return std::vector<uint8_t>(text.begin(), text.end()); }
+
+/// a block produced elsewhere, prefixed with the size of the original payload
+std::vector<uint8_t> payload(uint32_t size, const std::string &block) {
+    uint32_t network_size = htonl(size);
+    std::vector<uint8_t> data(sizeof(network_size));
+    memcpy(data.data(), &network_size, sizeof(network_size));
+    data.insert(data.end(), block.begin(), block.end());
+    return data;
+}
+
+bool decompress(const std::vector<uint8_t> &data, std::vector<uint8_t> *out) {
+    return decompress_payload(data.data(), data.size(), out);
+}
+
+}  // namespace
+
+/// whatever compresses comes back as it was
+static void test_round_trip() {
+    std::mt19937 random(1);
+    const std::string words = "hello world ";
+    int32_t compressed = 0;
+    for (size_t size = 1; size < 5000; size += 37) {
+        for (int32_t kind = 0; kind < 3; ++kind) {
+            std::vector<uint8_t> data(size);
+            for (uint8_t &byte : data) {
+                byte = kind == 0 ? 'a' + random() % 3 : kind == 1 ? words[random() % words.size()] : random();
+            }
+            std::vector<uint8_t> out;
+            if (!compress_payload(data.data(), data.size(), &out)) {
+                continue;
+            }
+            ++compressed;
+            EXPECT(out.size() < data.size());
+            std::vector<uint8_t> back;
+            EXPECT(decompress(out, &back));
+            EXPECT(back == data);
+        }
+    }
+    EXPECT(compressed > 200);
+
+    // runs longer than the 64K window and the 255 byte length steps
+    std::vector<uint8_t> run(200000, 'x');
+    run[100000] = 'y';
+    std::vector<uint8_t> out;
+    EXPECT(compress_payload(run.data(), run.size(), &out));
+    std::vector<uint8_t> back;
+    EXPECT(decompress(out, &back));
+    EXPECT(back == run);
+
+    // nothing to gain
+    EXPECT(!compress_payload(nullptr, 0, &out));
+    std::vector<uint8_t> short_data = bytes("abcabc");
+    EXPECT(!compress_payload(short_data.data(), short_data.size(), &out));
+}
+
+/// blocks written by the reference LZ4 implementation (LZ4_compress_default of lz4 1.9.4)
+static void test_reference_blocks() {
+    const std::string sentence =
+        "the quick brown fox jumps over the lazy dog, the quick brown fox jumps over the lazy dog";
+    const std::string sentence_block(
+        "\xf0\x10\x74\x68\x65\x20\x71\x75\x69\x63\x6b\x20\x62\x72\x6f\x77\x6e\x20\x66\x6f\x78\x20\x6a\x75\x6d\x70"
+        "\x73\x20\x6f\x76\x65\x72\x20\x1f\x00\x91\x6c\x61\x7a\x79\x20\x64\x6f\x67\x2c\x0e\x00\x0f\x2d\x00\x0f\x50"
+        "\x79\x20\x64\x6f\x67",
+        57);
+    std::vector<uint8_t> out;
+    EXPECT(decompress(payload(sentence.size(), sentence_block), &out));
+    EXPECT(out == bytes(sentence));
+
+    // extended literal and match lengths, and a match overlapping its own output
+    const std::string alphabet = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUV";
+    std::string long_text = alphabet.substr(0, 40) + std::string(300, 'z') + alphabet + "!!";
+    const std::string long_block(
+        "\xff\x1a\x30\x31\x32\x33\x34\x35\x36\x37\x38\x39\x61\x62\x63\x64\x65\x66\x67\x68\x69\x6a\x6b\x6c\x6d\x6e"
+        "\x6f\x70\x71\x72\x73\x74\x75\x76\x77\x78\x79\x7a\x41\x42\x43\x44\x7a\x01\x00\xff\x19\x0f\x54\x01\x15\xf0"
+        "\x05\x45\x46\x47\x48\x49\x4a\x4b\x4c\x4d\x4e\x4f\x50\x51\x52\x53\x54\x55\x56\x21\x21",
+        73);
+    EXPECT(decompress(payload(long_text.size(), long_block), &out));
+    EXPECT(out == bytes(long_text));
+}
+
+/// malformed payloads are refused without reading or writing out of bounds
+static void test_corrupt() {
+    std::string text;
+    for (int32_t i = 0; i < 200; ++i) {
+        text += "event " + std::to_string(i % 10) + ", ";
+    }
+    std::vector<uint8_t> data = bytes(text);
+    std::vector<uint8_t> compressed;
+    EXPECT(compress_payload(data.data(), data.size(), &compressed));
+    std::vector<uint8_t> out;
+
+    // every truncation
+    for (size_t length = 0; length < compressed.size(); ++length) {
+        EXPECT(!decompress_payload(compressed.data(), length, &out));
+    }
+    // a wrong original size
+    for (uint32_t size : {0u, static_cast<uint32_t>(data.size() - 1), static_cast<uint32_t>(data.size() + 1)}) {
+        std::vector<uint8_t> resized(compressed);
+        uint32_t network_size = htonl(size);
+        memcpy(resized.data(), &network_size, sizeof(network_size));
+        EXPECT(!decompress(resized, &out));
+    }
+    // a size no block of this length decompresses to is refused before anything is allocated
+    uint32_t size = 0;
+    std::vector<uint8_t> huge = payload(0xffffffffu, "\x00");
+    EXPECT(!decompressed_size(huge.data(), huge.size(), &size));
+    EXPECT(!decompress(huge, &out));
+    // so is a size larger than a frame, even if the block is long enough to decompress to it
+    huge = payload(MAX_FRAME_DATA_LENGTH + 1, std::string(MAX_FRAME_DATA_LENGTH / 255 + 1, '\0'));
+    EXPECT(!decompressed_size(huge.data(), huge.size(), &size));
+    EXPECT(!decompress(huge, &out));
+    EXPECT(!decompress(payload(4, ""), &out));
+
+    // a match before the start of the output, at offset 0, or past its end
+    EXPECT(!decompress(payload(8, std::string("\x10\x61\x02\x00\x30\x61\x61\x61", 8)), &out));
+    EXPECT(!decompress(payload(8, std::string("\x10\x61\x00\x00\x30\x61\x61\x61", 8)), &out));
+    EXPECT(!decompress(payload(8, std::string("\x1f\x61\x01\x00\x30\x61\x61\x61", 8)), &out));
+    // literals past the end of the block
+    EXPECT(!decompress(payload(8, std::string("\x80\x61\x61", 3)), &out));
+    // a block ending on a match
+    EXPECT(!decompress(payload(5, std::string("\x10\x61\x01\x00", 4)), &out));
+    // the valid form of the above
+    EXPECT(decompress(payload(8, std::string("\x10\x61\x01\x00\x30\x61\x61\x61", 8)), &out));
+    EXPECT(out == bytes("aaaaaaaa"));
+
+    // flipped bytes give either an error or a payload of the announced size
+    std::mt19937 random(2);
+    for (int32_t i = 0; i < 2000; ++i) {
+        std::vector<uint8_t> flipped(compressed);
+        flipped[sizeof(uint32_t) + random() % (flipped.size() - sizeof(uint32_t))] ^= 1 << (random() % 8);
+        if (decompress(flipped, &out)) {
+            EXPECT(out.size() == data.size());
+        }
+    }
+}
+
+int main() {
+    test_round_trip();
+    test_reference_blocks();
+    test_corrupt();
+    return unit_test_result();
+}
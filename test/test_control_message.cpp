@@ -0,0 +1,132 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <set>
+#include <string>
+
+#include "control_message.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+bool parse(ControlMessage *message, const std::string &encoded) {
+    return message->parse(reinterpret_cast<const uint8_t *>(encoded.data()), encoded.size());
+}
+
+/// one field in the TLV encoding
+std::string field(ControlTag tag, const std::string &value) {
+    std::string encoded(1, static_cast<char>(tag));
+    encoded += static_cast<char>(value.size() >> 8);
+    encoded += static_cast<char>(value.size() & 0xff);
+    return encoded + value;
+}
+
+const std::string header(1, static_cast<char>(ControlMessage::version));
+
+}  // namespace
+
+/// every kind of field comes back as it was set, through the encoding and through json
+static void test_round_trip() {
+    ControlMessage message;
+    message.set_string(CONTROL_TAG_TOPIC, "topic");
+    message.set_string(CONTROL_TAG_NAME, "");
+    message.set_uint(CONTROL_TAG_TYPE_ID, 0);
+    message.set_uint(CONTROL_TAG_PUBLISHER_PORT, 65535);
+    message.set_uint(CONTROL_TAG_TYPE_FINGERPRINT, UINT64_MAX);
+    message.set_bool(CONTROL_TAG_PUBLISHER_LOCAL, true);
+
+    ControlMessage parsed;
+    EXPECT(parse(&parsed, message.encoded()));
+    uint64_t wide = 1;
+    uint32_t narrow = 1;
+    bool flag = false;
+    EXPECT(parsed.get_string(CONTROL_TAG_TOPIC) == "topic");
+    EXPECT(parsed.contains(CONTROL_TAG_NAME) && parsed.get_string(CONTROL_TAG_NAME).empty());
+    EXPECT(parsed.get_uint(CONTROL_TAG_TYPE_ID, &wide) && wide == 0);
+    EXPECT(parsed.get_uint(CONTROL_TAG_PUBLISHER_PORT, &narrow) && narrow == 65535);
+    EXPECT(parsed.get_uint(CONTROL_TAG_TYPE_FINGERPRINT, &wide) && wide == UINT64_MAX);
+    // does not fit
+    EXPECT(!parsed.get_uint(CONTROL_TAG_TYPE_FINGERPRINT, &narrow));
+    EXPECT(parsed.get_bool(CONTROL_TAG_PUBLISHER_LOCAL, &flag) && flag);
+    EXPECT(!parsed.contains(CONTROL_TAG_METHOD));
+    EXPECT(!parsed.get_uint(CONTROL_TAG_METHOD, &wide));
+
+    ControlMessage from_json;
+    EXPECT(from_json.from_json(parsed.to_json()));
+    EXPECT(from_json.to_json() == parsed.to_json());
+    EXPECT(from_json.get_string(CONTROL_TAG_TOPIC) == "topic");
+
+    // a value longer than the length field is left out
+    ControlMessage long_value;
+    long_value.set_string(CONTROL_TAG_TOPIC, std::string(70000, 'x'));
+    EXPECT(!long_value.contains(CONTROL_TAG_TOPIC));
+}
+
+/// a message cut anywhere but between two fields is refused, and the previous content is kept
+static void test_truncated() {
+    ControlMessage message;
+    message.set_string(CONTROL_TAG_TOPIC, "topic");
+    message.set_uint(CONTROL_TAG_TYPE_ID, 300);
+    message.set_string(CONTROL_TAG_NAME, "name");
+    const std::string &encoded = message.encoded();
+    std::set<size_t> boundaries = {1, 1 + 3 + 5, 1 + 3 + 5 + 3 + 2, encoded.size()};
+
+    for (size_t size = 0; size <= encoded.size(); ++size) {
+        ControlMessage parsed;
+        parsed.set_string(CONTROL_TAG_RESPONSE, "previous");
+        bool valid = parse(&parsed, encoded.substr(0, size));
+        EXPECT(valid == (boundaries.count(size) > 0));
+        if (!valid) {
+            EXPECT(parsed.get_string(CONTROL_TAG_RESPONSE) == "previous");
+        }
+    }
+}
+
+/// wrong versions, lengths past the end and values of the wrong size
+static void test_malformed() {
+    ControlMessage message;
+    EXPECT(!message.parse(nullptr, 0));
+    EXPECT(!parse(&message, "{\"topic\":\"topic\"}"));
+    EXPECT(!parse(&message, std::string(1, static_cast<char>(ControlMessage::version + 1)) +
+                                field(CONTROL_TAG_TOPIC, "topic")));
+
+    // a length running past the end, by one byte or by the whole length field
+    std::string overlong = header + field(CONTROL_TAG_TOPIC, "topic");
+    overlong[3] = 6;
+    EXPECT(!parse(&message, overlong));
+    overlong[2] = static_cast<char>(0xff);
+    overlong[3] = static_cast<char>(0xff);
+    EXPECT(!parse(&message, overlong));
+    // trailing bytes too short for a field header
+    EXPECT(!parse(&message, header + field(CONTROL_TAG_TOPIC, "topic") + std::string(2, '\0')));
+
+    // integers of no byte or more than 8 bytes are not read
+    EXPECT(parse(&message, header + field(CONTROL_TAG_TYPE_ID, "") +
+                               field(CONTROL_TAG_PUBLISHER_PORT, std::string(9, '\x01')) +
+                               field(CONTROL_TAG_PUBLISHER_LOCAL, "")));
+    uint64_t wide = 0;
+    bool flag = false;
+    EXPECT(!message.get_uint(CONTROL_TAG_TYPE_ID, &wide));
+    EXPECT(!message.get_uint(CONTROL_TAG_PUBLISHER_PORT, &wide));
+    EXPECT(!message.get_bool(CONTROL_TAG_PUBLISHER_LOCAL, &flag));
+    // unknown tags are skipped over
+    EXPECT(parse(&message, header + field(static_cast<ControlTag>(200), "future") + field(CONTROL_TAG_TOPIC, "t")));
+    EXPECT(message.get_string(CONTROL_TAG_TOPIC) == "t");
+    EXPECT(message.to_json() == "{\"topic\":\"t\"}");
+
+    // json which is not an object of the expected types
+    ControlMessage from_json;
+    EXPECT(!from_json.from_json("{\"topic\":"));
+    EXPECT(!from_json.from_json("{\"type_id\":\"not a number\"}"));
+    EXPECT(!from_json.from_json("{\"topic\":42}"));
+    EXPECT(from_json.from_json("{\"unknown\":1}"));
+    EXPECT(from_json.to_json() == "{}");
+}
+
+int main() {
+    test_round_trip();
+    test_truncated();
+    test_malformed();
+    return unit_test_result();
+}
@@ -0,0 +1,120 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <atomic>
+#include <string>
+
+#include "test_fixture.hpp"
+#include "test_message.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+const int32_t event_count = 20;
+
+/// the subscriber of a topic, whose first callback blocks until released
+struct BlockedSubscriber {
+    std::atomic<int32_t> callbacks{0};
+    std::atomic<bool> released{false};
+
+    void operator()(const TestMessage1 &) {
+        if (callbacks.fetch_add(1) == 0) {
+            wait_until([this] { return released.load(); }, 60000);
+        }
+    }
+};
+
+/// a negative executor_threads keeps the default executor
+UBusRuntime *executor_participant(const std::string &name, bool shared_memory, int32_t executor_threads) {
+    return participant(name, [shared_memory, executor_threads](UBusRuntime *runtime) {
+        if (!shared_memory) {
+            runtime->configure_shared_memory(0, 0);
+        }
+        if (executor_threads >= 0) {
+            runtime->configure_event_executor(executor_threads, 4);
+        }
+    });
+}
+
+/// publishes event_count events while the first callback blocks, stats are taken before the release
+bool run(const std::string &topic, bool shared_memory, int32_t executor_threads, BlockedSubscriber *subscriber,
+         EventStats *stats) {
+    UBusRuntime *publisher = executor_participant(topic + "_pub", shared_memory, 0);
+    UBusRuntime *subscriber_runtime = executor_participant(topic + "_sub", shared_memory, executor_threads);
+    if (publisher == nullptr || subscriber_runtime == nullptr || !publisher->advertise_event<TestMessage1>(topic) ||
+        !subscriber_runtime->subscribe_event(
+            topic, std::function<void(const TestMessage1 &)>([subscriber](const TestMessage1 &event) {
+                (*subscriber)(event);
+            }))) {
+        return false;
+    }
+    // the publisher registered the subscriber before subscribe_event returned
+    for (int32_t i = 0; i < event_count; ++i) {
+        TestMessage1 event;
+        event.data = "event " + std::to_string(i);
+        publisher->publish_event(topic, event);
+    }
+    // every event is read, except behind a callback blocking the reading thread
+    EXPECT(wait_until([&] {
+        bool blocked = executor_threads == 0 && subscriber->callbacks.load() > 0;
+        subscriber_runtime->get_event_stats(topic, stats);
+        return stats->received == event_count || blocked;
+    }));
+    subscriber->released.store(true);
+    EXPECT(wait_until([&] {
+        EventStats after;
+        subscriber_runtime->get_event_stats(topic, &after);
+        return after.queue_depth == 0 && subscriber->callbacks.load() + after.queue_dropped >= event_count;
+    }));
+    return true;
+}
+
+}  // namespace
+
+/// the reading thread goes on while a callback blocks, events beyond the queue are counted as dropped
+static void test_executor(const std::string &topic, bool shared_memory) {
+    BlockedSubscriber subscriber;
+    EventStats stats;
+    EXPECT(run(topic, shared_memory, 1, &subscriber, &stats));
+    EXPECT(stats.received == event_count);
+    EXPECT(stats.queue_dropped > 0);
+    EXPECT(stats.queue_depth > 0 && stats.queue_depth <= 5);
+    EXPECT(subscriber.callbacks.load() + stats.queue_dropped == event_count);
+}
+
+/// by default the reading thread drains the socket or the ring while the callback blocks, and drops nothing
+static void test_default(const std::string &topic, bool shared_memory) {
+    BlockedSubscriber subscriber;
+    EventStats stats;
+    EXPECT(run(topic, shared_memory, -1, &subscriber, &stats));
+    EXPECT(stats.received == event_count);
+    // the event in the blocked callback is still counted
+    EXPECT(stats.queue_depth == event_count);
+    EXPECT(stats.queue_dropped == 0);
+    EXPECT(subscriber.callbacks.load() == event_count);
+}
+
+/// without threads the callback runs in the reading thread, which waits for it and drops nothing
+static void test_inline(const std::string &topic, bool shared_memory) {
+    BlockedSubscriber subscriber;
+    EventStats stats;
+    EXPECT(run(topic, shared_memory, 0, &subscriber, &stats));
+    EXPECT(stats.received == 1);
+    EXPECT(stats.queue_dropped == 0 && stats.queue_depth == 0);
+    EXPECT(subscriber.callbacks.load() == event_count);
+}
+
+int main() {
+    g_log_manager.SetLogLevel(3);
+    if (!start_master()) {
+        return 1;
+    }
+    test_executor("executor_socket", false);
+    test_executor("executor_shm", true);
+    test_default("default_socket", false);
+    test_default("default_shm", true);
+    test_inline("inline_socket", false);
+    test_inline("inline_shm", true);
+    return unit_test_result();
+}
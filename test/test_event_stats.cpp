@@ -0,0 +1,48 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <initializer_list>
+
+#include "stats.hpp"
+#include "unit_test.hpp"
+
+static EventStats received(std::initializer_list<uint64_t> sequences) {
+    EventStats stats;
+    for (uint64_t sequence : sequences) {
+        stats.update(sequence, 0, 0);
+    }
+    return stats;
+}
+
+/// gaps between sequence numbers count as dropped
+static void test_gaps() {
+    EventStats stats = received({1, 2, 3, 4});
+    EXPECT(stats.received == 4 && stats.dropped == 0 && stats.last_sequence == 4);
+    stats = received({5, 6, 9, 10, 200});
+    EXPECT(stats.received == 5 && stats.dropped == 191 && stats.last_sequence == 200);
+    // version 1 headers carry no sequence
+    stats = received({0, 0, 0});
+    EXPECT(stats.received == 3 && stats.dropped == 0 && stats.last_sequence == 0);
+}
+
+/// events of one transport overtaking those of another are not lost, and are counted once
+static void test_reordered() {
+    EventStats stats = received({1, 2, 5, 3, 4, 6});
+    EXPECT(stats.received == 6 && stats.dropped == 0 && stats.last_sequence == 6);
+    stats = received({1, 4, 3, 3, 4, 2, 2});
+    EXPECT(stats.received == 7 && stats.dropped == 0 && stats.last_sequence == 4);
+    stats = received({1, 4, 2});
+    EXPECT(stats.dropped == 1);
+    // the window reaches 64 events back
+    stats = received({1, 66, 2});
+    EXPECT(stats.dropped == 63);
+    stats = received({1, 100, 30});
+    EXPECT(stats.dropped == 98 && stats.last_sequence == 100);
+}
+
+int main() {
+    test_gaps();
+    test_reordered();
+    return unit_test_result();
+}
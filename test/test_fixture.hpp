@@ -0,0 +1,82 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "ubus_master.hpp"
+#include "ubus_runtime.hpp"
+
+/// A master and its participants within the process of a test, all of them run until the process exits.
+inline const std::string master_ip = "127.0.0.1";
+
+/// a port the system had free, so that tests running at the same time do not share a master
+inline uint32_t free_port() {
+    int32_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(0);
+    inet_pton(AF_INET, master_ip.c_str(), &addr.sin_addr);
+    uint32_t port = 0;
+    if (sock >= 0 && bind(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 &&
+        getsockname(sock, reinterpret_cast<sockaddr *>(&addr), &length) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+    return port;
+}
+
+inline uint32_t master_port() {
+    static uint32_t port = free_port();
+    return port;
+}
+
+inline bool start_master() {
+    UBusMaster *master = new UBusMaster();
+    if (master_port() == 0 || !master->init(master_ip, master_port())) {
+        fprintf(stderr, "failed to start the master\n");
+        return false;
+    }
+    std::thread(&UBusMaster::run, master).detach();
+    return true;
+}
+
+/// configure runs before init, nullptr if init fails
+inline UBusRuntime *participant(const std::string &name, std::function<void(UBusRuntime *)> configure = nullptr) {
+    UBusRuntime *runtime = new UBusRuntime();
+    if (configure) {
+        configure(runtime);
+    }
+    if (!runtime->init(name, master_ip, master_port())) {
+        return nullptr;
+    }
+    return runtime;
+}
+
+/// polls condition until it holds, false if it does not within timeout_ms
+inline bool wait_until(std::function<bool()> condition, int32_t timeout_ms = 2000) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        usleep(1000);
+    }
+    return true;
+}
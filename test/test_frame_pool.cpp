@@ -0,0 +1,91 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "frame_pool.hpp"
+#include "unit_test.hpp"
+
+/// a released block is the next one taken from its class, and lives as long as a copy refers to it
+static void test_reuse() {
+    FrameBuffer first(300);
+    EXPECT(first.size() == 300);
+    uint8_t *data = first.data();
+    memset(data, 'a', first.size());
+    // grows within the 512 byte class only
+    EXPECT(first.resize(512));
+    EXPECT(!first.resize(513));
+    EXPECT(first.size() == 512);
+
+    FrameBuffer copy(first);
+    first.reset();
+    EXPECT(first.empty());
+    EXPECT(copy.data() == data && copy.data()[0] == 'a');
+    FrameBuffer other(400);
+    EXPECT(other.data() != data);
+    other.reset();
+    copy.reset();
+    FrameBuffer reused(257);
+    EXPECT(reused.data() == data);
+    // blocks of another class are not mixed up
+    FrameBuffer small(10);
+    EXPECT(small.data() != data);
+}
+
+/// buffers above the largest class go to the global allocator and back
+static void test_oversize() {
+    size_t reserved = FramePool::reserved_bytes();
+    FrameBuffer large((FramePool::min_block_size << FramePool::class_count) + 1);
+    EXPECT(FramePool::reserved_bytes() > reserved + (FramePool::min_block_size << FramePool::class_count));
+    EXPECT(!large.resize(large.size() + 1));
+    large.reset();
+    EXPECT(FramePool::reserved_bytes() == reserved);
+}
+
+/// releasing many large blocks keeps no more than the caches allow for their class
+static void test_bounded() {
+    const size_t size = 1 << 20;
+    size_t reserved = FramePool::reserved_bytes();
+    std::vector<FrameBuffer> buffers;
+    for (int32_t i = 0; i < 100; ++i) {
+        buffers.emplace_back(size);
+    }
+    EXPECT(FramePool::reserved_bytes() >= reserved + 100 * size);
+    buffers.clear();
+    size_t kept = FramePool::thread_cache_bytes / size + FramePool::shared_cache_bytes / size;
+    EXPECT(FramePool::reserved_bytes() <= reserved + kept * (size + 64));
+}
+
+/// a thread_local buffer outliving the cache of its thread ends up in the shared list, and is reused from there
+static void test_thread_exit() {
+    const size_t size = 64 << 10;
+    uint8_t *data = nullptr;
+    std::thread exiting([&data, size]() {
+        // declared before the cache is first used, so destroyed after it
+        thread_local FrameBuffer holder;
+        holder = FrameBuffer(size);
+        data = holder.data();
+    });
+    exiting.join();
+    size_t reserved = FramePool::reserved_bytes();
+    uint8_t *reused = nullptr;
+    std::thread taking([&reused, size]() {
+        FrameBuffer buffer(size);
+        reused = buffer.data();
+    });
+    taking.join();
+    EXPECT(reused == data);
+    EXPECT(FramePool::reserved_bytes() == reserved);
+}
+
+int main() {
+    test_reuse();
+    test_oversize();
+    test_bounded();
+    test_thread_exit();
+    return unit_test_result();
+}
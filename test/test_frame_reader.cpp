@@ -0,0 +1,118 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "frame_reader.hpp"
+#include "unit_test.hpp"
+
+static std::vector<uint8_t> make_frame(uint8_t version, FrameType type, const std::string &data, uint64_t sequence) {
+    std::vector<uint8_t> frame(MAX_FRAME_HEADER_SIZE + data.size());
+    size_t header_size = encode_frame_header(version, type, static_cast<uint32_t>(data.size()), sequence, frame.data());
+    memcpy(frame.data() + header_size, data.data(), data.size());
+    frame.resize(header_size + data.size());
+    return frame;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t length) {
+    return writen(fd, data, length) == static_cast<ssize_t>(length);
+}
+
+/// every frame comes out once complete, however the stream is split
+static void test_partial_reads() {
+    int fds[2];
+    EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::string large(10000, 'x');
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> frame = make_frame(FRAME_VERSION_1, FRAME_EVENT, "first", 0);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+    frame = make_frame(FRAME_VERSION_2, FRAME_EVENT, large, 7);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+    frame = make_frame(FRAME_VERSION_2, FRAME_KEEP_ALIVE, "", 8);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+
+    FrameReader reader;
+    FrameHeader header;
+    FrameHeaderV2 extended;
+    const uint8_t *data = nullptr;
+    std::vector<std::string> frames;
+    std::vector<uint64_t> sequences;
+    // odd chunk sizes so that headers and data are split at every possible place
+    size_t offset = 0;
+    size_t chunk = 1;
+    while (offset < stream.size()) {
+        size_t size = std::min(chunk, stream.size() - offset);
+        EXPECT(write_all(fds[1], stream.data() + offset, size));
+        offset += size;
+        chunk = chunk * 3 % 1031 + 1;
+        EXPECT(reader.fill(fds[0]));
+        while (reader.next(&header, &data, &extended)) {
+            frames.emplace_back(reinterpret_cast<const char *>(data), header.data_length);
+            sequences.push_back(extended.sequence);
+        }
+    }
+    EXPECT(frames.size() == 3);
+    if (frames.size() == 3) {
+        EXPECT(frames[0] == "first");
+        EXPECT(frames[1] == large);
+        EXPECT(frames[2].empty());
+        EXPECT(sequences[1] == 7 && sequences[2] == 8);
+    }
+    EXPECT(!reader.failed());
+
+    // a closed peer still leaves the frames read before
+    frame = make_frame(FRAME_VERSION_2, FRAME_EVENT, "last", 9);
+    EXPECT(write_all(fds[1], frame.data(), frame.size()));
+    close(fds[1]);
+    EXPECT(!reader.fill(fds[0]));
+    EXPECT(reader.next(&header, &data, &extended));
+    EXPECT(std::string(reinterpret_cast<const char *>(data), header.data_length) == "last");
+    EXPECT(!reader.next(&header, &data, &extended));
+    close(fds[0]);
+}
+
+/// the reader neither allocates for nor resynchronizes after a frame above the limit
+static void test_oversized_frame() {
+    int fds[2];
+    EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    FrameReader reader(1024);
+    std::vector<uint8_t> frame = make_frame(FRAME_VERSION_2, FRAME_EVENT, std::string(1024, 'a'), 1);
+    EXPECT(write_all(fds[1], frame.data(), frame.size()));
+    uint8_t header[MAX_FRAME_HEADER_SIZE];
+    size_t header_size = encode_frame_header(FRAME_VERSION_2, FRAME_EVENT, 0xffffffffu, 2, header);
+    EXPECT(write_all(fds[1], header, header_size));
+    frame = make_frame(FRAME_VERSION_2, FRAME_EVENT, "after", 3);
+    EXPECT(write_all(fds[1], frame.data(), frame.size()));
+
+    FrameHeader frame_header;
+    const uint8_t *data = nullptr;
+    EXPECT(reader.fill(fds[0]));
+    EXPECT(reader.next(&frame_header, &data));
+    EXPECT(frame_header.data_length == 1024);
+    EXPECT(!reader.next(&frame_header, &data));
+    EXPECT(reader.failed());
+    EXPECT(!reader.next(&frame_header, &data));
+    EXPECT(!reader.fill(fds[0]));
+
+    // same for a version 1 header
+    FrameReader v1_reader(1024);
+    header_size = encode_frame_header(FRAME_VERSION_1, FRAME_EVENT, 1025, 0, header);
+    EXPECT(write_all(fds[1], header, header_size));
+    EXPECT(v1_reader.fill(fds[0]));
+    EXPECT(!v1_reader.next(&frame_header, &data));
+    EXPECT(v1_reader.failed());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main() {
+    test_partial_reads();
+    test_oversized_frame();
+    return unit_test_result();
+}
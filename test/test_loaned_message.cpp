@@ -0,0 +1,75 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <atomic>
+#include <string>
+
+#include "test_fixture.hpp"
+#include "test_message.hpp"
+#include "unit_test.hpp"
+
+static UBusRuntime *loan_participant(const std::string &name, bool shared_memory) {
+    return participant(name, [shared_memory](UBusRuntime *runtime) {
+        if (!shared_memory) {
+            runtime->configure_shared_memory(0, 0);
+        }
+    });
+}
+
+/// a plain struct constructed in the loaned buffer reaches the subscriber as it was filled in
+static void test_loan(const std::string &topic, bool shared_memory) {
+    UBusRuntime *publisher = loan_participant(topic + "_pub", shared_memory);
+    UBusRuntime *subscriber = loan_participant(topic + "_sub", shared_memory);
+    std::atomic<int32_t> received{0};
+    std::atomic<uint32_t> last{0};
+    EXPECT(publisher != nullptr && subscriber != nullptr);
+    if (publisher == nullptr || subscriber == nullptr) {
+        return;
+    }
+    EXPECT(publisher->advertise_event<TimestampMessage>(topic));
+    EXPECT(subscriber->subscribe_event(topic, std::function<void(const TimestampMessage &)>(
+                                                  [&received, &last](const TimestampMessage &event) {
+                                                      last.store(event.h * 1000u + event.ms);
+                                                      received.fetch_add(1);
+                                                  })));
+
+    auto message = publisher->loan<TimestampMessage>(topic);
+    EXPECT(message.valid());
+    EXPECT(message.in_shared_memory() == shared_memory);
+    // value initialized, whatever the slot held before
+    EXPECT(message->h == 0 && message->m == 0 && message->s == 0 && message->ms == 0);
+    message->h = 12;
+    message.get()->ms = 345;
+    EXPECT(publisher->publish(std::move(message)));
+    EXPECT(!message.valid());
+
+    // the loan is given back when dropped, the next one gets the slot again
+    {
+        auto dropped = publisher->loan<TimestampMessage>(topic);
+        EXPECT(dropped.valid());
+    }
+    auto moved = publisher->loan<TimestampMessage>(topic);
+    EXPECT(moved.in_shared_memory() == shared_memory);
+    LoanedMessage<TimestampMessage> second(std::move(moved));
+    EXPECT(!moved.valid() && second.valid());
+    second->h = 1;
+    EXPECT(publisher->publish(std::move(second)));
+
+    EXPECT(wait_until([&received] { return received.load() == 2; }));
+    EXPECT(last.load() == 1000);
+
+    // other types and topics get no loan
+    EXPECT(!publisher->loan<TimestampMessage>(topic + "_unknown").valid());
+    EXPECT(!publisher->loan<TestMessage1>(topic, 8).valid());
+}
+
+int main() {
+    g_log_manager.SetLogLevel(3);
+    if (!start_master()) {
+        return 1;
+    }
+    test_loan("loan_socket", false);
+    test_loan("loan_shm", true);
+    return unit_test_result();
+}
@@ -0,0 +1,117 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "test_fixture.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+const int32_t call_count = 6;
+// the provider answers request i after delay_steps[i] steps, neither in the order of the calls nor in reverse
+const uint32_t delay_steps[call_count] = {3, 0, 5, 1, 4, 2};
+const uint32_t delay_step_us = 40000;
+
+int32_t expected_response(int32_t request) { return request * 10 + 1; }
+
+/// requests the provider finished, in the order it answered them
+struct Answered {
+    std::mutex mtx;
+    std::vector<int32_t> requests;
+};
+
+}  // namespace
+
+/// calls in flight over the connection to one provider get their own response whatever order they come back in
+static void test_out_of_order(UBusRuntime *caller, const std::string &method, Answered *answered) {
+    std::vector<Int32Msg> requests(call_count);
+    std::vector<Int32Msg> responses(call_count);
+    std::vector<std::future<bool>> results;
+    for (int32_t i = 0; i < call_count; ++i) {
+        requests[i].data = i;
+        responses[i].data = -1;
+        results.push_back(caller->call_method_async(method, requests[i], &responses[i]));
+    }
+    for (int32_t i = 0; i < call_count; ++i) {
+        EXPECT(results[i].wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+        EXPECT(results[i].get());
+        EXPECT(responses[i].data == expected_response(i));
+    }
+    std::lock_guard<std::mutex> lock(answered->mtx);
+    EXPECT(answered->requests.size() == static_cast<size_t>(call_count));
+    if (answered->requests.size() == static_cast<size_t>(call_count)) {
+        EXPECT(answered->requests.front() == 1);
+        EXPECT(answered->requests.back() == 2);
+    }
+    answered->requests.clear();
+}
+
+/// same with callbacks, mixed with a blocking call on the same connection
+static void test_callbacks(UBusRuntime *caller, const std::string &method) {
+    std::mutex mtx;
+    std::vector<int32_t> responses(call_count, -1);
+    int32_t completed = 0;
+    for (int32_t i = 0; i < call_count; ++i) {
+        Int32Msg request;
+        request.data = i;
+        caller->call_method_async(method, request,
+                                  std::function<void(bool, const Int32Msg &)>(
+                                      [i, &mtx, &responses, &completed](bool ok, const Int32Msg &response) {
+                                          std::lock_guard<std::mutex> lock(mtx);
+                                          responses[i] = ok ? response.data : -2;
+                                          ++completed;
+                                      }));
+    }
+    Int32Msg request;
+    Int32Msg response;
+    request.data = call_count - 1;
+    EXPECT(caller->call_method(method, request, &response));
+    EXPECT(response.data == expected_response(call_count - 1));
+
+    EXPECT(wait_until([&] {
+        std::lock_guard<std::mutex> lock(mtx);
+        return completed == call_count;
+    }, 5000));
+    std::lock_guard<std::mutex> lock(mtx);
+    for (int32_t i = 0; i < call_count; ++i) {
+        EXPECT(responses[i] == expected_response(i));
+    }
+}
+
+int main() {
+    g_log_manager.SetLogLevel(3);
+    if (!start_master()) {
+        return 1;
+    }
+    const std::string method = "multiplexing_delayed";
+    Answered answered;
+    // one thread per call, so that none waits for another to finish
+    UBusRuntime *provider = participant("multiplexing_provider", [](UBusRuntime *runtime) {
+        runtime->configure_method_executor(call_count + 1);
+    });
+    UBusRuntime *caller = participant("multiplexing_caller");
+    EXPECT(provider != nullptr && caller != nullptr);
+    if (provider == nullptr || caller == nullptr) {
+        return unit_test_result();
+    }
+    auto delayed_echo = [&answered](const Int32Msg &request, Int32Msg *response) {
+        usleep(delay_steps[request.data % call_count] * delay_step_us);
+        response->data = expected_response(request.data);
+        std::lock_guard<std::mutex> lock(answered.mtx);
+        answered.requests.push_back(request.data);
+    };
+    bool provided = provider->provide_method<Int32Msg, Int32Msg>(
+        method, std::function<void(const Int32Msg &, Int32Msg *)>(delayed_echo));
+    EXPECT(provided);
+    test_out_of_order(caller, method, &answered);
+    test_callbacks(caller, method);
+    return unit_test_result();
+}
@@ -0,0 +1,214 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <string>
+
+#include "multicast.hpp"
+#include "method_frame.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+// the master hands out groups from 239.255.0.1, the test stays clear of them
+const std::string test_group = "239.254.0.1";
+const std::string test_topic = "test_multicast";
+const uint32_t multicast_magic = 0x55424d43;
+
+uint32_t test_port() { return 40000 + getpid() % 20000; }
+
+/// Sends hand made fragments to the group, in any order
+class FragmentWriter {
+ public:
+    FragmentWriter() {
+        socket_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        in_addr interface_address;
+        inet_pton(AF_INET, "127.0.0.1", &interface_address);
+        setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_IF, &interface_address, sizeof(interface_address));
+        uint8_t loop = 1;
+        setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        group_address_.sin_family = AF_INET;
+        group_address_.sin_port = htons(static_cast<uint16_t>(test_port()));
+        inet_pton(AF_INET, test_group.c_str(), &group_address_.sin_addr);
+    }
+    ~FragmentWriter() { close(socket_); }
+
+    /// fragment index of message, split in fragment_count pieces of fragment_size bytes
+    void send(uint64_t sequence,
+              const std::string &message,
+              uint16_t index,
+              uint16_t fragment_count,
+              size_t fragment_size,
+              const std::string &topic = test_topic) {
+        MulticastFragmentHeader header;
+        header.magic = htonl(multicast_magic);
+        header.topic_hash = htonl(method_name_hash(topic));
+        header.sequence = htobe64(sequence);
+        header.timestamp = htobe64(sequence * 1000);
+        header.total_length = htonl(static_cast<uint32_t>(message.size()));
+        header.offset = htonl(static_cast<uint32_t>(index * fragment_size));
+        header.fragment_index = htons(index);
+        header.fragment_count = htons(fragment_count);
+        std::string datagram(reinterpret_cast<const char *>(&header), sizeof(header));
+        datagram += message.substr(index * fragment_size, fragment_size);
+        send_datagram(datagram);
+    }
+
+    void send_datagram(const std::string &datagram) {
+        sendto(socket_, datagram.data(), datagram.size(), 0, reinterpret_cast<sockaddr *>(&group_address_),
+               sizeof(group_address_));
+    }
+
+ private:
+    int32_t socket_ = -1;
+    sockaddr_in group_address_ = {};
+};
+
+/// next complete message, "<none>" if nothing is complete within a second
+std::string receive(MulticastReceiver *receiver, uint64_t *sequence = nullptr) {
+    for (int32_t i = 0; i < 100; ++i) {
+        uint64_t message_sequence = 0;
+        uint64_t timestamp = 0;
+        std::string_view message;
+        if (receiver->receive(&message_sequence, &timestamp, &message) == 1) {
+            if (sequence != nullptr) {
+                *sequence = message_sequence;
+            }
+            return std::string(message);
+        }
+        pollfd fd = {receiver->socket(), POLLIN, 0};
+        poll(&fd, 1, 10);
+    }
+    return "<none>";
+}
+
+}  // namespace
+
+/// a message split by MulticastSender comes out whole
+static void test_round_trip(MulticastReceiver *receiver) {
+    MulticastSender sender;
+    EXPECT(sender.open(test_topic, test_group, test_port(), "127.0.0.1", sizeof(MulticastFragmentHeader) + 16));
+    std::string message;
+    for (int32_t i = 0; i < 100; ++i) {
+        message += static_cast<char>('a' + i % 26);
+    }
+    EXPECT(sender.send(1, 1000, reinterpret_cast<const uint8_t *>(message.data()), message.size()));
+    uint64_t sequence = 0;
+    EXPECT(receive(receiver, &sequence) == message);
+    EXPECT(sequence == 1);
+    EXPECT(sender.send(2, 2000, nullptr, 0));
+    EXPECT(receive(receiver, &sequence).empty());
+    EXPECT(sequence == 2);
+}
+
+/// fragments are put in place by their offset, whatever order they arrive in
+static void test_out_of_order(MulticastReceiver *receiver) {
+    FragmentWriter writer;
+    std::string message = "0123456789abcdefghijklmnopqrstuvwxyz";
+    writer.send(10, message, 3, 4, 10);
+    writer.send(10, message, 1, 4, 10);
+    // duplicates are dropped
+    writer.send(10, message, 1, 4, 10);
+    writer.send(10, message, 0, 4, 10);
+    writer.send(10, message, 2, 4, 10);
+    uint64_t sequence = 0;
+    EXPECT(receive(receiver, &sequence) == message);
+    EXPECT(sequence == 10);
+    // fragments of a delivered message do not start it again
+    writer.send(10, message, 0, 4, 10);
+    writer.send(10, message, 1, 4, 10);
+    writer.send(10, message, 2, 4, 10);
+    writer.send(10, message, 3, 4, 10);
+    writer.send(11, "marker", 0, 1, 10);
+    EXPECT(receive(receiver, &sequence) == "marker");
+    EXPECT(sequence == 11);
+}
+
+/// a message missing a fragment is given up once a newer one arrives
+static void test_missing_fragment(MulticastReceiver *receiver) {
+    FragmentWriter writer;
+    std::string lost = "this message loses its tail";
+    std::string next = "the next one is complete";
+    uint64_t incomplete = receiver->incomplete_count();
+    writer.send(20, lost, 0, 3, 10);
+    writer.send(20, lost, 1, 3, 10);
+    writer.send(21, next, 1, 3, 10);
+    writer.send(21, next, 0, 3, 10);
+    // the late fragment of the lost message is ignored
+    writer.send(20, lost, 2, 3, 10);
+    writer.send(21, next, 2, 3, 10);
+    uint64_t sequence = 0;
+    EXPECT(receive(receiver, &sequence) == next);
+    EXPECT(sequence == 21);
+    EXPECT(receiver->incomplete_count() == incomplete + 1);
+
+    // neither fragments of another topic nor malformed ones end up in a message
+    writer.send(22, "other topic", 0, 1, 20, "another_topic");
+    MulticastFragmentHeader header;
+    header.magic = htonl(multicast_magic);
+    header.topic_hash = htonl(method_name_hash(test_topic));
+    header.sequence = htobe64(23);
+    header.total_length = htonl(4);
+    header.offset = htonl(2);
+    header.fragment_index = htons(0);
+    header.fragment_count = htons(1);
+    std::string overflowing(reinterpret_cast<const char *>(&header), sizeof(header));
+    overflowing += "1234";
+    writer.send_datagram(overflowing);
+    writer.send_datagram("short");
+    writer.send(24, "marker", 0, 1, 10);
+    EXPECT(receive(receiver, &sequence) == "marker");
+    EXPECT(sequence == 24);
+}
+
+/// a length the fragments could not carry, or larger than any frame, is refused before anything is allocated
+static void test_oversized_length(MulticastReceiver *receiver) {
+    FragmentWriter writer;
+    uint64_t incomplete = receiver->incomplete_count();
+    MulticastFragmentHeader header;
+    header.magic = htonl(multicast_magic);
+    header.topic_hash = htonl(method_name_hash(test_topic));
+    header.sequence = htobe64(30);
+    header.total_length = htonl(UINT32_MAX);
+    header.offset = htonl(0);
+    header.fragment_index = htons(0);
+    header.fragment_count = htons(UINT16_MAX);
+    std::string oversized(reinterpret_cast<const char *>(&header), sizeof(header));
+    oversized += "1234";
+    writer.send_datagram(oversized);
+    // two fragments hold much less than 64 KiB
+    header.sequence = htobe64(31);
+    header.total_length = htonl(1 << 20);
+    header.fragment_count = htons(2);
+    oversized.replace(0, sizeof(header), reinterpret_cast<const char *>(&header), sizeof(header));
+    writer.send_datagram(oversized);
+    std::string message = "0123456789abcdefghij";
+    writer.send(32, message, 0, 2, 10);
+    writer.send(32, message, 1, 2, 10);
+    uint64_t sequence = 0;
+    EXPECT(receive(receiver, &sequence) == message);
+    EXPECT(sequence == 32);
+    // neither started a message that the next one would give up
+    EXPECT(receiver->incomplete_count() == incomplete);
+}
+
+int main() {
+    MulticastReceiver receiver;
+    if (!receiver.open(test_topic, test_group, test_port(), "127.0.0.1")) {
+        fprintf(stderr, "multicast is not available, skipped\n");
+        // SKIP_RETURN_CODE of the test
+        return 77;
+    }
+    test_round_trip(&receiver);
+    test_out_of_order(&receiver);
+    test_missing_fragment(&receiver);
+    test_oversized_length(&receiver);
+    return unit_test_result();
+}
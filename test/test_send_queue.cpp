@@ -0,0 +1,232 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "test_fixture.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+/// the send queues of a runtime, without a master
+class SendQueueRuntime : public UBusRuntime {
+ public:
+    using UBusRuntime::enqueue_frame;
+    using UBusRuntime::SendQueue;
+    using UBusRuntime::start_publish_worker;
+};
+
+/// publish_worker_ runs until the process exits
+SendQueueRuntime *runtime() {
+    static SendQueueRuntime *runtime = nullptr;
+    if (runtime == nullptr) {
+        runtime = new SendQueueRuntime();
+        EXPECT(runtime->start_publish_worker());
+    }
+    return runtime;
+}
+
+/// size and id of the frame, then the low byte of the id up to size
+FrameBuffer make_frame(uint32_t id, uint32_t size = 1024) {
+    FrameBuffer frame(size);
+    memcpy(frame.data(), &size, sizeof(size));
+    memcpy(frame.data() + sizeof(size), &id, sizeof(id));
+    memset(frame.data() + 2 * sizeof(uint32_t), id & 0xff, size - 2 * sizeof(uint32_t));
+    return frame;
+}
+
+struct SocketPair {
+    int32_t publisher = -1;
+    int32_t subscriber = -1;
+    // bytes written to fill the socket before the queue is used
+    size_t filled = 0;
+
+    SocketPair() {
+        int32_t fds[2];
+        EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        publisher = fds[0];
+        subscriber = fds[1];
+        timeval timeout = {2, 0};
+        setsockopt(subscriber, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    ~SocketPair() {
+        close(publisher);
+        close(subscriber);
+    }
+
+    /// writes until the socket takes no more, nothing the queue sends goes through meanwhile
+    void fill() {
+        std::vector<uint8_t> chunk(4096, 0);
+        while (1) {
+            ssize_t ret = send(publisher, chunk.data(), chunk.size(), MSG_DONTWAIT);
+            if (ret <= 0) {
+                break;
+            }
+            filled += ret;
+        }
+    }
+
+    bool read_exact(void *data, size_t size) {
+        uint8_t *bytes = static_cast<uint8_t *>(data);
+        while (size > 0) {
+            ssize_t ret = recv(subscriber, bytes, size, 0);
+            if (ret <= 0) {
+                return false;
+            }
+            bytes += ret;
+            size -= ret;
+        }
+        return true;
+    }
+
+    bool drain_filled() {
+        std::vector<uint8_t> chunk(filled);
+        bool ok = read_exact(chunk.data(), chunk.size());
+        filled = 0;
+        return ok;
+    }
+
+    /// id of the next frame, -1 if it is missing or damaged
+    int64_t read_frame() {
+        uint32_t size, id;
+        if (!read_exact(&size, sizeof(size)) || !read_exact(&id, sizeof(id)) || size < 2 * sizeof(uint32_t)) {
+            return -1;
+        }
+        std::vector<uint8_t> payload(size - 2 * sizeof(uint32_t));
+        if (!read_exact(payload.data(), payload.size())) {
+            return -1;
+        }
+        for (uint8_t byte : payload) {
+            if (byte != (id & 0xff)) {
+                return -1;
+            }
+        }
+        return id;
+    }
+
+    /// nothing more arrives within timeout_ms
+    bool idle(int32_t timeout_ms = 100) {
+        pollfd fd = {subscriber, POLLIN, 0};
+        return poll(&fd, 1, timeout_ms) == 0;
+    }
+};
+
+std::shared_ptr<SendQueueRuntime::SendQueue> make_queue(const SocketPair &sockets, uint32_t depth,
+                                                        OverflowPolicy policy) {
+    auto queue = std::make_shared<SendQueueRuntime::SendQueue>();
+    queue->socket = sockets.publisher;
+    queue->depth = depth;
+    queue->overflow_policy = policy;
+    return queue;
+}
+
+bool waiting_writable(const std::shared_ptr<SendQueueRuntime::SendQueue> &queue) {
+    std::lock_guard<std::mutex> lock(queue->mtx);
+    return queue->waiting_writable;
+}
+
+bool drained(const std::shared_ptr<SendQueueRuntime::SendQueue> &queue) {
+    std::lock_guard<std::mutex> lock(queue->mtx);
+    return queue->frames.empty() && !queue->waiting_writable;
+}
+
+/// a full socket hands the queue over to EPOLLOUT, frames beyond depth are dropped by policy
+void test_overflow(OverflowPolicy policy, const std::vector<int64_t> &expected) {
+    SocketPair sockets;
+    sockets.fill();
+    auto queue = make_queue(sockets, 4, policy);
+    for (uint32_t id = 0; id < 10; ++id) {
+        EXPECT(runtime()->enqueue_frame(queue, make_frame(id)));
+    }
+    EXPECT(wait_until([&] { return waiting_writable(queue); }));
+    {
+        std::lock_guard<std::mutex> lock(queue->mtx);
+        EXPECT(queue->dropped == 6);
+        EXPECT(queue->frames.size() == 4);
+    }
+
+    EXPECT(sockets.drain_filled());
+    for (int64_t id : expected) {
+        EXPECT(sockets.read_frame() == id);
+    }
+    EXPECT(sockets.idle());
+    EXPECT(wait_until([&] { return drained(queue); }));
+}
+
+/// the frame being written when the queue overflows is finished, the oldest frame after it is dropped
+void test_drop_oldest_partial() {
+    SocketPair sockets;
+    auto queue = make_queue(sockets, 4, OVERFLOW_DROP_OLDEST);
+    const uint32_t large_size = 4 << 20;
+    EXPECT(runtime()->enqueue_frame(queue, make_frame(0, large_size)));
+    EXPECT(wait_until([&] { return waiting_writable(queue); }));
+    {
+        std::lock_guard<std::mutex> lock(queue->mtx);
+        EXPECT(queue->offset > 0 && queue->offset < large_size);
+    }
+    for (uint32_t id = 1; id < 7; ++id) {
+        EXPECT(runtime()->enqueue_frame(queue, make_frame(id)));
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue->mtx);
+        EXPECT(queue->dropped == 3);
+    }
+
+    EXPECT(sockets.read_frame() == 0);
+    EXPECT(sockets.read_frame() == 4);
+    EXPECT(sockets.read_frame() == 5);
+    EXPECT(sockets.read_frame() == 6);
+    EXPECT(sockets.idle());
+    EXPECT(wait_until([&] { return drained(queue); }));
+}
+
+/// the publisher waits for room in the queue, and goes on once the subscriber reads again
+void test_block() {
+    SocketPair sockets;
+    sockets.fill();
+    auto queue = make_queue(sockets, 2, OVERFLOW_BLOCK);
+    EXPECT(runtime()->enqueue_frame(queue, make_frame(0)));
+    EXPECT(runtime()->enqueue_frame(queue, make_frame(1)));
+    std::atomic<int32_t> enqueued{0};
+    std::thread publisher([&] {
+        for (uint32_t id = 2; id < 6; ++id) {
+            EXPECT(runtime()->enqueue_frame(queue, make_frame(id)));
+            ++enqueued;
+        }
+    });
+    EXPECT(wait_until([&] { return waiting_writable(queue); }));
+    // nothing to poll for, the publisher has to be still waiting a while later
+    usleep(100000);
+    EXPECT(enqueued.load() == 0);
+
+    EXPECT(sockets.drain_filled());
+    for (int64_t id = 0; id < 6; ++id) {
+        EXPECT(sockets.read_frame() == id);
+    }
+    publisher.join();
+    EXPECT(enqueued.load() == 4);
+    EXPECT(sockets.idle());
+    EXPECT(wait_until([&] { return drained(queue); }));
+    std::lock_guard<std::mutex> lock(queue->mtx);
+    EXPECT(queue->dropped == 0);
+}
+
+}  // namespace
+
+int main() {
+    test_overflow(OVERFLOW_DROP_NEWEST, {0, 1, 2, 3});
+    test_overflow(OVERFLOW_DROP_OLDEST, {6, 7, 8, 9});
+    test_drop_oldest_partial();
+    test_block();
+    return unit_test_result();
+}
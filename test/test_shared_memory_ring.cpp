@@ -0,0 +1,159 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <string>
+
+#include "shared_memory.hpp"
+#include "unit_test.hpp"
+
+static std::string ring_name(const std::string &topic) {
+    return SharedMemoryRing::make_name("test_" + std::to_string(getpid()), topic);
+}
+
+static bool write_string(SharedMemoryRing *ring, const std::string &message) {
+    return ring->write(message.data(), message.size());
+}
+
+static std::string read_string(SharedMemoryRing *ring) {
+    std::string message;
+    return ring->read(&message, 0) == 1 ? message : "<none>";
+}
+
+/// slots are reused in order once the sequence passes slot_count
+static void test_wraparound() {
+    SharedMemoryRing producer;
+    EXPECT(producer.create(ring_name("wrap"), 4, 64));
+    SharedMemoryRing consumer;
+    EXPECT(consumer.open(ring_name("wrap")));
+    EXPECT(read_string(&consumer) == "<none>");
+    for (int32_t i = 0; i < 11; ++i) {
+        EXPECT(write_string(&producer, "message " + std::to_string(i)));
+        EXPECT(read_string(&consumer) == "message " + std::to_string(i));
+    }
+    // a full ring read at once
+    for (int32_t i = 0; i < 4; ++i) {
+        EXPECT(write_string(&producer, "batch " + std::to_string(i)));
+    }
+    for (int32_t i = 0; i < 4; ++i) {
+        EXPECT(read_string(&consumer) == "batch " + std::to_string(i));
+    }
+    EXPECT(read_string(&consumer) == "<none>");
+    EXPECT(consumer.overrun_count() == 0);
+
+    // a late consumer starts with the next message
+    SharedMemoryRing late;
+    EXPECT(late.open(ring_name("wrap")));
+    EXPECT(read_string(&late) == "<none>");
+    EXPECT(write_string(&producer, "after open"));
+    EXPECT(read_string(&late) == "after open");
+    EXPECT(read_string(&consumer) == "after open");
+}
+
+/// a consumer falling behind by more than the ring loses the oldest messages and counts them
+static void test_overrun() {
+    SharedMemoryRing producer;
+    EXPECT(producer.create(ring_name("overrun"), 4, 64));
+    SharedMemoryRing slow;
+    EXPECT(slow.open(ring_name("overrun")));
+    SharedMemoryRing fast;
+    EXPECT(fast.open(ring_name("overrun")));
+    for (int32_t i = 0; i < 10; ++i) {
+        EXPECT(write_string(&producer, "message " + std::to_string(i)));
+        EXPECT(read_string(&fast) == "message " + std::to_string(i));
+    }
+    for (int32_t i = 6; i < 10; ++i) {
+        EXPECT(read_string(&slow) == "message " + std::to_string(i));
+    }
+    EXPECT(read_string(&slow) == "<none>");
+    EXPECT(slow.overrun_count() == 6);
+    EXPECT(fast.overrun_count() == 0);
+}
+
+/// in place writes, and the limits of a slot
+static void test_reserve() {
+    SharedMemoryRing producer;
+    EXPECT(producer.create(ring_name("reserve"), 2, 16));
+    SharedMemoryRing consumer;
+    EXPECT(consumer.open(ring_name("reserve")));
+    EXPECT(producer.slot_size() == 16);
+    EXPECT(!write_string(&producer, std::string(17, 'x')));
+    EXPECT(write_string(&producer, std::string(16, 'x')));
+    EXPECT(read_string(&consumer) == std::string(16, 'x'));
+
+    uint8_t *slot = producer.reserve(8);
+    EXPECT(slot != nullptr);
+    if (slot != nullptr) {
+        memcpy(slot, "loaned", 6);
+    }
+    // nothing else goes into the ring meanwhile, and nothing is visible before the commit
+    EXPECT(producer.reserve(8) == nullptr);
+    EXPECT(!write_string(&producer, "other"));
+    EXPECT(read_string(&consumer) == "<none>");
+    EXPECT(!producer.commit(9));
+    EXPECT(producer.commit(6, 42, 1000));
+    std::string message;
+    uint64_t event_sequence = 0;
+    uint64_t event_timestamp = 0;
+    EXPECT(consumer.read(&message, 0, &event_sequence, &event_timestamp) == 1);
+    EXPECT(message == "loaned" && event_sequence == 42 && event_timestamp == 1000);
+    EXPECT(producer.write("written", 7, 43, 2000));
+    EXPECT(consumer.read(&message, 0, &event_sequence, &event_timestamp) == 1);
+    EXPECT(message == "written" && event_sequence == 43 && event_timestamp == 2000);
+
+    EXPECT(producer.reserve(8) != nullptr);
+    producer.abort();
+    EXPECT(!producer.commit(1));
+    EXPECT(write_string(&producer, "after abort"));
+    EXPECT(read_string(&consumer) == "after abort");
+
+    // consumers do not write
+    EXPECT(!write_string(&consumer, "consumer"));
+    SharedMemoryRing missing;
+    EXPECT(!missing.open(ring_name("missing")));
+}
+
+/// overwrites one of the leading uint32 fields of the ring header: magic, slot_count, slot_size, slot_stride
+static void patch_header(const std::string &name, size_t field, uint32_t value) {
+    int32_t fd = shm_open(name.c_str(), O_RDWR, 0600);
+    EXPECT(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    void *base = mmap(nullptr, 4 * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    EXPECT(base != MAP_FAILED);
+    if (base != MAP_FAILED) {
+        static_cast<uint32_t *>(base)[field] = value;
+        munmap(base, 4 * sizeof(uint32_t));
+    }
+}
+
+/// a consumer refuses a header whose geometry does not describe usable slots
+static void test_invalid_layout() {
+    SharedMemoryRing producer;
+    EXPECT(producer.create(ring_name("layout"), 4, 64));
+    patch_header(ring_name("layout"), 1, 0);
+    SharedMemoryRing no_slots;
+    EXPECT(!no_slots.open(ring_name("layout")));
+    patch_header(ring_name("layout"), 1, 4);
+    patch_header(ring_name("layout"), 2, 4096);
+    SharedMemoryRing short_stride;
+    EXPECT(!short_stride.open(ring_name("layout")));
+    patch_header(ring_name("layout"), 2, 64);
+    SharedMemoryRing restored;
+    EXPECT(restored.open(ring_name("layout")));
+}
+
+int main() {
+    test_wraparound();
+    test_overrun();
+    test_reserve();
+    test_invalid_layout();
+    return unit_test_result();
+}
@@ -0,0 +1,86 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#include <memory>
+#include <thread>
+
+#include "spsc_queue.hpp"
+#include "unit_test.hpp"
+
+/// a full queue refuses values, and gives them back in order across the wraparound
+static void test_bounds() {
+    SpscQueue<int32_t> queue(5);
+    EXPECT(queue.capacity() == 8);
+    int32_t value = 0;
+    EXPECT(!queue.pop(&value));
+    int32_t next_push = 0;
+    int32_t next_pop = 0;
+    for (int32_t round = 0; round < 10; ++round) {
+        int32_t pushed = next_push;
+        while (queue.push(int32_t(next_push))) {
+            ++next_push;
+        }
+        EXPECT(next_push - pushed == static_cast<int32_t>(queue.capacity()) - round % 3);
+        EXPECT(queue.size() == queue.capacity());
+        // leaves a few behind so that the next round starts at another slot
+        while (static_cast<int32_t>(queue.size()) > (round + 1) % 3) {
+            EXPECT(queue.pop(&value));
+            EXPECT(value == next_pop++);
+        }
+    }
+}
+
+/// a popped slot does not hold on to its value
+static void test_move_only() {
+    SpscQueue<std::unique_ptr<int32_t>> queue(2);
+    std::unique_ptr<int32_t> value(new int32_t(7));
+    EXPECT(queue.push(std::move(value)));
+    EXPECT(value == nullptr);
+    EXPECT(queue.push(std::unique_ptr<int32_t>(new int32_t(8))));
+    std::unique_ptr<int32_t> refused(new int32_t(9));
+    EXPECT(!queue.push(std::move(refused)));
+    EXPECT(refused != nullptr && *refused == 9);
+
+    SpscQueue<std::shared_ptr<int32_t>> shared_queue(1);
+    std::shared_ptr<int32_t> shared = std::make_shared<int32_t>(1);
+    std::weak_ptr<int32_t> watched = shared;
+    EXPECT(shared_queue.push(std::move(shared)));
+    EXPECT(shared_queue.pop(&shared));
+    shared.reset();
+    EXPECT(watched.expired());
+}
+
+/// one producer and one consumer thread see every value once and in order
+static void test_threads() {
+    const uint64_t count = 1000000;
+    SpscQueue<uint64_t> queue(64);
+    std::thread producer([&queue, count]() {
+        for (uint64_t i = 1; i <= count; ++i) {
+            while (!queue.push(uint64_t(i))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint64_t expected = 1;
+    bool ordered = true;
+    while (expected <= count) {
+        uint64_t value;
+        if (!queue.pop(&value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        ordered = ordered && value == expected;
+        ++expected;
+    }
+    producer.join();
+    EXPECT(ordered);
+    EXPECT(queue.size() == 0);
+}
+
+int main() {
+    test_bounds();
+    test_move_only();
+    test_threads();
+    return unit_test_result();
+}
@@ -0,0 +1,30 @@
+/**
+ * Wang Jiadong <jiadong.wang.94@outlook.com>
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+/// Minimal checks for the self-contained unit tests run by ctest, a failed check is reported and the test goes on.
+inline int &unit_test_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define EXPECT(condition)                                                                  \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++unit_test_failures();                                                        \
+        }                                                                                  \
+    } while (0)
+
+/// exit code of main
+inline int unit_test_result() {
+    if (unit_test_failures() > 0) {
+        fprintf(stderr, "%d check(s) failed\n", unit_test_failures());
+        return 1;
+    }
+    return 0;
+}